@@ -316,3 +316,41 @@ void chimes_compute_4b_props(double dr_4b[6], double dist_4b[6][3], char *atype4
     stress[7] = stress_vec[7];
     stress[8] = stress_vec[8];
 }
+
+void chimes_get_stats(long long calls[3], long long excluded[3], long long rejected[3]) {
+  for (int i = 0; i < 3; i++) {
+    calls[i]    = chimes_ptr->stats.calls[i];
+    excluded[i] = chimes_ptr->stats.excluded[i];
+    rejected[i] = chimes_ptr->stats.rejected[i];
+  }
+}
+
+void chimes_reset_stats() {
+  chimes_ptr->stats.reset();
+}
+
+void chimes_print_stats(int at_exit) {
+  // Print now (at_exit = 0) or at program exit (at_exit = 1)
+  if (at_exit) {
+    chimes_ptr->print_stats_at_exit = true;
+  } else {
+    chimes_ptr->stats.print(cout);
+  }
+}
+
+void chimes_set_badness_silent(int silent) {
+  chimes_ptr->set_badness_silent(silent != 0);
+}
+
+void chimes_print_badness_summary() {
+  chimes_ptr->print_badness_summary(cout);
+}
+
+void chimes_set_eval_mode(int mode) {
+  if ((mode < 0) || (mode > 2)) {
+    cout << "ERROR: Evaluation mode must be 0 (energy), 1 (energy and forces), or 2 (energy, forces, and stress)" << endl;
+    cout << "Received: " << mode << endl;
+    exit(0);
+  }
+  chimes_ptr->set_eval_mode((evalMode) mode);
+}
@@ -27,6 +27,21 @@ void chimes_compute_2b_props_fromf90(double *rij, double dr[3], char *type1, cha
 void chimes_compute_3b_props_fromf90(double dr_3b[3], double dist_3b[3][3], char *type1, char *type2, char *type3, double f3b[3][3], double stress[9], double *epot);
 void chimes_compute_4b_props_fromf90(double dr_4b[6], double dist_4b[6][3], char *type1, char *type2, char *type3, char *type4, double f4b[4][3], double stress[9], double *epot);
 
+/* Instrumentation counters (see chimesStats in chimesFF.h), indexed by bodiedness-2 */
+
+void chimes_get_stats(long long calls[3], long long excluded[3], long long rejected[3]);
+void chimes_reset_stats();
+void chimes_print_stats(int at_exit);
+
+/* Quantities computed: 0 = energy, 1 = energy and forces, 2 = energy, forces and stress (default) */
+
+void chimes_set_eval_mode(int mode);
+
+/* Count penalty and inner cutoff events instead of printing a warning for each (silent = 0/1 for false/true) */
+
+void chimes_set_badness_silent(int silent);
+void chimes_print_badness_summary();
+
 #ifdef __cplusplus
 }
 #endif
@@ -95,9 +95,79 @@ chimesFF::chimesFF()
     penalty_params[1] = 1.0E4;
 
     inner_smooth_distance = 0.01 ;
+    
+    tabulate_2b = false;
+    
+    mixed_precision = false;
+    
+    eval_mode = evalMode::ENERGY_FORCES_STRESS;
+    
+    // Generic compute kernels until the polynomial orders are known
+
+    compute_2B_fn = &chimesFF::compute_2B_kernel<0>;
+    compute_3B_fn = &chimesFF::compute_3B_kernel<0>;
+    compute_4B_fn = &chimesFF::compute_4B_kernel<0>;
+    
+    rank = 0;
+    print_stats_at_exit = false;
+    
+    badness        = 0;
+    badness_silent = false;
+    energy_penalty = 0.0;
 	
 }
-chimesFF::~chimesFF(){}
+chimesFF::~chimesFF()
+{
+    if (print_stats_at_exit && (rank == 0))
+        stats.print(cout);
+    
+    // Like the warnings they replace, badness summaries are printed by all ranks
+    
+    if (badness_silent)
+        for (int i=0; i<badness_counts.size(); i++)
+            if (badness_counts[i] > 0)
+            {
+                print_badness_summary(cout);
+                break;
+            }
+}
+
+void chimesStats::print(ostream & out) const
+{
+    // Prints the counters and phase timings. Evaluated interactions are the calls that were neither excluded
+    // nor beyond the outer cutoff.
+    
+    const char * phase_names[NPHASES] = {"ghost atoms", "2b neighbor list", "3b/4b neighbor lists", "1b/2b loop", "3b loop", "4b loop"};
+    
+    out << "ChIMES instrumentation";
+    
+    if (!CHIMES_INSTRUMENT)
+    {
+        out << " disabled at compile time (CHIMES_INSTRUMENT = 0)" << endl;
+        return;
+    }
+    out << ":" << endl;
+    
+    out << "    " << setw(8) << "bodies" << setw(16) << "calls" << setw(16) << "evaluated" << setw(16) << "excluded" << setw(16) << "beyond cutoff" << endl;
+    
+    for (int i=0; i<3; i++)
+        out << "    " << setw(8) << i+2 << setw(16) << calls[i] << setw(16) << calls[i]-excluded[i]-rejected[i] << setw(16) << excluded[i] << setw(16) << rejected[i] << endl;
+    
+    if (ncalculate == 0)
+        return;
+    
+    double total = 0.0;
+    
+    for (int i=0; i<NPHASES; i++)
+        total += time[i];
+    
+    out << "    Wall time over " << ncalculate << " calculate call(s):" << endl;
+    
+    for (int i=0; i<NPHASES; i++)
+        out << "    " << left << setw(24) << phase_names[i] << right << fixed << setprecision(6) << setw(14) << time[i] << " s" << setprecision(1) << setw(8) << (total > 0.0 ? 100.0*time[i]/total : 0.0) << " %" << endl;
+    
+    out << defaultfloat << setprecision(6);
+}
 
 void chimesFF::init(int mpi_rank)
 {
@@ -1327,10 +1397,79 @@ void chimesFF::read_parameters(string paramfile)
         }    
     }
     
-    param_file.close();    
+    param_file.close();
+    
+    reset_badness_counts();
+
+    build_2B_dense();
+    
+    build_3B_factorization();
+
+    select_compute_kernels();
+}
+
+void chimesFF::set_eval_mode(evalMode mode)
+{
+    eval_mode = mode;
+}
+
+evalMode chimesFF::get_eval_mode()
+{
+    return eval_mode;
+}
+
+void chimesFF::set_badness_silent(bool silent)
+{
+    badness_silent = silent;
+}
+
+void chimesFF::reset_badness_counts()
+{
+    int npairs = chimes_2b_cutoff.size();
+    
+    badness_counts  .assign(NBADNESS_EVENTS*npairs, 0);
+    badness_min_dist.assign(NBADNESS_EVENTS*npairs, 1.0e30);
+}
+
+void chimesFF::print_badness_summary(ostream & out, bool all_ranks)
+{
+    // Prints the number of badness events and the shortest distance observed, for each event kind and pair type 
+    // with at least one event
+    
+    const char * event_names[NBADNESS_EVENTS] = {"2b penalty region", "below 2b inner cutoff", "below 3b inner cutoff", "below 4b inner cutoff"};
+    
+    int npairs = chimes_2b_cutoff.size();
+    
+    if (all_ranks)
+        out << "chimesFF: " << "Badness summary (all ranks):" << endl;
+    else
+        out << "chimesFF: " << "Badness summary (rank " << rank << "):" << endl;
+    
+    bool any = false;
+    
+    for (int event=0; event<NBADNESS_EVENTS; event++)
+    {
+        for (int i=0; i<npairs; i++)
+        {
+            int idx = event*npairs + i;
+            
+            if (badness_counts[idx] == 0)
+                continue;
+            
+            any = true;
+            
+            out << "chimesFF: " << "\t" << left << setw(24) << event_names[event] << right 
+                << " pair type " << i << " (" << pair_params_atm_chem_1[i] << " " << pair_params_atm_chem_2[i] << "): "
+                << badness_counts[idx] << " events, min. distance " << fixed << setprecision(4) << badness_min_dist[idx] 
+                << defaultfloat << setprecision(6) << endl;
+        }
+    }
+    
+    if (!any)
+        out << "chimesFF: " << "\tNo penalty or inner cutoff events" << endl;
 }
 
-void chimesFF::set_polys_out_of_range(vector<double> &Tn, vector<double> &Tnd, double dx, double x, int poly_order, double inner_cutoff, double exprlen, double dx_dr)
+void chimesFF::set_polys_out_of_range(double *Tn, double *Tnd, double dx, double x, int poly_order, double inner_cutoff, double exprlen, double dx_dr)
 {
     //  Sets the value of the Chebyshev polynomials (Tn) and their derivatives (Tnd) when dx is < inner_cutoff.
     //  Tnd is the derivative with respect to the interatomic distance, not the transformed distance (x).
@@ -1373,27 +1512,6 @@ void chimesFF::set_polys_out_of_range(vector<double> &Tn, vector<double> &Tnd, d
     }     
 }
 
-inline double chimesFF::dr2_3B(const double *dr2, int i, int j, int k, int l)
-{
-    // Access the dr2 distance tensor for a 3 body interaction.
-    return(dr2[i*CHDIM*3*CHDIM + j*3*CHDIM + k*CHDIM + l]) ;
-}
-
-inline double chimesFF::dr2_4B(const double *dr2, int i, int j, int k, int l)
-{
-    // Access the dr2 distance tensor for a 4 body interaction.
-    return(dr2[i*CHDIM*6*CHDIM + j*6*CHDIM + k*CHDIM + l]) ;
-}
-
-inline void chimesFF::init_distance_tensor(double *dr2, const vector<double> & dr, int npairs)
-{
-    for ( int i = 0 ; i < npairs ; i++ )
-        for ( int j = 0 ; j < CHDIM ; j++ )
-            for ( int k = 0 ; k < npairs ; k++ )
-                for ( int l = 0 ; l < CHDIM ; l++ )
-                    dr2[i* CHDIM * npairs * CHDIM + j * npairs * CHDIM + k * CHDIM + l] = dr[i*CHDIM+j] * dr[k*CHDIM+l] ;
-}
-
 void chimesFF::compute_1B(const int typ_idx, double & energy )
 {
     // Compute 1b (input: a single atom type index... outputs (updates) energy
@@ -1402,12 +1520,19 @@ void chimesFF::compute_1B(const int typ_idx, double & energy )
 }
 
 // Overload for calls from LAMMPS                 
-void chimesFF::compute_2B(const double dx, const vector<double> & dr, const vector<int> typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes2BTmp &tmp)
+void chimesFF::compute_2B(const double dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes2BTmp &tmp)
 {              
     double dummy_force_scalar;
     compute_2B(dx, dr, typ_idxs, force, stress, energy, tmp, dummy_force_scalar);                                                               
 }
-void chimesFF::compute_2B(const double dx, const vector<double> & dr, const vector<int> typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes2BTmp &tmp, double & force_scalar_in)
+void chimesFF::compute_2B(const double dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes2BTmp &tmp, double & force_scalar_in)
+{
+    CHIMES_COUNT(stats.calls[0]);
+    (this->*compute_2B_fn)(dx, dr, typ_idxs, force, stress, energy, tmp, force_scalar_in);
+}
+
+template<int ORDER>
+void chimesFF::compute_2B_kernel(const double dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes2BTmp &tmp, double & force_scalar_in)
 {
     // Compute 2b (input: 2 atoms or distances, corresponding types... outputs (updates) force, acceleration, energy, stress
     //
@@ -1429,96 +1554,203 @@ void chimesFF::compute_2B(const double dx, const vector<double> & dr, const vect
     double  fcut;
     double  fcutderiv;
 
-    // tmp.resize(poly_orders[0]+1) ;
-    
-    // Use references for readability.
-    vector<double> &Tn = tmp.Tn ;
-    vector<double> &Tnd = tmp.Tnd ;
+    // The polynomials are summed by Clenshaw recurrences, which need no temporary storage, so tmp is unused.
+    // Order-specialized kernels (ORDER > 0) run the recurrences with compile-time bounds.
     
     pair_idx = atom_int_pair_map[ typ_idxs[0]*natmtyps + typ_idxs[1] ];
 
+    force_scalar_in = 0.0;  // Total (all coefficients + penalty) force scalar for the pair
+
     if (dx >= chimes_2b_cutoff[pair_idx][1])
+    {
+        CHIMES_COUNT(stats.rejected[0]);
         return;    
-
-    set_cheby_polys(Tn, Tnd, dx, pair_idx, chimes_2b_cutoff[pair_idx][0], chimes_2b_cutoff[pair_idx][1], 0);
-    
-    get_fcut(dx, chimes_2b_cutoff[pair_idx][1], fcut, fcutderiv);
+    }
 
     double dx_inv = ( dx > 0.0 ) ? 1.0 / dx : 1e20 ;
     
-    for(int coeffs=0; coeffs<ncoeffs_2b[pair_idx]; coeffs++)
+    double force_scalar = 0.0;  // Force scalar summed over all coefficients
+    
+    if ( tabulate_2b && (dx >= chimes_2b_cutoff[pair_idx][0]) )
     {
-        double coeff_val = chimes_2b_params[pair_idx][coeffs];        
+        // Interpolate from tables; distances below the inner cutoff always use the exact polynomials
         
-        energy += coeff_val * fcut * Tn[ chimes_2b_pows[pair_idx][coeffs]+1 ];
-                                                
-        double deriv = fcut * Tnd[ chimes_2b_pows[pair_idx][coeffs]+1 ]  + fcutderiv * Tn[ chimes_2b_pows[pair_idx][coeffs]+1 ];    
-
-        double force_scalar = coeff_val * deriv * dx_inv ; 
-
-        force[0*CHDIM+0] += force_scalar * dr[0];
-        force[0*CHDIM+1] += force_scalar * dr[1];
-        force[0*CHDIM+2] += force_scalar * dr[2];
+        double E_tab, dEdr_tab;
         
-        force[1*CHDIM+0] -= force_scalar * dr[0];
-        force[1*CHDIM+1] -= force_scalar * dr[1];
-        force[1*CHDIM+2] -= force_scalar * dr[2];
+        get_2B_tabulated(dx, pair_idx, E_tab, dEdr_tab);
+        
+        energy      += E_tab;
+        force_scalar = dEdr_tab * dx_inv;
+    }
+    else
+    {
+        // Sum the polynomial and its derivative directly from the dense coefficients (see get_2B_clenshaw)
         
-        // xx xy xz yy yz zz
-        // 0  1  2  3  4  5
+        const bool derivs = (eval_mode != evalMode::ENERGY);
         
-        // xx xy xz yx yy yz zx zy zz
-        // 0  1  2  3  4  5  6  7  8
-        // *           *           *
+        double S, dSdr;
         
-        stress[0] -= force_scalar * dr[0] * dr[0]; // xx tensor component
-        stress[1] -= force_scalar * dr[0] * dr[1]; // xy tensor component 
-        stress[2] -= force_scalar * dr[0] * dr[2]; // xz tensor component
-        stress[3] -= force_scalar * dr[1] * dr[1]; // yy tensor component
-        stress[4] -= force_scalar * dr[1] * dr[2]; // yz tensor component
-        stress[5] -= force_scalar * dr[2] * dr[2]; // zz tensor component
-            
+        get_2B_clenshaw<ORDER>(dx, pair_idx, derivs, S, dSdr);
+    
+        get_fcut(dx, chimes_2b_cutoff[pair_idx][1], fcut, fcutderiv);
+        
+        energy += fcut * S;
+        
+        if (derivs)
+            force_scalar = (fcut * dSdr + fcutderiv * S) * dx_inv;
     }
-
+    
     double E_penalty = 0.0 ;
-    double force_scalar ;
-    get_penalty(dx, pair_idx, E_penalty , force_scalar); 
+    double penalty_scalar;
+    
+    get_penalty(dx, pair_idx, E_penalty , penalty_scalar); 
 
     if ( E_penalty > 0.0 ) 
     {
-        energy += E_penalty;
-
-        force_scalar /= dx ;
-
-        // Note: force_scalar is negative (LEF) 7/30/21.
-        force[0*CHDIM+0] += force_scalar * dr[0];
-        force[0*CHDIM+1] += force_scalar * dr[1];
-        force[0*CHDIM+2] += force_scalar * dr[2];
-        
-        force[1*CHDIM+0] -= force_scalar * dr[0];
-        force[1*CHDIM+1] -= force_scalar * dr[1];
-        force[1*CHDIM+2] -= force_scalar * dr[2];
-
-        // Update stress according to penalty force. (LEF) 07/30/21
-        stress[0] -= force_scalar  * dr[0] * dr[0]; // xx tensor component
-        stress[1] -= force_scalar  * dr[0] * dr[1]; // xy tensor component 
-        stress[2] -= force_scalar  * dr[0] * dr[2]; // xz tensor component
-        stress[3] -= force_scalar  * dr[1] * dr[1]; // yy tensor component
-        stress[4] -= force_scalar  * dr[1] * dr[2]; // yz tensor component
-        stress[5] -= force_scalar  * dr[2] * dr[2]; // zz tensor component
+        energy         += E_penalty;
+        energy_penalty += E_penalty;
 
+        // Note: penalty_scalar is negative (LEF) 7/30/21.
+        force_scalar += penalty_scalar / dx ;
     }
     
-    force_scalar_in = force_scalar;
+    force_scalar_in += force_scalar;
+    
+    // Update forces and stress according to the total (coefficients + penalty) force scalar
+    
+    accumulate_cluster<2>(&force_scalar, dr.data(), force.data(), stress.data());
 }
 
 // Overload for calls from LAMMPS  
+void chimesFF::compute_2B_polys(const double dx, const vector<int> & typ_idxs, chimes2BTmp &tmp)
+{
+    int pair_idx = atom_int_pair_map[ typ_idxs[0]*natmtyps + typ_idxs[1] ];
+    
+    tmp.resize(poly_orders[0]);
+    
+    set_cheby_polys<0>(tmp.Tn.data(), tmp.Tnd.data(), dx, pair_idx, chimes_2b_cutoff[pair_idx][0], chimes_2b_cutoff[pair_idx][1], 0);
+}
+
 void chimesFF::compute_3B(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes3BTmp &tmp)
 {
-	vector<double> dummy_force_scalar(3);
-	compute_3B(dx, dr, typ_idxs, force, stress, energy, tmp, dummy_force_scalar);
+	compute_3B(dx, dr, typ_idxs, force, stress, energy, tmp, tmp.force_scalar);
 }
 void chimesFF::compute_3B(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes3BTmp &tmp, vector<double> & force_scalar_in)
+{
+    CHIMES_COUNT(stats.calls[1]);
+    (this->*compute_3B_fn)(dx, dr, typ_idxs, force, stress, energy, tmp, force_scalar_in);
+}
+
+inline void chimesFF::contract_3B(const int tripidx, const int *mapped_pair_idx, const double * const * G, const double * const * dG, const double *dx, const double *dr, 
+                                  double *force, double *stress, double & energy, double *force_scalar_in, const bool derivs)
+{
+    const int natoms = 3;
+    const int npairs = natoms*(natoms-1)/2;
+    
+    force_scalar_in[0] = 0.0;
+    force_scalar_in[1] = 0.0;
+    force_scalar_in[2] = 0.0;
+    
+    // Index the edges by parameter file constituent pair, to match the ordering of the factorized powers
+    
+    const double *G_s[npairs], *dG_s[npairs];
+    
+    for (int i=0; i<npairs; i++)
+    {
+        G_s [ mapped_pair_idx[i] ] = G [i];
+        dG_s[ mapped_pair_idx[i] ] = dG[i];
+    }
+    
+    // Contract the coefficient tensor one constituent pair at a time (see build_3B_factorization), 
+    // accumulating the energy and its derivative with respect to each constituent pair distance.
+    
+    const int    * p0     = chimes_3b_fact_p0    [tripidx].data();
+    const int    * p0_end = chimes_3b_fact_p0_end[tripidx].data();
+    const int    * p1     = chimes_3b_fact_p1    [tripidx].data();
+    const int    * p1_end = chimes_3b_fact_p1_end[tripidx].data();
+    const int    * p2     = chimes_3b_fact_p2    [tripidx].data();
+    const double * coeff  = chimes_3b_fact_params[tripidx].data();
+    
+    const int n_p0 = chimes_3b_fact_p0[tripidx].size();
+    
+    double E = 0.0;
+    
+    int j = 0;
+    int k = 0;
+    
+    if (!derivs)
+    {
+        for (int i=0; i<n_p0; i++)
+        {
+            double E_1 = 0.0;
+            
+            for ( ; j<p0_end[i]; j++)
+            {
+                double E_2 = 0.0;
+                
+                for ( ; k<p1_end[j]; k++)
+                    E_2 += coeff[k] * G_s[2][ p2[k] ];
+                
+                E_1 += G_s[1][ p1[j] ] * E_2;
+            }
+            
+            E += G_s[0][ p0[i] ] * E_1;
+        }
+        
+        energy += E;
+        
+        return;
+    }
+    
+    double dE_s[npairs] = {0.0, 0.0, 0.0};
+
+    for (int i=0; i<n_p0; i++)
+    {
+        double E_1   = 0.0;    // sum_p1 G1[p1] * E_2
+        double dE_11 = 0.0;    // sum_p1 dG1[p1] * E_2
+        double dE_12 = 0.0;    // sum_p1 G1[p1] * dE_2
+
+        for ( ; j<p0_end[i]; j++)
+        {
+            double E_2  = 0.0;    // sum_p2 c * G2[p2]
+            double dE_2 = 0.0;    // sum_p2 c * dG2[p2]
+            
+            for ( ; k<p1_end[j]; k++)
+            {
+                E_2  += coeff[k] * G_s [2][ p2[k] ];
+                dE_2 += coeff[k] * dG_s[2][ p2[k] ];
+            }
+            
+            E_1   += G_s [1][ p1[j] ] * E_2;
+            dE_11 += dG_s[1][ p1[j] ] * E_2;
+            dE_12 += G_s [1][ p1[j] ] * dE_2;
+        }
+        
+        E       += G_s [0][ p0[i] ] * E_1;
+        dE_s[0] += dG_s[0][ p0[i] ] * E_1;
+        dE_s[1] += G_s [0][ p0[i] ] * dE_11;
+        dE_s[2] += G_s [0][ p0[i] ] * dE_12;
+    }
+    
+    energy += E;
+    
+    // Per-pair force scalars, (dE/dr)/r, for the runtime pair ordering (ij, ik, jk)
+    
+    double force_scalar[npairs] ;
+    
+    for (int i=0; i<npairs; i++)
+    {
+        force_scalar[i]    = dE_s[ mapped_pair_idx[i] ] / dx[i];
+        force_scalar_in[i] = force_scalar[i];
+    }
+
+    // Accumulate forces/stresses once per pair
+    
+    accumulate_cluster<natoms>(force_scalar, dr, force, stress);
+}
+
+template<int ORDER>
+void chimesFF::compute_3B_kernel(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes3BTmp &tmp, vector<double> & force_scalar_in)
 {
     // Compute 3b (input: 3 atoms or distances, corresponding types... outputs (updates) force, acceleration, energy, stress
     //
@@ -1539,20 +1771,21 @@ void chimesFF::compute_3B(const vector<double> & dx, const vector<double> & dr,
     const int natoms = 3;                   // Number of atoms in an interaction set
     const int npairs = natoms*(natoms-1)/2; // Number of pairs in an interaction set
     
-    // tmp.resize(poly_orders[1]) ;
+    // Order-specialized kernels (ORDER > 0) keep the polynomials on the stack; the generic kernel uses tmp.
     
-    vector<double> &Tn_ij  = tmp.Tn_ij ;
-    vector<double> &Tn_ik  = tmp.Tn_ik ;
-    vector<double> &Tn_jk  = tmp.Tn_jk ;   // The Chebyshev polymonials
-    vector<double> &Tnd_ij = tmp.Tnd_ij ;
-    vector<double> &Tnd_ik = tmp.Tnd_ik ;
-    vector<double> &Tnd_jk = tmp.Tnd_jk ;  // The Chebyshev polymonial derivatives
+    double Tn_fixed[npairs][ORDER+1], Tnd_fixed[npairs][ORDER+1];
+    
+    double *Tn_ij  = (ORDER > 0) ? Tn_fixed[0]  : tmp.Tn_ij.data() ;
+    double *Tn_ik  = (ORDER > 0) ? Tn_fixed[1]  : tmp.Tn_ik.data() ;
+    double *Tn_jk  = (ORDER > 0) ? Tn_fixed[2]  : tmp.Tn_jk.data() ;   // The Chebyshev polymonials
+    double *Tnd_ij = (ORDER > 0) ? Tnd_fixed[0] : tmp.Tnd_ij.data() ;
+    double *Tnd_ik = (ORDER > 0) ? Tnd_fixed[1] : tmp.Tnd_ik.data() ;
+    double *Tnd_jk = (ORDER > 0) ? Tnd_fixed[2] : tmp.Tnd_jk.data() ;  // The Chebyshev polymonial derivatives
 
     // Avoid allocating std::vector quantities.  Heap memory allocation is slow on the GPU.
     // fixed-length C arrays are allocated on the stack.
     double fcut[npairs] ;
     double fcutderiv[npairs] ;
-    double deriv[npairs];
 
 #if DEBUG == 1  
     if ( dr.size() != 9 )
@@ -1562,37 +1795,42 @@ void chimesFF::compute_3B(const vector<double> & dx, const vector<double> & dr,
     }
 #endif
 
+    // Per-pair force scalars, summed over all coefficients
+    
+    force_scalar_in[0] = 0.0;
+    force_scalar_in[1] = 0.0;
+    force_scalar_in[2] = 0.0;
+
     int type_idx =  typ_idxs[0]*natmtyps*natmtyps + typ_idxs[1]*natmtyps + typ_idxs[2] ;
     int tripidx = atom_int_trip_map[type_idx];
 
     if(tripidx < 0)    // Skipping an excluded interaction
+    {
+        CHIMES_COUNT(stats.excluded[1]);
         return;
+    }
         
     // Check whether cutoffs are within allowed ranges
     vector<int> & mapped_pair_idx = pair_int_trip_map[type_idx] ;
 
    
-    if (dx[0] >= chimes_3b_cutoff[ tripidx ][1][mapped_pair_idx[0]])    // ij
-        return;    
-    if (dx[1] >= chimes_3b_cutoff[ tripidx ][1][mapped_pair_idx[1]])    // ik
-        return;    
-    if (dx[2] >= chimes_3b_cutoff[ tripidx ][1][mapped_pair_idx[2]])    // jk
+    if ((dx[0] >= chimes_3b_cutoff[ tripidx ][1][mapped_pair_idx[0]])      // ij
+     || (dx[1] >= chimes_3b_cutoff[ tripidx ][1][mapped_pair_idx[1]])      // ik
+     || (dx[2] >= chimes_3b_cutoff[ tripidx ][1][mapped_pair_idx[2]]))     // jk
+    {
+        CHIMES_COUNT(stats.rejected[1]);
         return;    
+    }
      
     // At this point, all distances are within allowed ranges. We can now proceed to the force/stress/energy calculation
 
-#ifdef USE_DISTANCE_TENSOR  
-    // Tensor product of displacement vectors.
-    double dr2[CHDIM*CHDIM*npairs*npairs] ;
-    init_distance_tensor(dr2, dr, npairs) ;
-#endif
-
-
-    // Set up the polynomials
+    // Set up the polynomials (and their derivatives, unless only the energy is needed)
+    
+    const bool derivs = (eval_mode != evalMode::ENERGY);
 
-    set_cheby_polys(Tn_ij, Tnd_ij, dx[0], atom_int_pair_map[ typ_idxs[0]*natmtyps + typ_idxs[1] ], chimes_3b_cutoff[tripidx][0][mapped_pair_idx[0]], chimes_3b_cutoff[tripidx][1][mapped_pair_idx[0]], 1);
-    set_cheby_polys(Tn_ik, Tnd_ik, dx[1], atom_int_pair_map[ typ_idxs[0]*natmtyps + typ_idxs[2] ], chimes_3b_cutoff[tripidx][0][mapped_pair_idx[1]], chimes_3b_cutoff[tripidx][1][mapped_pair_idx[1]], 1);
-    set_cheby_polys(Tn_jk, Tnd_jk, dx[2], atom_int_pair_map[ typ_idxs[1]*natmtyps + typ_idxs[2] ], chimes_3b_cutoff[tripidx][0][mapped_pair_idx[2]], chimes_3b_cutoff[tripidx][1][mapped_pair_idx[2]], 1);
+    set_cheby_polys<ORDER>(Tn_ij, Tnd_ij, dx[0], atom_int_pair_map[ typ_idxs[0]*natmtyps + typ_idxs[1] ], chimes_3b_cutoff[tripidx][0][mapped_pair_idx[0]], chimes_3b_cutoff[tripidx][1][mapped_pair_idx[0]], 1, derivs);
+    set_cheby_polys<ORDER>(Tn_ik, Tnd_ik, dx[1], atom_int_pair_map[ typ_idxs[0]*natmtyps + typ_idxs[2] ], chimes_3b_cutoff[tripidx][0][mapped_pair_idx[1]], chimes_3b_cutoff[tripidx][1][mapped_pair_idx[1]], 1, derivs);
+    set_cheby_polys<ORDER>(Tn_jk, Tnd_jk, dx[2], atom_int_pair_map[ typ_idxs[1]*natmtyps + typ_idxs[2] ], chimes_3b_cutoff[tripidx][0][mapped_pair_idx[2]], chimes_3b_cutoff[tripidx][1][mapped_pair_idx[2]], 1, derivs);
     
     
     // Set up the smoothing functions
@@ -1600,131 +1838,122 @@ void chimesFF::compute_3B(const vector<double> & dx, const vector<double> & dr,
     get_fcut(dx[0], chimes_3b_cutoff[tripidx][1][mapped_pair_idx[0]], fcut[0], fcutderiv[0]);
     get_fcut(dx[1], chimes_3b_cutoff[tripidx][1][mapped_pair_idx[1]], fcut[1], fcutderiv[1]);
     get_fcut(dx[2], chimes_3b_cutoff[tripidx][1][mapped_pair_idx[2]], fcut[2], fcutderiv[2]);
-    double fcut_all =  fcut[0] * fcut[1] * fcut[2] ;
-
-    // Product of 2 fcuts divided by dx. Index i = product of all fcuts except i.
-    double fcut_2[npairs] ;
-    fcut_2[0] = fcut[1] * fcut[2] / dx[0] ;
-    fcut_2[1] = fcut[0] * fcut[2] / dx[1] ;
-    fcut_2[2] = fcut[0] * fcut[1] / dx[2] ;
-
-    // Start the force/stress/energy calculation
-    double coeff;
-    int powers[npairs] ;
-    double force_scalar[npairs] ;
 
-    for(int coeffs=0; coeffs<ncoeffs_3b[tripidx]; coeffs++)
+    // Fold the smoothing functions into the polynomials, in place: Tn -> fcut * Tn and 
+    // Tnd -> d(fcut * Tn)/dr. Each edge then contributes a single factor (and derivative) per coefficient.
+    
+    double *G[npairs]  = { Tn_ij,  Tn_ik,  Tn_jk  };
+    double *dG[npairs] = { Tnd_ij, Tnd_ik, Tnd_jk };
+    
+    const int npows = (ORDER > 0) ? ORDER+1 : poly_orders[1]+1;
+    
+    for (int i=0; i<npairs; i++)
     {
-        coeff = chimes_3b_params[tripidx][coeffs];
-        
-        powers[0] = chimes_3b_powers[tripidx][coeffs][mapped_pair_idx[0]];
-        powers[1] = chimes_3b_powers[tripidx][coeffs][mapped_pair_idx[1]];
-        powers[2] = chimes_3b_powers[tripidx][coeffs][mapped_pair_idx[2]];
-        
-        energy += coeff * fcut_all * Tn_ij[ powers[0] ] * Tn_ik[ powers[1] ] * Tn_jk[ powers[2] ];    
-
-        deriv[0] = fcut[0] * Tnd_ij[ powers[0] ] + fcutderiv[0] * Tn_ij[ powers[0] ];
-        deriv[1] = fcut[1] * Tnd_ik[ powers[1] ] + fcutderiv[1] * Tn_ik[ powers[1] ];
-        deriv[2] = fcut[2] * Tnd_jk[ powers[2] ] + fcutderiv[2] * Tn_jk[ powers[2] ];
-
-        force_scalar[0]  = coeff * deriv[0] * fcut_2[0] * Tn_ik[powers[1]]  * Tn_jk[powers[2]] ;
-        force_scalar[1]  = coeff * deriv[1] * fcut_2[1] * Tn_ij[powers[0]]  * Tn_jk[powers[2]] ;
-        force_scalar[2]  = coeff * deriv[2] * fcut_2[2] * Tn_ij[powers[0]]  * Tn_ik[powers[1]] ;
-        
-        // Accumulate forces/stresses on/from the ij pair
-        
-        force[0*CHDIM+0] += force_scalar[0] * dr[0*CHDIM+0];
-        force[0*CHDIM+1] += force_scalar[0] * dr[0*CHDIM+1];
-        force[0*CHDIM+2] += force_scalar[0] * dr[0*CHDIM+2];
-
-        force[1*CHDIM+0] -= force_scalar[0] * dr[0*CHDIM+0];
-        force[1*CHDIM+1] -= force_scalar[0] * dr[0*CHDIM+1];
-        force[1*CHDIM+2] -= force_scalar[0] * dr[0*CHDIM+2];   
-
-        // dr2_3B looks like a function call, but the optimizer should remove it entirely.
-#ifdef USE_DISTANCE_TENSOR
-        // New stress code.
-        stress[0] -= force_scalar[0]  * dr2_3B(dr2,0,0,0,0); // xx tensor component
-        stress[1] -= force_scalar[0]  * dr2_3B(dr2,0,0,0,1); // xy tensor component
-        stress[2] -= force_scalar[0]  * dr2_3B(dr2,0,0,0,2); // xz tensor component
-        stress[3] -= force_scalar[0]  * dr2_3B(dr2,0,1,0,1); // yy tensor component
-        stress[4] -= force_scalar[0]  * dr2_3B(dr2,0,1,0,2); // yz tensor component
-        stress[5] -= force_scalar[0]  * dr2_3B(dr2,0,2,0,2); // zz tensor component
-        
-#else
-        stress[0] -= force_scalar[0]  * dr[0*CHDIM+0] * dr[0*CHDIM+0]; // xx tensor component
-        stress[1] -= force_scalar[0]  * dr[0*CHDIM+0] * dr[0*CHDIM+1]; // xy tensor component
-        stress[2] -= force_scalar[0]  * dr[0*CHDIM+0] * dr[0*CHDIM+2]; // xz tensor component
-        stress[3] -= force_scalar[0]  * dr[0*CHDIM+1] * dr[0*CHDIM+1]; // yy tensor component
-        stress[4] -= force_scalar[0]  * dr[0*CHDIM+1] * dr[0*CHDIM+2]; // yz tensor component
-        stress[5] -= force_scalar[0]  * dr[0*CHDIM+2] * dr[0*CHDIM+2]; // zz tensor component
-#endif        
-        // Accumulate forces/stresses on/from the ik pair
-        
-        force[0*CHDIM+0] += force_scalar[1] * dr[1*CHDIM+0];
-        force[0*CHDIM+1] += force_scalar[1] * dr[1*CHDIM+1];
-        force[0*CHDIM+2] += force_scalar[1] * dr[1*CHDIM+2];
-
-        force[2*CHDIM+0] -= force_scalar[1] * dr[1*CHDIM+0];
-        force[2*CHDIM+1] -= force_scalar[1] * dr[1*CHDIM+1];
-        force[2*CHDIM+2] -= force_scalar[1] * dr[1*CHDIM+2];   
-
-#ifdef USE_DISTANCE_TENSOR
-        stress[0] -= force_scalar[1]  * dr2_3B(dr2,1,0,1,0); // xx tensor component
-        stress[1] -= force_scalar[1]  * dr2_3B(dr2,1,0,1,1); // xy tensor component
-        stress[2] -= force_scalar[1]  * dr2_3B(dr2,1,0,1,2); // xz tensor component
-        stress[3] -= force_scalar[1]  * dr2_3B(dr2,1,1,1,1); // yy tensor component
-        stress[4] -= force_scalar[1]  * dr2_3B(dr2,1,1,1,2); // yz tensor component
-        stress[5] -= force_scalar[1]  * dr2_3B(dr2,1,2,1,2); // zz tensor component
-#else
-        stress[0] -= force_scalar[1]  * dr[1*CHDIM+0] * dr[1*CHDIM+0]; // xx tensor component
-        stress[1] -= force_scalar[1]  * dr[1*CHDIM+0] * dr[1*CHDIM+1]; // xy tensor component
-        stress[2] -= force_scalar[1]  * dr[1*CHDIM+0] * dr[1*CHDIM+2]; // xz tensor component
-        stress[3] -= force_scalar[1]  * dr[1*CHDIM+1] * dr[1*CHDIM+1]; // yy tensor component
-        stress[4] -= force_scalar[1]  * dr[1*CHDIM+1] * dr[1*CHDIM+2]; // yz tensor component
-        stress[5] -= force_scalar[1]  * dr[1*CHDIM+2] * dr[1*CHDIM+2]; // zz tensor component
-#endif
+        if (derivs)
+            for (int p=0; p<npows; p++)
+                dG[i][p] = fcut[i] * dG[i][p] + fcutderiv[i] * G[i][p];
         
-        // Accumulate forces/stresses on/from the jk pair
-        
-        force[1*CHDIM+0] += force_scalar[2] * dr[2*CHDIM+0];
-        force[1*CHDIM+1] += force_scalar[2] * dr[2*CHDIM+1];
-        force[1*CHDIM+2] += force_scalar[2] * dr[2*CHDIM+2];
-
-        force[2*CHDIM+0] -= force_scalar[2] * dr[2*CHDIM+0];
-        force[2*CHDIM+1] -= force_scalar[2] * dr[2*CHDIM+1];
-        force[2*CHDIM+2] -= force_scalar[2] * dr[2*CHDIM+2];   
-
-#ifdef USE_DISTANCE_TENSOR
-        stress[0] -= force_scalar[2]  * dr2_3B(dr2,2,0,2,0); // xx tensor component
-        stress[1] -= force_scalar[2]  * dr2_3B(dr2,2,0,2,1); // xy tensor component
-        stress[2] -= force_scalar[2]  * dr2_3B(dr2,2,0,2,2); // xz tensor component
-        stress[3] -= force_scalar[2]  * dr2_3B(dr2,2,1,2,1); // yy tensor component
-        stress[4] -= force_scalar[2]  * dr2_3B(dr2,2,1,2,2); // yz tensor component
-        stress[5] -= force_scalar[2]  * dr2_3B(dr2,2,2,2,2); // zz tensor component
-#else        
-        stress[0] -= force_scalar[2]  * dr[2*CHDIM+0] * dr[2*CHDIM+0]; // xx tensor component
-        stress[1] -= force_scalar[2]  * dr[2*CHDIM+0] * dr[2*CHDIM+1]; // xy tensor component
-        stress[2] -= force_scalar[2]  * dr[2*CHDIM+0] * dr[2*CHDIM+2]; // xz tensor component
-        stress[3] -= force_scalar[2]  * dr[2*CHDIM+1] * dr[2*CHDIM+1]; // yy tensor component
-        stress[4] -= force_scalar[2]  * dr[2*CHDIM+1] * dr[2*CHDIM+2]; // yz tensor component
-        stress[5] -= force_scalar[2]  * dr[2*CHDIM+2] * dr[2*CHDIM+2]; // zz tensor component
-#endif        
+        for (int p=0; p<npows; p++)
+            G[i][p] = fcut[i] * G[i][p];
     }
     
-    force_scalar_in[0] = force_scalar[0];
-    force_scalar_in[1] = force_scalar[1];
-    force_scalar_in[2] = force_scalar[2];
-
-    return;    
+    contract_3B(tripidx, mapped_pair_idx.data(), G, dG, dx.data(), dr.data(), force.data(), stress.data(), energy, force_scalar_in.data(), derivs);
 }
 
 void chimesFF::compute_4B(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes4BTmp &tmp)
 {              
-        vector<double> dummy_force_scalar(6);
-        compute_4B(dx, dr, typ_idxs, force, stress, energy, tmp, dummy_force_scalar);                                                               
+        compute_4B(dx, dr, typ_idxs, force, stress, energy, tmp, tmp.force_scalar);
 }
 void chimesFF::compute_4B(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes4BTmp &tmp, vector<double> & force_scalar_in)
+{
+    CHIMES_COUNT(stats.calls[2]);
+    (this->*compute_4B_fn)(dx, dr, typ_idxs, force, stress, energy, tmp, force_scalar_in);
+}
+
+inline void chimesFF::contract_4B(const int quadidx, const int *mapped_pair_idx, const double * const * G, const double * const * dG, const double *dx, const double *dr, 
+                                  double *force, double *stress, double & energy, double *force_scalar_in, const bool derivs)
+{
+    const int natoms = 4;
+    const int npairs = natoms*(natoms-1)/2;
+    
+    for(int i=0; i<npairs; i++)
+        force_scalar_in[i] = 0.0;
+    
+    const int    ncoeffs = ncoeffs_4b[quadidx];
+    const double * coeff = chimes_4b_params[quadidx].data();
+    
+    double E = 0.0;
+    
+    if (!derivs)
+    {
+        for(int c=0; c<ncoeffs; c++)
+        {
+            const int * pows = chimes_4b_powers[quadidx][c].data();
+            
+            E += coeff[c] 
+               * G[0][ pows[mapped_pair_idx[0]] ] * G[1][ pows[mapped_pair_idx[1]] ] * G[2][ pows[mapped_pair_idx[2]] ]
+               * G[3][ pows[mapped_pair_idx[3]] ] * G[4][ pows[mapped_pair_idx[4]] ] * G[5][ pows[mapped_pair_idx[5]] ];
+        }
+        
+        energy += E;
+        
+        return;
+    }
+    
+    // For each coefficient, the derivative with respect to edge i is the product of dG of edge i with G of all other 
+    // edges, obtained from prefix and suffix products of G
+    
+    double dE[npairs] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    
+    int    powers[npairs];
+    double g     [npairs];
+    double pre   [npairs+1];    // pre[i] = g[0]*...*g[i-1]
+    double suf   [npairs+1];    // suf[i] = g[i]*...*g[npairs-1]
+    
+    pre[0]      = 1.0;
+    suf[npairs] = 1.0;
+
+    for(int c=0; c<ncoeffs; c++)
+    {
+        const int * pows = chimes_4b_powers[quadidx][c].data();
+        
+        for (int i=0; i<npairs; i++)
+        {
+            powers[i] = pows[mapped_pair_idx[i]];
+            g[i]      = G[i][powers[i]];
+        }
+        
+        for (int i=0; i<npairs; i++)
+            pre[i+1] = pre[i] * g[i];
+        
+        for (int i=npairs-1; i>=0; i--)
+            suf[i] = suf[i+1] * g[i];
+        
+        E += coeff[c] * pre[npairs];
+        
+        for (int i=0; i<npairs; i++)
+            dE[i] += coeff[c] * dG[i][powers[i]] * pre[i] * suf[i+1];
+    }
+    
+    energy += E;
+    
+    // Per-pair force scalars, (dE/dr)/r
+    
+    double force_scalar[npairs];
+    
+    for(int i=0; i<npairs; i++)
+    {
+        force_scalar[i]    = dE[i] / dx[i];
+        force_scalar_in[i] = force_scalar[i];
+    }
+    
+    // Accumulate forces/stresses once per pair, from the force scalars summed over all coefficients
+    
+    accumulate_cluster<natoms>(force_scalar, dr, force, stress);
+}
+
+template<int ORDER>
+void chimesFF::compute_4B_kernel(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes4BTmp &tmp, vector<double> & force_scalar_in)
 {
     // Compute 3b (input: 3 atoms or distances, corresponding types... outputs (updates) force, acceleration, energy, stress
     //
@@ -1747,7 +1976,6 @@ void chimesFF::compute_4B(const vector<double> & dx, const vector<double> & dr,
 
     double fcut[npairs] ;
     double fcutderiv[npairs] ;
-    double deriv[npairs] ;
     
 
 #if DEBUG == 1  
@@ -1757,19 +1985,28 @@ void chimesFF::compute_4B(const vector<double> & dx, const vector<double> & dr,
     }
 #endif      
 
-    vector<double> &Tn_ij   = tmp.Tn_ij ;
-    vector<double> &Tn_ik   = tmp.Tn_ik ;
-    vector<double> &Tn_il   = tmp.Tn_il ;
-    vector<double> &Tn_jk   = tmp.Tn_jk ;
-    vector<double> &Tn_jl   = tmp.Tn_jl ;
-    vector<double> &Tn_kl   = tmp.Tn_kl ;        
+    // Order-specialized kernels (ORDER > 0) keep the polynomials on the stack; the generic kernel uses tmp.
+    
+    double Tn_fixed[npairs][ORDER+1], Tnd_fixed[npairs][ORDER+1];
+    
+    double *Tn_ij   = (ORDER > 0) ? Tn_fixed[0]  : tmp.Tn_ij.data() ;
+    double *Tn_ik   = (ORDER > 0) ? Tn_fixed[1]  : tmp.Tn_ik.data() ;
+    double *Tn_il   = (ORDER > 0) ? Tn_fixed[2]  : tmp.Tn_il.data() ;
+    double *Tn_jk   = (ORDER > 0) ? Tn_fixed[3]  : tmp.Tn_jk.data() ;
+    double *Tn_jl   = (ORDER > 0) ? Tn_fixed[4]  : tmp.Tn_jl.data() ;
+    double *Tn_kl   = (ORDER > 0) ? Tn_fixed[5]  : tmp.Tn_kl.data() ;        
                                           
-    vector<double> &Tnd_ij  = tmp.Tnd_ij ;
-    vector<double> &Tnd_ik  = tmp.Tnd_ik ;
-    vector<double> &Tnd_il  = tmp.Tnd_il ;  
-    vector<double> &Tnd_jk  = tmp.Tnd_jk ;
-    vector<double> &Tnd_jl  = tmp.Tnd_jl ;
-    vector<double> &Tnd_kl  = tmp.Tnd_kl ;              
+    double *Tnd_ij  = (ORDER > 0) ? Tnd_fixed[0] : tmp.Tnd_ij.data() ;
+    double *Tnd_ik  = (ORDER > 0) ? Tnd_fixed[1] : tmp.Tnd_ik.data() ;
+    double *Tnd_il  = (ORDER > 0) ? Tnd_fixed[2] : tmp.Tnd_il.data() ;  
+    double *Tnd_jk  = (ORDER > 0) ? Tnd_fixed[3] : tmp.Tnd_jk.data() ;
+    double *Tnd_jl  = (ORDER > 0) ? Tnd_fixed[4] : tmp.Tnd_jl.data() ;
+    double *Tnd_kl  = (ORDER > 0) ? Tnd_fixed[5] : tmp.Tnd_kl.data() ;              
+
+    // Per-pair force scalars, summed over all coefficients
+    
+    for(int i=0; i<npairs; i++)
+        force_scalar_in[i] = 0.0;
 
     int idx = typ_idxs[0]*natmtyps*natmtyps*natmtyps
         + typ_idxs[1]*natmtyps*natmtyps + typ_idxs[2]*natmtyps + typ_idxs[3] ;
@@ -1777,247 +2014,803 @@ void chimesFF::compute_4B(const vector<double> & dx, const vector<double> & dr,
     int quadidx = atom_int_quad_map[idx] ;
 
     if(quadidx < 0)    // Skipping an excluded interaction
+    {
+        CHIMES_COUNT(stats.excluded[2]);
         return;
+    }
 
     vector<int> & mapped_pair_idx = pair_int_quad_map[idx] ;
 
     // Check whether cutoffs are within allowed ranges
 
     for(int i=0; i<npairs; i++)
+    {
         if (dx[i] >= chimes_4b_cutoff[ quadidx ][1][mapped_pair_idx[i]])
+        {
+            CHIMES_COUNT(stats.rejected[2]);
             return;    
+        }
+    }
 
     // At this point, all distances are within allowed ranges. We can now proceed to the force/stress/energy calculation
     
-    // Set up the polynomials
-    
-    set_cheby_polys(Tn_ij, Tnd_ij, dx[0], atom_int_pair_map[ typ_idxs[0]*natmtyps + typ_idxs[1] ], chimes_4b_cutoff[quadidx][0][mapped_pair_idx[0]], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[0]], 2);
-    set_cheby_polys(Tn_ik, Tnd_ik, dx[1], atom_int_pair_map[ typ_idxs[0]*natmtyps + typ_idxs[2] ], chimes_4b_cutoff[quadidx][0][mapped_pair_idx[1]], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[1]], 2);
-    set_cheby_polys(Tn_il, Tnd_il, dx[2], atom_int_pair_map[ typ_idxs[0]*natmtyps + typ_idxs[3] ], chimes_4b_cutoff[quadidx][0][mapped_pair_idx[2]], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[2]], 2);
-    set_cheby_polys(Tn_jk, Tnd_jk, dx[3], atom_int_pair_map[ typ_idxs[1]*natmtyps + typ_idxs[2] ], chimes_4b_cutoff[quadidx][0][mapped_pair_idx[3]], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[3]], 2);
-    set_cheby_polys(Tn_jl, Tnd_jl, dx[4], atom_int_pair_map[ typ_idxs[1]*natmtyps + typ_idxs[3] ], chimes_4b_cutoff[quadidx][0][mapped_pair_idx[4]], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[4]], 2);
-    set_cheby_polys(Tn_kl, Tnd_kl, dx[5], atom_int_pair_map[ typ_idxs[2]*natmtyps + typ_idxs[3] ], chimes_4b_cutoff[quadidx][0][mapped_pair_idx[5]], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[5]], 2);     
+    // Set up the polynomials (and their derivatives, unless only the energy is needed)
     
-#ifdef USE_DISTANCE_TENSOR  
-    // Tensor product of displacement vectors.
-    double dr2[CHDIM*CHDIM*npairs*npairs] ;
-    init_distance_tensor(dr2, dr, npairs) ;
-#endif
+    const bool derivs = (eval_mode != evalMode::ENERGY);
     
+    set_cheby_polys<ORDER>(Tn_ij, Tnd_ij, dx[0], atom_int_pair_map[ typ_idxs[0]*natmtyps + typ_idxs[1] ], chimes_4b_cutoff[quadidx][0][mapped_pair_idx[0]], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[0]], 2, derivs);
+    set_cheby_polys<ORDER>(Tn_ik, Tnd_ik, dx[1], atom_int_pair_map[ typ_idxs[0]*natmtyps + typ_idxs[2] ], chimes_4b_cutoff[quadidx][0][mapped_pair_idx[1]], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[1]], 2, derivs);
+    set_cheby_polys<ORDER>(Tn_il, Tnd_il, dx[2], atom_int_pair_map[ typ_idxs[0]*natmtyps + typ_idxs[3] ], chimes_4b_cutoff[quadidx][0][mapped_pair_idx[2]], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[2]], 2, derivs);
+    set_cheby_polys<ORDER>(Tn_jk, Tnd_jk, dx[3], atom_int_pair_map[ typ_idxs[1]*natmtyps + typ_idxs[2] ], chimes_4b_cutoff[quadidx][0][mapped_pair_idx[3]], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[3]], 2, derivs);
+    set_cheby_polys<ORDER>(Tn_jl, Tnd_jl, dx[4], atom_int_pair_map[ typ_idxs[1]*natmtyps + typ_idxs[3] ], chimes_4b_cutoff[quadidx][0][mapped_pair_idx[4]], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[4]], 2, derivs);
+    set_cheby_polys<ORDER>(Tn_kl, Tnd_kl, dx[5], atom_int_pair_map[ typ_idxs[2]*natmtyps + typ_idxs[3] ], chimes_4b_cutoff[quadidx][0][mapped_pair_idx[5]], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[5]], 2, derivs);     
     
     // Set up the smoothing functions
     for (int i=0; i<npairs; i++)    
         get_fcut(dx[i], chimes_4b_cutoff[quadidx][1][mapped_pair_idx[i]], fcut[i], fcutderiv[i]);
 
-
-    // Product of all 6 fcuts.
-    double fcut_all = fcut[0] * fcut[1] * fcut[2] * fcut[3] * fcut[4] * fcut[5]  ;
-
-    // Product of 5 fcuts divided by dx.
-    double fcut_5[npairs] ;
-    fcut_5[0] = fcut[1] * fcut[2] * fcut[3] * fcut[4] * fcut[5] / dx[0] ;
-    fcut_5[1] = fcut[0] * fcut[2] * fcut[3] * fcut[4] * fcut[5] / dx[1] ;
-    fcut_5[2] = fcut[0] * fcut[1] * fcut[3] * fcut[4] * fcut[5] / dx[2] ;
-    fcut_5[3] = fcut[0] * fcut[1] * fcut[2] * fcut[4] * fcut[5] / dx[3] ;
-    fcut_5[4] = fcut[0] * fcut[1] * fcut[2] * fcut[3] * fcut[5] / dx[4] ;
-    fcut_5[5] = fcut[0] * fcut[1] * fcut[2] * fcut[3] * fcut[4] / dx[5] ;
+    // Fold the smoothing functions into the polynomials, in place (as in compute_3B_kernel)
     
-    // Start the force/stress/energy calculation
-        
-    double coeff;
-    int powers[npairs] ;
-    double force_scalar[npairs] ;
-
-    for(int coeffs=0; coeffs<ncoeffs_4b[quadidx]; coeffs++)
+    double *G[npairs]  = { Tn_ij,  Tn_ik,  Tn_il,  Tn_jk,  Tn_jl,  Tn_kl  };
+    double *dG[npairs] = { Tnd_ij, Tnd_ik, Tnd_il, Tnd_jk, Tnd_jl, Tnd_kl };
+    
+    const int npows = (ORDER > 0) ? ORDER+1 : poly_orders[2]+1;
+    
+    for (int i=0; i<npairs; i++)
     {
-        coeff = chimes_4b_params[quadidx][coeffs];
-        
-        for (int i=0; i<npairs; i++)
-            powers[i] = chimes_4b_powers[quadidx][coeffs][mapped_pair_idx[i]];
-
-        double Tn_ij_ik_il =  Tn_ij[ powers[0] ] * Tn_ik[ powers[1] ] * Tn_il[ powers[2] ] ;
-        double Tn_jk_jl    =  Tn_jk[ powers[3] ] * Tn_jl[ powers[4] ] ;
-        double Tn_kl_5     =  Tn_kl[ powers[5] ] ;
-
-        energy += coeff * fcut_all * Tn_ij_ik_il * Tn_jk_jl * Tn_kl_5 ;        
-
-        deriv[0] = fcut[0] * Tnd_ij[ powers[0] ] + fcutderiv[0] * Tn_ij[ powers[0] ];
-        deriv[1] = fcut[1] * Tnd_ik[ powers[1] ] + fcutderiv[1] * Tn_ik[ powers[1] ];
-        deriv[2] = fcut[2] * Tnd_il[ powers[2] ] + fcutderiv[2] * Tn_il[ powers[2] ];
-        deriv[3] = fcut[3] * Tnd_jk[ powers[3] ] + fcutderiv[3] * Tn_jk[ powers[3] ];
-        deriv[4] = fcut[4] * Tnd_jl[ powers[4] ] + fcutderiv[4] * Tn_jl[ powers[4] ];
-        deriv[5] = fcut[5] * Tnd_kl[ powers[5] ] + fcutderiv[5] * Tn_kl[ powers[5] ];        
-
-        force_scalar[0]  = coeff * deriv[0] * fcut_5[0] * Tn_ik[powers[1]]  * Tn_il[powers[2]] * Tn_jk_jl * Tn_kl_5 ;
-        force_scalar[1]  = coeff * deriv[1] * fcut_5[1] * Tn_ij[powers[0]]  * Tn_il[powers[2]] * Tn_jk_jl * Tn_kl_5 ;
-        force_scalar[2]  = coeff * deriv[2] * fcut_5[2] * Tn_ij[powers[0]]  * Tn_ik[powers[1]] * Tn_jk_jl * Tn_kl_5 ;
-        force_scalar[3]  = coeff * deriv[3] * fcut_5[3] * Tn_ij_ik_il  * Tn_jl[powers[4]] * Tn_kl_5 ;
-        force_scalar[4]  = coeff * deriv[4] * fcut_5[4] * Tn_ij_ik_il  * Tn_jk[powers[3]] * Tn_kl_5 ;
-        force_scalar[5]  = coeff * deriv[5] * fcut_5[5] * Tn_ij_ik_il * Tn_jk_jl ;
-
-        // Accumulate forces/stresses on/from the ij pair
-        
-        force[0*CHDIM+0] += force_scalar[0] * dr[0*CHDIM+0];
-        force[0*CHDIM+1] += force_scalar[0] * dr[0*CHDIM+1];
-        force[0*CHDIM+2] += force_scalar[0] * dr[0*CHDIM+2];
-
-        force[1*CHDIM+0] -= force_scalar[0] * dr[0*CHDIM+0];
-        force[1*CHDIM+1] -= force_scalar[0] * dr[0*CHDIM+1];
-        force[1*CHDIM+2] -= force_scalar[0] * dr[0*CHDIM+2];   
-
-#ifdef USE_DISTANCE_TENSOR      
-        stress[0] -= force_scalar[0]  * dr2_4B(dr2,0,0,0,0); // xx tensor component
-        stress[1] -= force_scalar[0]  * dr2_4B(dr2,0,0,0,1); // xy tensor component
-        stress[2] -= force_scalar[0]  * dr2_4B(dr2,0,0,0,2); // xz tensor component
-        stress[3] -= force_scalar[0]  * dr2_4B(dr2,0,1,0,1); // yy tensor component
-        stress[4] -= force_scalar[0]  * dr2_4B(dr2,0,1,0,2); // yz tensor component
-        stress[5] -= force_scalar[0]  * dr2_4B(dr2,0,2,0,2); // zz tensor component
-#else
-        stress[0] -= force_scalar[0]  * dr[0*CHDIM+0] * dr[0*CHDIM+0]; // xx tensor component
-        stress[1] -= force_scalar[0]  * dr[0*CHDIM+0] * dr[0*CHDIM+1]; // xy tensor component
-        stress[2] -= force_scalar[0]  * dr[0*CHDIM+0] * dr[0*CHDIM+2]; // xz tensor component
-        stress[3] -= force_scalar[0]  * dr[0*CHDIM+1] * dr[0*CHDIM+1]; // yy tensor component
-        stress[4] -= force_scalar[0]  * dr[0*CHDIM+1] * dr[0*CHDIM+2]; // yz tensor component
-        stress[5] -= force_scalar[0]  * dr[0*CHDIM+2] * dr[0*CHDIM+2]; // zz tensor component
-#endif      
-        
-        // Accumulate forces/stresses on/from the ik pair
-        
-        force[0*CHDIM+0] += force_scalar[1] * dr[1*CHDIM+0];
-        force[0*CHDIM+1] += force_scalar[1] * dr[1*CHDIM+1];
-        force[0*CHDIM+2] += force_scalar[1] * dr[1*CHDIM+2];
-
-        force[2*CHDIM+0] -= force_scalar[1] * dr[1*CHDIM+0];
-        force[2*CHDIM+1] -= force_scalar[1] * dr[1*CHDIM+1];
-        force[2*CHDIM+2] -= force_scalar[1] * dr[1*CHDIM+2];   
-
-#if USE_DISTANCE_TENSOR     
-        stress[0] -= force_scalar[1]  * dr2_4B(dr2,1,0,1,0); // xx tensor component
-        stress[1] -= force_scalar[1]  * dr2_4B(dr2,1,0,1,1); // xy tensor component
-        stress[2] -= force_scalar[1]  * dr2_4B(dr2,1,0,1,2); // xz tensor component
-        stress[3] -= force_scalar[1]  * dr2_4B(dr2,1,1,1,1); // yy tensor component
-        stress[4] -= force_scalar[1]  * dr2_4B(dr2,1,1,1,2); // yz tensor component
-        stress[5] -= force_scalar[1]  * dr2_4B(dr2,1,2,1,2); // zz tensor component
-#else        
-        stress[0] -= force_scalar[1]  * dr[1*CHDIM+0] * dr[1*CHDIM+0]; // xx tensor component
-        stress[1] -= force_scalar[1]  * dr[1*CHDIM+0] * dr[1*CHDIM+1]; // xy tensor component
-        stress[2] -= force_scalar[1]  * dr[1*CHDIM+0] * dr[1*CHDIM+2]; // xz tensor component
-        stress[3] -= force_scalar[1]  * dr[1*CHDIM+1] * dr[1*CHDIM+1]; // yy tensor component
-        stress[4] -= force_scalar[1]  * dr[1*CHDIM+1] * dr[1*CHDIM+2]; // yz tensor component
-        stress[5] -= force_scalar[1]  * dr[1*CHDIM+2] * dr[1*CHDIM+2]; // zz tensor component
-#endif      
-        // Accumulate forces/stresses on/from the il pair
-        
-        force[0*CHDIM+0] += force_scalar[2] * dr[2*CHDIM+0];
-        force[0*CHDIM+1] += force_scalar[2] * dr[2*CHDIM+1];
-        force[0*CHDIM+2] += force_scalar[2] * dr[2*CHDIM+2];
-
-        force[3*CHDIM+0] -= force_scalar[2] * dr[2*CHDIM+0];
-        force[3*CHDIM+1] -= force_scalar[2] * dr[2*CHDIM+1];
-        force[3*CHDIM+2] -= force_scalar[2] * dr[2*CHDIM+2];   
-
-#ifdef USE_DISTANCE_TENSOR        
-        stress[0] -= force_scalar[2]  * dr2_4B(dr2,2,0,2,0); // xx tensor component
-        stress[1] -= force_scalar[2]  * dr2_4B(dr2,2,0,2,1); // xy tensor component
-        stress[2] -= force_scalar[2]  * dr2_4B(dr2,2,0,2,2); // xz tensor component
-        stress[3] -= force_scalar[2]  * dr2_4B(dr2,2,1,2,1); // yy tensor component
-        stress[4] -= force_scalar[2]  * dr2_4B(dr2,2,1,2,2); // yz tensor component
-        stress[5] -= force_scalar[2]  * dr2_4B(dr2,2,2,2,2); // zz tensor component           
-#else       
-        stress[0] -= force_scalar[2]  * dr[2*CHDIM+0] * dr[2*CHDIM+0]; // xx tensor component
-        stress[1] -= force_scalar[2]  * dr[2*CHDIM+0] * dr[2*CHDIM+1]; // xy tensor component
-        stress[2] -= force_scalar[2]  * dr[2*CHDIM+0] * dr[2*CHDIM+2]; // xz tensor component
-        stress[3] -= force_scalar[2]  * dr[2*CHDIM+1] * dr[2*CHDIM+1]; // yy tensor component
-        stress[4] -= force_scalar[2]  * dr[2*CHDIM+1] * dr[2*CHDIM+2]; // yz tensor component
-        stress[5] -= force_scalar[2]  * dr[2*CHDIM+2] * dr[2*CHDIM+2]; // zz tensor component           
-#endif
+        if (derivs)
+            for (int p=0; p<npows; p++)
+                dG[i][p] = fcut[i] * dG[i][p] + fcutderiv[i] * G[i][p];
         
-        // Accumulate forces/stresses on/from the jk pair
-        
-        force[1*CHDIM+0] += force_scalar[3] * dr[3*CHDIM+0];
-        force[1*CHDIM+1] += force_scalar[3] * dr[3*CHDIM+1];
-        force[1*CHDIM+2] += force_scalar[3] * dr[3*CHDIM+2];
-
-        force[2*CHDIM+0] -= force_scalar[3] * dr[3*CHDIM+0];
-        force[2*CHDIM+1] -= force_scalar[3] * dr[3*CHDIM+1];
-        force[2*CHDIM+2] -= force_scalar[3] * dr[3*CHDIM+2];   
-
-#ifdef USE_DISTANCE_TENSOR      
-        stress[0] -= force_scalar[3]  * dr2_4B(dr2,3,0,3,0); // xx tensor component
-        stress[1] -= force_scalar[3]  * dr2_4B(dr2,3,0,3,1); // xy tensor component
-        stress[2] -= force_scalar[3]  * dr2_4B(dr2,3,0,3,2); // xz tensor component
-        stress[3] -= force_scalar[3]  * dr2_4B(dr2,3,1,3,1); // yy tensor component
-        stress[4] -= force_scalar[3]  * dr2_4B(dr2,3,1,3,2); // yz tensor component
-        stress[5] -= force_scalar[3]  * dr2_4B(dr2,3,2,3,2); // zz tensor component
-#else
-        stress[0] -= force_scalar[3]  * dr[3*CHDIM+0] * dr[3*CHDIM+0]; // xx tensor component
-        stress[1] -= force_scalar[3]  * dr[3*CHDIM+0] * dr[3*CHDIM+1]; // xy tensor component
-        stress[2] -= force_scalar[3]  * dr[3*CHDIM+0] * dr[3*CHDIM+2]; // xz tensor component
-        stress[3] -= force_scalar[3]  * dr[3*CHDIM+1] * dr[3*CHDIM+1]; // yy tensor component
-        stress[4] -= force_scalar[3]  * dr[3*CHDIM+1] * dr[3*CHDIM+2]; // yz tensor component
-        stress[5] -= force_scalar[3]  * dr[3*CHDIM+2] * dr[3*CHDIM+2]; // zz tensor component
+        for (int p=0; p<npows; p++)
+            G[i][p] = fcut[i] * G[i][p];
+    }
+    
+    contract_4B(quadidx, mapped_pair_idx.data(), G, dG, dx.data(), dr.data(), force.data(), stress.data(), energy, force_scalar_in.data(), derivs);
+}
+
+int chimesFF::get_num_edge_variants()
+{
+    return edge_var_pair.size();
+}
+
+int chimesFF::get_edge_variant_order(const int variant)
+{
+    return poly_orders[ edge_var_bodiedness[variant] ];
+}
+
+void chimesFF::set_edge_polys(const int variant, const double dx, double *G, double *dG)
+{
+    // Smoothed polynomials of an edge, as compute_3B_kernel/compute_4B_kernel set them up before the contraction
+    
+    const int    bodiedness_idx = edge_var_bodiedness[variant];
+    const double outer_cutoff   = edge_var_outer[variant];
+    const bool   derivs         = (eval_mode != evalMode::ENERGY);
+    
+    double fcut, fcutderiv;
+    
+    set_cheby_polys<0>(G, dG, dx, edge_var_pair[variant], edge_var_inner[variant], outer_cutoff, bodiedness_idx, derivs);
+    
+    get_fcut(dx, outer_cutoff, fcut, fcutderiv);
+    
+    const int npows = poly_orders[bodiedness_idx]+1;
+    
+    if (derivs)
+        for (int p=0; p<npows; p++)
+            dG[p] = fcut * dG[p] + fcutderiv * G[p];
+    
+    for (int p=0; p<npows; p++)
+        G[p] = fcut * G[p];
+}
+
+void chimesFF::compute_3B_edges(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, const double * const * G, const double * const * dG, vector<double> & force, vector<double> & stress, double & energy, vector<double> & force_scalar_in)
+{
+    CHIMES_COUNT(stats.calls[1]);
+    
+    int type_idx = typ_idxs[0]*natmtyps*natmtyps + typ_idxs[1]*natmtyps + typ_idxs[2];
+    
+    contract_3B(atom_int_trip_map[type_idx], pair_int_trip_map[type_idx].data(), G, dG, dx.data(), dr.data(), force.data(), stress.data(), energy, force_scalar_in.data(), eval_mode != evalMode::ENERGY);
+}
+
+void chimesFF::compute_4B_edges(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, const double * const * G, const double * const * dG, vector<double> & force, vector<double> & stress, double & energy, vector<double> & force_scalar_in)
+{
+    CHIMES_COUNT(stats.calls[2]);
+    
+    int idx = typ_idxs[0]*natmtyps*natmtyps*natmtyps + typ_idxs[1]*natmtyps*natmtyps + typ_idxs[2]*natmtyps + typ_idxs[3];
+    
+    contract_4B(atom_int_quad_map[idx], pair_int_quad_map[idx].data(), G, dG, dx.data(), dr.data(), force.data(), stress.data(), energy, force_scalar_in.data(), eval_mode != evalMode::ENERGY);
+}
+
+void chimesFF::compute_3B_block(const int ncl, const int *typ_idxs, const double * const * G, const double * const * dG, const double *dx, const double *dr, double *force, double *stress, double & energy, chimesBlockTmp & tmp)
+{
+#if CHIMES_INSTRUMENT
+    stats.calls[1] += ncl;
 #endif
+    
+    int type_idx = typ_idxs[0]*natmtyps*natmtyps + typ_idxs[1]*natmtyps + typ_idxs[2];
+    int tripidx  = atom_int_trip_map[type_idx];
+    
+    const int * mapped_pair_idx = pair_int_trip_map[type_idx].data();
+    
+    tmp.resize(3, poly_orders[1]);
+    
+    if (mixed_precision)
+        contract_3B_block<float> (ncl, tripidx, mapped_pair_idx, chimes_3b_fact_params_f[tripidx].data(), G, dG, dx, dr, force, stress, energy, tmp);
+    else
+        contract_3B_block<double>(ncl, tripidx, mapped_pair_idx, chimes_3b_fact_params  [tripidx].data(), G, dG, dx, dr, force, stress, energy, tmp);
+}
+
+void chimesFF::compute_4B_block(const int ncl, const int *typ_idxs, const double * const * G, const double * const * dG, const double *dx, const double *dr, double *force, double *stress, double & energy, chimesBlockTmp & tmp)
+{
+#if CHIMES_INSTRUMENT
+    stats.calls[2] += ncl;
+#endif
+    
+    int idx     = typ_idxs[0]*natmtyps*natmtyps*natmtyps + typ_idxs[1]*natmtyps*natmtyps + typ_idxs[2]*natmtyps + typ_idxs[3];
+    int quadidx = atom_int_quad_map[idx];
+    
+    const int * mapped_pair_idx = pair_int_quad_map[idx].data();
+    
+    tmp.resize(6, poly_orders[2]);
+    
+    if (mixed_precision)
+        contract_4B_block<float> (ncl, quadidx, mapped_pair_idx, chimes_4b_params_f[quadidx].data(), G, dG, dx, dr, force, stress, energy, tmp);
+    else
+        contract_4B_block<double>(ncl, quadidx, mapped_pair_idx, chimes_4b_params  [quadidx].data(), G, dG, dx, dr, force, stress, energy, tmp);
+}
+
+template<typename REAL>
+void chimesFF::contract_3B_block(const int ncl, const int tripidx, const int *mapped_pair_idx, const REAL *coeff, const double * const * G, const double * const * dG, 
+                                 const double *dx, const double *dr, double *force, double *stress, double & energy, chimesBlockTmp & tmp)
+{
+    const int natoms = 3;
+    const int npairs = natoms*(natoms-1)/2;
+    const int nb     = CHIMES_BLOCK;
+    
+    const bool   derivs = (eval_mode != evalMode::ENERGY);
+    const int    npows  = poly_orders[1]+1;
+    
+    const int    * p0     = chimes_3b_fact_p0    [tripidx].data();
+    const int    * p0_end = chimes_3b_fact_p0_end[tripidx].data();
+    const int    * p1     = chimes_3b_fact_p1    [tripidx].data();
+    const int    * p1_end = chimes_3b_fact_p1_end[tripidx].data();
+    const int    * p2     = chimes_3b_fact_p2    [tripidx].data();
+    
+    const int n_p0 = chimes_3b_fact_p0[tripidx].size();
+    
+    REAL * Gb;
+    REAL * dGb;
+    
+    tmp.get(Gb, dGb);
+    
+    // Per-cluster partial sums of the factorized contraction (see contract_3B). The inner levels are formed in 
+    // precision REAL, the outer (p0) level is always accumulated in double.
+    
+    double E[nb];
+    double dE_s[npairs][nb];
+    REAL   E_1[nb], E_2[nb];
+    REAL   dE_11[nb], dE_12[nb], dE_2[nb];
+    
+    for (int c0=0; c0<ncl; c0+=nb)
+    {
+        const int n = min(nb, ncl-c0);
         
-        // Accumulate forces/stresses on/from the jl pair
-        
-        force[1*CHDIM+0] += force_scalar[4] * dr[4*CHDIM+0];
-        force[1*CHDIM+1] += force_scalar[4] * dr[4*CHDIM+1];
-        force[1*CHDIM+2] += force_scalar[4] * dr[4*CHDIM+2];
-
-        force[3*CHDIM+0] -= force_scalar[4] * dr[4*CHDIM+0];
-        force[3*CHDIM+1] -= force_scalar[4] * dr[4*CHDIM+1];
-        force[3*CHDIM+2] -= force_scalar[4] * dr[4*CHDIM+2];     
-
-#ifdef USE_DISTANCE_TENSOR      
-        stress[0] -= force_scalar[4]  * dr2_4B(dr2,4,0,4,0); // xx tensor component
-        stress[1] -= force_scalar[4]  * dr2_4B(dr2,4,0,4,1); // xy tensor component
-        stress[2] -= force_scalar[4]  * dr2_4B(dr2,4,0,4,2); // xz tensor component
-        stress[3] -= force_scalar[4]  * dr2_4B(dr2,4,1,4,1); // yy tensor component
-        stress[4] -= force_scalar[4]  * dr2_4B(dr2,4,1,4,2); // yz tensor component
-        stress[5] -= force_scalar[4]  * dr2_4B(dr2,4,2,4,2); // zz tensor component
-#else       
-        stress[0] -= force_scalar[4]  * dr[4*CHDIM+0] * dr[4*CHDIM+0]; // xx tensor component
-        stress[1] -= force_scalar[4]  * dr[4*CHDIM+0] * dr[4*CHDIM+1]; // xy tensor component
-        stress[2] -= force_scalar[4]  * dr[4*CHDIM+0] * dr[4*CHDIM+2]; // xz tensor component
-        stress[3] -= force_scalar[4]  * dr[4*CHDIM+1] * dr[4*CHDIM+1]; // yy tensor component
-        stress[4] -= force_scalar[4]  * dr[4*CHDIM+1] * dr[4*CHDIM+2]; // yz tensor component
-        stress[5] -= force_scalar[4]  * dr[4*CHDIM+2] * dr[4*CHDIM+2]; // zz tensor component
-#endif      
-        // Accumulate forces/stresses on/from the kl pair
-        
-        force[2*CHDIM+0] += force_scalar[5] * dr[5*CHDIM+0];
-        force[2*CHDIM+1] += force_scalar[5] * dr[5*CHDIM+1];
-        force[2*CHDIM+2] += force_scalar[5] * dr[5*CHDIM+2];
-
-        force[3*CHDIM+0] -= force_scalar[5] * dr[5*CHDIM+0];
-        force[3*CHDIM+1] -= force_scalar[5] * dr[5*CHDIM+1];
-        force[3*CHDIM+2] -= force_scalar[5] * dr[5*CHDIM+2];     
-
-#ifdef USE_DISTANCE_TENSOR
-        stress[0] -= force_scalar[5]  * dr2_4B(dr2,5,0,5,0); // xx tensor component
-        stress[1] -= force_scalar[5]  * dr2_4B(dr2,5,0,5,1); // xy tensor component
-        stress[2] -= force_scalar[5]  * dr2_4B(dr2,5,0,5,2); // xz tensor component
-        stress[3] -= force_scalar[5]  * dr2_4B(dr2,5,1,5,1); // yy tensor component
-        stress[4] -= force_scalar[5]  * dr2_4B(dr2,5,1,5,2); // yz tensor component
-        stress[5] -= force_scalar[5]  * dr2_4B(dr2,5,2,5,2); // zz tensor component
-#else       
-        stress[0] -= force_scalar[5]  * dr[5*CHDIM+0] * dr[5*CHDIM+0]; // xx tensor component
-        stress[1] -= force_scalar[5]  * dr[5*CHDIM+0] * dr[5*CHDIM+1]; // xy tensor component
-        stress[2] -= force_scalar[5]  * dr[5*CHDIM+0] * dr[5*CHDIM+2]; // xz tensor component
-        stress[3] -= force_scalar[5]  * dr[5*CHDIM+1] * dr[5*CHDIM+1]; // yy tensor component
-        stress[4] -= force_scalar[5]  * dr[5*CHDIM+1] * dr[5*CHDIM+2]; // yz tensor component
-        stress[5] -= force_scalar[5]  * dr[5*CHDIM+2] * dr[5*CHDIM+2]; // zz tensor component
-#endif      
+        // Gather the polynomials of the block by parameter file constituent pair, padding unused clusters with zeros
+        
+        for (int e=0; e<npairs; e++)
+        {
+            REAL * Gs  = Gb  + mapped_pair_idx[e]*npows*nb;
+            REAL * dGs = dGb + mapped_pair_idx[e]*npows*nb;
+            
+            for (int p=0; p<npows; p++)
+            {
+                for (int b=0; b<n; b++)
+                    Gs[p*nb+b] = G[(c0+b)*npairs+e][p];
+                for (int b=n; b<nb; b++)
+                    Gs[p*nb+b] = 0.0;
+            }
+            
+            if (derivs)
+            for (int p=0; p<npows; p++)
+            {
+                for (int b=0; b<n; b++)
+                    dGs[p*nb+b] = dG[(c0+b)*npairs+e][p];
+                for (int b=n; b<nb; b++)
+                    dGs[p*nb+b] = 0.0;
+            }
+        }
+        
+        for (int b=0; b<nb; b++)
+        {
+            E[b]       = 0.0;
+            dE_s[0][b] = 0.0;
+            dE_s[1][b] = 0.0;
+            dE_s[2][b] = 0.0;
+        }
+        
+        int j = 0;
+        int k = 0;
+        
+        for (int i=0; i<n_p0; i++)
+        {
+            for (int b=0; b<nb; b++)
+            {
+                E_1  [b] = 0.0;
+                dE_11[b] = 0.0;
+                dE_12[b] = 0.0;
+            }
+            
+            for ( ; j<p0_end[i]; j++)
+            {
+                for (int b=0; b<nb; b++)
+                {
+                    E_2 [b] = 0.0;
+                    dE_2[b] = 0.0;
+                }
+                
+                for ( ; k<p1_end[j]; k++)
+                {
+                    const REAL   c   = coeff[k];
+                    const REAL * g2  = Gb  + (2*npows + p2[k])*nb;
+                    const REAL * dg2 = dGb + (2*npows + p2[k])*nb;
+                    
+                    for (int b=0; b<nb; b++)
+                        E_2[b] += c * g2[b];
+                    
+                    if (derivs)
+                    for (int b=0; b<nb; b++)
+                        dE_2[b] += c * dg2[b];
+                }
+                
+                const REAL * g1  = Gb  + (1*npows + p1[j])*nb;
+                const REAL * dg1 = dGb + (1*npows + p1[j])*nb;
+                
+                for (int b=0; b<nb; b++)
+                    E_1[b] += g1[b] * E_2[b];
+                
+                if (derivs)
+                for (int b=0; b<nb; b++)
+                {
+                    dE_11[b] += dg1[b] * E_2[b];
+                    dE_12[b] += g1 [b] * dE_2[b];
+                }
+            }
+            
+            const REAL * g0  = Gb  + (0*npows + p0[i])*nb;
+            const REAL * dg0 = dGb + (0*npows + p0[i])*nb;
+            
+            for (int b=0; b<nb; b++)
+                E[b] += g0[b] * E_1[b];
+            
+            if (derivs)
+            for (int b=0; b<nb; b++)
+            {
+                dE_s[0][b] += dg0[b] * E_1[b];
+                dE_s[1][b] += g0 [b] * dE_11[b];
+                dE_s[2][b] += g0 [b] * dE_12[b];
+            }
+        }
+        
+        // Energies, and forces/stresses from the per-pair force scalars of each cluster
+        
+        for (int b=0; b<n; b++)
+        {
+            energy += E[b];
+            
+            if (!derivs)
+                continue;
+            
+            double force_scalar[npairs];
+            
+            for (int e=0; e<npairs; e++)
+                force_scalar[e] = dE_s[ mapped_pair_idx[e] ][b] / dx[(c0+b)*npairs+e];
+            
+            accumulate_cluster<natoms>(force_scalar, dr + (c0+b)*npairs*CHDIM, force + (c0+b)*natoms*CHDIM, stress);
+        }
     }
+}
+
+template<typename REAL>
+void chimesFF::contract_4B_block(const int ncl, const int quadidx, const int *mapped_pair_idx, const REAL *coeff, const double * const * G, const double * const * dG, 
+                                 const double *dx, const double *dr, double *force, double *stress, double & energy, chimesBlockTmp & tmp)
+{
+    const int natoms = 4;
+    const int npairs = natoms*(natoms-1)/2;
+    const int nb     = CHIMES_BLOCK;
+    const int nchunk = 32;    // Coefficients summed in precision REAL before accumulating in double
+    
+    const bool   derivs  = (eval_mode != evalMode::ENERGY);
+    const int    npows   = poly_orders[2]+1;
+    const int    ncoeffs = ncoeffs_4b[quadidx];
+    
+    REAL * Gb;
+    REAL * dGb;
     
-	force_scalar_in[0] = force_scalar[0];
-	force_scalar_in[1] = force_scalar[1];
-	force_scalar_in[2] = force_scalar[2];
-	force_scalar_in[3] = force_scalar[3];
-	force_scalar_in[4] = force_scalar[4];
-	force_scalar_in[5] = force_scalar[5];
+    tmp.get(Gb, dGb);
+    
+    double E[nb];
+    double dE[npairs][nb];
+    REAL   E_c[nb];
+    REAL   dE_c[npairs][nb];
+    
+    for (int c0=0; c0<ncl; c0+=nb)
+    {
+        const int n = min(nb, ncl-c0);
+        
+        // Gather the polynomials of the block, by edge, padding unused clusters with zeros
+        
+        for (int e=0; e<npairs; e++)
+        {
+            for (int p=0; p<npows; p++)
+            {
+                for (int b=0; b<n; b++)
+                    Gb[(e*npows+p)*nb+b] = G[(c0+b)*npairs+e][p];
+                for (int b=n; b<nb; b++)
+                    Gb[(e*npows+p)*nb+b] = 0.0;
+            }
+            
+            if (derivs)
+            for (int p=0; p<npows; p++)
+            {
+                for (int b=0; b<n; b++)
+                    dGb[(e*npows+p)*nb+b] = dG[(c0+b)*npairs+e][p];
+                for (int b=n; b<nb; b++)
+                    dGb[(e*npows+p)*nb+b] = 0.0;
+            }
+        }
+        
+        for (int b=0; b<nb; b++)
+        {
+            E[b] = 0.0;
+            
+            for (int e=0; e<npairs; e++)
+                dE[e][b] = 0.0;
+        }
+        
+        // For each coefficient, the derivative with respect to edge e is the product of dG of edge e with G of all 
+        // other edges (prefix and suffix products, as in contract_4B)
+        
+        for (int c1=0; c1<ncoeffs; c1+=nchunk)
+        {
+            const int c1_end = min(ncoeffs, c1+nchunk);
+            
+            for (int b=0; b<nb; b++)
+            {
+                E_c[b] = 0.0;
+                
+                for (int e=0; e<npairs; e++)
+                    dE_c[e][b] = 0.0;
+            }
+            
+            for (int c=c1; c<c1_end; c++)
+            {
+                const int  * pows = chimes_4b_powers[quadidx][c].data();
+                const REAL   cv   = coeff[c];
+                
+                const REAL * g [npairs];
+                const REAL * dg[npairs];
+                
+                for (int e=0; e<npairs; e++)
+                {
+                    g [e] = Gb  + (e*npows + pows[mapped_pair_idx[e]])*nb;
+                    dg[e] = dGb + (e*npows + pows[mapped_pair_idx[e]])*nb;
+                }
+                
+                if (!derivs)
+                {
+                    for (int b=0; b<nb; b++)
+                        E_c[b] += cv * g[0][b] * g[1][b] * g[2][b] * g[3][b] * g[4][b] * g[5][b];
+                    
+                    continue;
+                }
+                
+                for (int b=0; b<nb; b++)
+                {
+                    REAL pre2 = g[0][b] * g[1][b];
+                    REAL pre3 = pre2    * g[2][b];
+                    REAL pre4 = pre3    * g[3][b];
+                    REAL pre5 = pre4    * g[4][b];
+                    
+                    REAL suf4 = g[4][b] * g[5][b];
+                    REAL suf3 = g[3][b] * suf4;
+                    REAL suf2 = g[2][b] * suf3;
+                    REAL suf1 = g[1][b] * suf2;
+                    
+                    E_c    [b] += cv * pre5 * g[5][b];
+                    dE_c[0][b] += cv * dg[0][b] * suf1;
+                    dE_c[1][b] += cv * dg[1][b] * g[0][b] * suf2;
+                    dE_c[2][b] += cv * dg[2][b] * pre2 * suf3;
+                    dE_c[3][b] += cv * dg[3][b] * pre3 * suf4;
+                    dE_c[4][b] += cv * dg[4][b] * pre4 * g[5][b];
+                    dE_c[5][b] += cv * dg[5][b] * pre5;
+                }
+            }
+            
+            for (int b=0; b<nb; b++)
+            {
+                E[b] += E_c[b];
+                
+                for (int e=0; e<npairs; e++)
+                    dE[e][b] += dE_c[e][b];
+            }
+        }
+        
+        for (int b=0; b<n; b++)
+        {
+            energy += E[b];
+            
+            if (!derivs)
+                continue;
+            
+            double force_scalar[npairs];
+            
+            for (int e=0; e<npairs; e++)
+                force_scalar[e] = dE[e][b] / dx[(c0+b)*npairs+e];
+            
+            accumulate_cluster<natoms>(force_scalar, dr + (c0+b)*npairs*CHDIM, force + (c0+b)*natoms*CHDIM, stress);
+        }
+    }
+}
 
-    return;
+void chimesFF::get_2B_exact(const double dx, const int pair_idx, double & E, double & dEdr)
+{
+    // Exact 2-body energy and dE/dr (excluding the penalty) for a single pair distance; used to build and 
+    // validate the 2-body tables
+
+    vector<double> Tn (poly_orders[0]+1);
+    vector<double> Tnd(poly_orders[0]+1);
+    double         fcut, fcutderiv;
+    
+    set_cheby_polys<0>(Tn.data(), Tnd.data(), dx, pair_idx, chimes_2b_cutoff[pair_idx][0], chimes_2b_cutoff[pair_idx][1], 0);
+    
+    get_fcut(dx, chimes_2b_cutoff[pair_idx][1], fcut, fcutderiv);
+    
+    E    = 0.0;
+    dEdr = 0.0;
+    
+    for(int coeffs=0; coeffs<ncoeffs_2b[pair_idx]; coeffs++)
+    {
+        int pow = chimes_2b_pows[pair_idx][coeffs]+1;
+        
+        E    += chimes_2b_params[pair_idx][coeffs] * fcut * Tn[pow];
+        dEdr += chimes_2b_params[pair_idx][coeffs] * (fcut * Tnd[pow] + fcutderiv * Tn[pow]);
+    }
+}
+
+void chimesFF::get_2B_table_interval(const int pair_idx, const int k, double & r0, double & r1)
+{
+    // Returns the bounds of grid interval k of a 2-body table
+    
+    if (k < tab_2b_nlower[pair_idx])
+    {
+        r0 = chimes_2b_cutoff[pair_idx][0] + (k  ) / tab_2b_inv_h_lower[pair_idx];
+        r1 = chimes_2b_cutoff[pair_idx][0] + (k+1) / tab_2b_inv_h_lower[pair_idx];
+        
+        if (k == tab_2b_nlower[pair_idx]-1)
+            r1 = tab_2b_rsplit[pair_idx];
+    }
+    else
+    {
+        r0 = tab_2b_rsplit[pair_idx] + (k   - tab_2b_nlower[pair_idx]) / tab_2b_inv_h_upper[pair_idx];
+        r1 = tab_2b_rsplit[pair_idx] + (k+1 - tab_2b_nlower[pair_idx]) / tab_2b_inv_h_upper[pair_idx];
+        
+        if (k == tab_2b_nintervals[pair_idx]-1)
+            r1 = chimes_2b_cutoff[pair_idx][1];
+    }
+}
+
+void chimesFF::build_2B_table(const int pair_idx, const int nintervals)
+{
+    // Builds quintic Hermite splines of the 2-body energy on a grid of (about) nintervals intervals between the 
+    // inner and outer cutoff. Second derivatives are taken from one-sided finite differences of the exact dE/dr,
+    // from within each interval.
+    
+    const double rmin  = chimes_2b_cutoff[pair_idx][0];
+    const double rmax  = chimes_2b_cutoff[pair_idx][1];
+    
+    double rsplit = rmax;
+    
+    if (fcut_type == fcutType::TERSOFF)
+    {
+        double thresh = rmax - fcut_var*rmax;
+        
+        if ( (thresh > rmin) && (thresh < rmax) )
+            rsplit = thresh;
+    }
+    
+    int nlower = (int) round(nintervals * (rsplit - rmin) / (rmax - rmin));
+    
+    if (nlower < 1)
+        nlower = 1;
+    if ( (rsplit < rmax) && (nlower > nintervals - 1) )
+        nlower = nintervals - 1;
+    
+    tab_2b_nintervals [pair_idx] = (rsplit < rmax) ? nintervals : nlower;
+    tab_2b_nlower     [pair_idx] = nlower;
+    tab_2b_rsplit     [pair_idx] = rsplit;
+    tab_2b_inv_h_lower[pair_idx] = nlower / (rsplit - rmin);
+    tab_2b_inv_h_upper[pair_idx] = (rsplit < rmax) ? (nintervals - nlower) / (rmax - rsplit) : 0.0;
+    
+    tab_2b_coeffs[pair_idx].resize(6*tab_2b_nintervals[pair_idx]);
+    
+    double r0, r1;
+    double E0, E1, d0, d1, s0, s1;
+    double Etmp, dtmp1, dtmp2;
+    
+    for (int k=0; k<tab_2b_nintervals[pair_idx]; k++)
+    {
+        get_2B_table_interval(pair_idx, k, r0, r1);
+        
+        const double h     = r1 - r0;
+        const double delta = 1.0e-3 * h;
+        
+        get_2B_exact(r0, pair_idx, E0, d0);
+        get_2B_exact(r1, pair_idx, E1, d1);
+        
+        get_2B_exact(r0 +     delta, pair_idx, Etmp, dtmp1);
+        get_2B_exact(r0 + 2.0*delta, pair_idx, Etmp, dtmp2);
+        s0 = (-3.0*d0 + 4.0*dtmp1 - dtmp2) / (2.0*delta);
+        
+        get_2B_exact(r1 -     delta, pair_idx, Etmp, dtmp1);
+        get_2B_exact(r1 - 2.0*delta, pair_idx, Etmp, dtmp2);
+        s1 = ( 3.0*d1 - 4.0*dtmp1 + dtmp2) / (2.0*delta);
+        
+        // Quintic in t = (r-r0)/h matching E, dE/dt and d2E/dt2 at both ends of the interval
+        
+        double *c = &tab_2b_coeffs[pair_idx][6*k];
+        
+        c[0] = E0;
+        c[1] = d0 * h;
+        c[2] = 0.5 * s0 * h * h;
+        
+        double a = E1         - (c[0] + c[1] + c[2]);
+        double b = d1 * h     - (c[1] + 2.0*c[2]);
+        double g = s1 * h * h - 2.0*c[2];
+        
+        c[3] =  10.0*a - 4.0*b + 0.5*g;
+        c[4] = -15.0*a + 7.0*b -     g;
+        c[5] =   6.0*a - 3.0*b + 0.5*g;
+    }
+}
+
+void chimesFF::set_2B_tabulation(bool tabulate, double tolerance)
+{
+    tabulate_2b = false; // Tables are built and validated against the exact polynomials
+    
+    if ( (!tabulate) || (poly_orders.size() == 0) || (poly_orders[0] == 0) )
+        return;
+    
+    if (tolerance <= 0.0)
+    {
+        cout << "chimesFF: " << "ERROR: 2-body tabulation tolerance must be positive. Got: " << tolerance << endl;
+        exit(0);
+    }
+    
+    const int min_intervals = 64;
+    const int max_intervals = 65536;
+    const int nsamples      = 3;    // Validation points per interval
+    
+    int npairs = chimes_2b_cutoff.size();
+    
+    tab_2b_nintervals .resize(npairs);
+    tab_2b_nlower     .resize(npairs);
+    tab_2b_rsplit     .resize(npairs);
+    tab_2b_inv_h_lower.resize(npairs);
+    tab_2b_inv_h_upper.resize(npairs);
+    tab_2b_coeffs     .resize(npairs);
+    
+    for (int i=0; i<npairs; i++)
+    {
+        double max_err_E;
+        double max_err_F;
+        
+        int nintervals = min_intervals;
+        
+        while (true)
+        {
+            build_2B_table(i, nintervals);
+            
+            // Validate against the exact polynomials at points inside each interval
+            
+            max_err_E = 0.0;
+            max_err_F = 0.0;
+            
+            double r0, r1;
+            
+            for (int k=0; k<tab_2b_nintervals[i]; k++)
+            {
+                get_2B_table_interval(i, k, r0, r1);
+                
+                for (int n=1; n<=nsamples; n++)
+                {
+                    double r = r0 + n / (nsamples + 1.0) * (r1 - r0);
+                    
+                    double E_exact, dEdr_exact, E_tab, dEdr_tab;
+                    
+                    get_2B_exact    (r, i, E_exact, dEdr_exact);
+                    get_2B_tabulated(r, i, E_tab,   dEdr_tab);
+                    
+                    max_err_E = max(max_err_E, fabs(E_tab    - E_exact   ));
+                    max_err_F = max(max_err_F, fabs(dEdr_tab - dEdr_exact));
+                }
+            }
+            
+            if ( (max_err_E <= tolerance) && (max_err_F <= tolerance) )
+                break;
+                
+            if (nintervals >= max_intervals)
+            {
+                if (rank == 0)
+                    cout << "chimesFF: " << "WARNING: Could not reach 2-body tabulation tolerance " << tolerance 
+                         << " for pair type " << i << " with " << nintervals << " grid intervals" << endl;
+                break;
+            }
+            
+            nintervals *= 2;
+        }
+        
+        if (rank == 0)
+        {
+            ios_base::fmtflags flags = cout.flags();
+            
+            cout << "chimesFF: " << "Tabulated 2-body pair type " << i << " with " << tab_2b_nintervals[i] << " grid intervals. "
+                 << "Max. abs. error in energy, dE/dr: " << scientific << max_err_E << ", " << max_err_F << endl;
+                 
+            cout.flags(flags);
+        }
+    }
+    
+    tabulate_2b = true;
+}
+
+void chimesFF::set_mixed_precision(bool mixed)
+{
+    mixed_precision = mixed;
+    
+    chimes_3b_fact_params_f.clear();
+    chimes_4b_params_f     .clear();
+    
+    if (!mixed)
+        return;
+    
+    for (int i=0; i<chimes_3b_fact_params.size(); i++)
+        chimes_3b_fact_params_f.push_back(vector<float>(chimes_3b_fact_params[i].begin(), chimes_3b_fact_params[i].end()));
+    
+    for (int i=0; i<chimes_4b_params.size(); i++)
+        chimes_4b_params_f.push_back(vector<float>(chimes_4b_params[i].begin(), chimes_4b_params[i].end()));
+}
+
+bool chimesFF::get_mixed_precision()
+{
+    return mixed_precision;
+}
+
+void chimesFF::build_2B_dense()
+{
+    // Store the 2-body coefficients densely by polynomial order (the parameter file power p multiplies T_p+1),
+    // along with the Morse transformation constants of each pair type, for get_2B_clenshaw.
+    
+    int npairs = ncoeffs_2b.size();
+    
+    chimes_2b_dense.assign(npairs, vector<double>(poly_orders[0]+1, 0.0));
+    chimes_2b_xavg .assign(npairs, 0.0);
+    chimes_2b_xdiff.assign(npairs, 0.0);
+    
+    for (int i=0; i<npairs; i++)
+    {
+        for (int j=0; j<ncoeffs_2b[i]; j++)
+            chimes_2b_dense[i][ chimes_2b_pows[i][j]+1 ] += chimes_2b_params[i][j];
+        
+        double x_min = exp(-1*chimes_2b_cutoff[i][0]/morse_var[i]);
+        double x_max = exp(-1*chimes_2b_cutoff[i][1]/morse_var[i]);
+        
+        chimes_2b_xavg [i] =  0.5 * (x_max + x_min);
+        chimes_2b_xdiff[i] = -0.5 * (x_max - x_min);    // Special for Morse style (see set_cheby_polys)
+    }
+}
+
+void chimesFF::build_3B_factorization()
+{
+    // Regroup the 3-body coefficients of each triplet type by shared constituent pair powers, so that the
+    // compute kernel can contract the coefficient tensor one pair (edge) at a time:
+    //
+    //   E = sum_p0 G0[p0] * sum_p1 G1[p1] * sum_p2 c(p0,p1,p2) * G2[p2],  with Gi[p] = fcut_i * Tn_i[p]
+    //
+    // The innermost sum is shared by all coefficients with the same (p0,p1), and the middle sum by all
+    // coefficients with the same p0.
+
+    int ntrips = ncoeffs_3b.size();
+
+    chimes_3b_fact_p0    .assign(ntrips, vector<int>());
+    chimes_3b_fact_p0_end.assign(ntrips, vector<int>());
+    chimes_3b_fact_p1    .assign(ntrips, vector<int>());
+    chimes_3b_fact_p1_end.assign(ntrips, vector<int>());
+    chimes_3b_fact_p2    .assign(ntrips, vector<int>());
+    chimes_3b_fact_params.assign(ntrips, vector<double>());
+
+    for (int i=0; i<ntrips; i++)
+    {
+        vector<int> order(ncoeffs_3b[i]);
+
+        for (int j=0; j<ncoeffs_3b[i]; j++)
+            order[j] = j;
+
+        vector<vector<int> > & pows = chimes_3b_powers[i];
+
+        sort(order.begin(), order.end(), [&pows](int a, int b) { return pows[a] < pows[b]; });
+
+        for (int j=0; j<ncoeffs_3b[i]; j++)
+        {
+            const vector<int> & p = pows[order[j]];
+
+            bool new_p0 = (j == 0) || (p[0] != pows[order[j-1]][0]);
+            bool new_p1 = new_p0   || (p[1] != pows[order[j-1]][1]);
+
+            if (new_p0)
+            {
+                chimes_3b_fact_p0    [i].push_back(p[0]);
+                chimes_3b_fact_p0_end[i].push_back(0);
+            }
+            if (new_p1)
+            {
+                chimes_3b_fact_p1    [i].push_back(p[1]);
+                chimes_3b_fact_p1_end[i].push_back(0);
+            }
+            chimes_3b_fact_p2    [i].push_back(p[2]);
+            chimes_3b_fact_params[i].push_back(chimes_3b_params[i][order[j]]);
+
+            chimes_3b_fact_p1_end[i].back() = chimes_3b_fact_p2[i].size();
+            chimes_3b_fact_p0_end[i].back() = chimes_3b_fact_p1[i].size();
+        }
+    }
+}
+
+void chimesFF::select_compute_kernels()
+{
+    // Select order-specialized compute kernels for the most common polynomial orders (2B: 8-20, 3B: 4-12,
+    // 4B: 2-6). Any other order falls back to the generic kernel.
+    
+    switch (poly_orders[0])
+    {
+        case  8: compute_2B_fn = &chimesFF::compute_2B_kernel< 8>; break;
+        case  9: compute_2B_fn = &chimesFF::compute_2B_kernel< 9>; break;
+        case 10: compute_2B_fn = &chimesFF::compute_2B_kernel<10>; break;
+        case 11: compute_2B_fn = &chimesFF::compute_2B_kernel<11>; break;
+        case 12: compute_2B_fn = &chimesFF::compute_2B_kernel<12>; break;
+        case 13: compute_2B_fn = &chimesFF::compute_2B_kernel<13>; break;
+        case 14: compute_2B_fn = &chimesFF::compute_2B_kernel<14>; break;
+        case 15: compute_2B_fn = &chimesFF::compute_2B_kernel<15>; break;
+        case 16: compute_2B_fn = &chimesFF::compute_2B_kernel<16>; break;
+        case 17: compute_2B_fn = &chimesFF::compute_2B_kernel<17>; break;
+        case 18: compute_2B_fn = &chimesFF::compute_2B_kernel<18>; break;
+        case 19: compute_2B_fn = &chimesFF::compute_2B_kernel<19>; break;
+        case 20: compute_2B_fn = &chimesFF::compute_2B_kernel<20>; break;
+        default: compute_2B_fn = &chimesFF::compute_2B_kernel< 0>; break;
+    }
+    
+    switch (poly_orders[1])
+    {
+        case  4: compute_3B_fn = &chimesFF::compute_3B_kernel< 4>; break;
+        case  5: compute_3B_fn = &chimesFF::compute_3B_kernel< 5>; break;
+        case  6: compute_3B_fn = &chimesFF::compute_3B_kernel< 6>; break;
+        case  7: compute_3B_fn = &chimesFF::compute_3B_kernel< 7>; break;
+        case  8: compute_3B_fn = &chimesFF::compute_3B_kernel< 8>; break;
+        case  9: compute_3B_fn = &chimesFF::compute_3B_kernel< 9>; break;
+        case 10: compute_3B_fn = &chimesFF::compute_3B_kernel<10>; break;
+        case 11: compute_3B_fn = &chimesFF::compute_3B_kernel<11>; break;
+        case 12: compute_3B_fn = &chimesFF::compute_3B_kernel<12>; break;
+        default: compute_3B_fn = &chimesFF::compute_3B_kernel< 0>; break;
+    }
+    
+    switch (poly_orders[2])
+    {
+        case  2: compute_4B_fn = &chimesFF::compute_4B_kernel< 2>; break;
+        case  3: compute_4B_fn = &chimesFF::compute_4B_kernel< 3>; break;
+        case  4: compute_4B_fn = &chimesFF::compute_4B_kernel< 4>; break;
+        case  5: compute_4B_fn = &chimesFF::compute_4B_kernel< 5>; break;
+        case  6: compute_4B_fn = &chimesFF::compute_4B_kernel< 6>; break;
+        default: compute_4B_fn = &chimesFF::compute_4B_kernel< 0>; break;
+    }
 }
 
 void chimesFF::get_cutoff_2B(vector<vector<double> >  & cutoff_2b)
@@ -2165,6 +2958,37 @@ void chimesFF::build_pair_int_quad_map()
 			cout << "Warning: Did not initialize pair_int_quad_map for excluded entry " << i << endl ;
         }
     }   
+
+    // Largest outer cutoff of each pair of atom types, over the non-excluded quadruplets containing it
+    
+    chimes_4b_pair_maxcut.assign(natmtyps*natmtyps, 0.0);
+    
+    const int quad_pairs[npairs][2] = {{0,1}, {0,2}, {0,3}, {1,2}, {1,3}, {2,3}};    // ij, ik, il, jk, jl, kl
+    
+    for ( int i = 0 ; i < natmtyps*natmtyps*natmtyps*natmtyps ; i++ )
+    {
+        int quadidx = atom_int_quad_map[i];
+        
+        if (quadidx < 0)
+            continue;
+        
+        typ_idxs[0] = i / (natmtyps*natmtyps*natmtyps);
+        typ_idxs[1] = (i / (natmtyps*natmtyps)) % natmtyps;
+        typ_idxs[2] = (i / natmtyps) % natmtyps;
+        typ_idxs[3] = i % natmtyps;
+        
+        for ( int p = 0 ; p < npairs ; p++ )
+        {
+            int    ti  = typ_idxs[quad_pairs[p][0]];
+            int    tj  = typ_idxs[quad_pairs[p][1]];
+            double cut = chimes_4b_cutoff[quadidx][1][pair_int_quad_map[i][p]];
+            
+            chimes_4b_pair_maxcut[ti*natmtyps + tj] = max(chimes_4b_pair_maxcut[ti*natmtyps + tj], cut);
+            chimes_4b_pair_maxcut[tj*natmtyps + ti] = chimes_4b_pair_maxcut[ti*natmtyps + tj];
+        }
+    }
+    
+    build_edge_variants();
 }
 
 void chimesFF::build_pair_int_trip_map()
@@ -2221,6 +3045,111 @@ void chimesFF::build_pair_int_trip_map()
 			cout << "Warning: Did not initialize pair_int_trip_map for excluded entry " << i << endl ;
         }
     }
+
+    // Largest outer cutoff of each pair of atom types, over the non-excluded triplets containing it
     
+    chimes_3b_pair_maxcut.assign(natmtyps*natmtyps, 0.0);
+    
+    const int trip_pairs[npairs][2] = {{0,1}, {0,2}, {1,2}};    // ij, ik, jk
+    
+    for ( int i = 0 ; i < natmtyps*natmtyps*natmtyps ; i++ )
+    {
+        int tripidx = atom_int_trip_map[i];
+        
+        if (tripidx < 0)
+            continue;
+        
+        typ_idxs[0] = i / (natmtyps*natmtyps);
+        typ_idxs[1] = (i / natmtyps) % natmtyps;
+        typ_idxs[2] = i % natmtyps;
+        
+        for ( int p = 0 ; p < npairs ; p++ )
+        {
+            int    ti  = typ_idxs[trip_pairs[p][0]];
+            int    tj  = typ_idxs[trip_pairs[p][1]];
+            double cut = chimes_3b_cutoff[tripidx][1][pair_int_trip_map[i][p]];
+            
+            chimes_3b_pair_maxcut[ti*natmtyps + tj] = max(chimes_3b_pair_maxcut[ti*natmtyps + tj], cut);
+            chimes_3b_pair_maxcut[tj*natmtyps + ti] = chimes_3b_pair_maxcut[ti*natmtyps + tj];
+        }
+    }
+    
+    build_edge_variants();
 }
 
+int chimesFF::find_edge_variant(const int pair_idx, const int bodiedness_idx, const double inner_cutoff, const double outer_cutoff)
+{
+    // Index of the matching edge variant, which is added if it does not exist yet
+    
+    for ( int v = 0 ; v < edge_var_pair.size() ; v++ )
+        if ( (edge_var_pair[v] == pair_idx) && (edge_var_bodiedness[v] == bodiedness_idx) 
+          && (edge_var_inner[v] == inner_cutoff) && (edge_var_outer[v] == outer_cutoff) )
+            return v;
+    
+    edge_var_pair      .push_back(pair_idx);
+    edge_var_bodiedness.push_back(bodiedness_idx);
+    edge_var_inner     .push_back(inner_cutoff);
+    edge_var_outer     .push_back(outer_cutoff);
+    
+    return edge_var_pair.size() - 1;
+}
+
+void chimesFF::build_edge_variants()
+// Build the edge variant of every edge of every triplet and quadruplet type (see get_edge_variant_3B). Called by 
+// build_pair_int_trip_map and build_pair_int_quad_map, once the corresponding pair maps exist.
+{
+    edge_var_pair.clear();
+    edge_var_bodiedness.clear();
+    edge_var_inner.clear();
+    edge_var_outer.clear();
+    
+    const int trip_pairs[3][2] = {{0,1}, {0,2}, {1,2}};                            // ij, ik, jk
+    const int quad_pairs[6][2] = {{0,1}, {0,2}, {0,3}, {1,2}, {1,3}, {2,3}};    // ij, ik, il, jk, jl, kl
+    
+    int typ_idxs[4];
+    
+    edge_variant_3b.assign(3*pair_int_trip_map.size(), -1);
+    
+    for ( int i = 0 ; i < pair_int_trip_map.size() ; i++ )
+    {
+        int tripidx = atom_int_trip_map[i];
+        
+        if (tripidx < 0)
+            continue;
+        
+        typ_idxs[0] = i / (natmtyps*natmtyps);
+        typ_idxs[1] = (i / natmtyps) % natmtyps;
+        typ_idxs[2] = i % natmtyps;
+        
+        for ( int p = 0 ; p < 3 ; p++ )
+        {
+            int pair_idx = atom_int_pair_map[ typ_idxs[trip_pairs[p][0]]*natmtyps + typ_idxs[trip_pairs[p][1]] ];
+            int mapped   = pair_int_trip_map[i][p];
+            
+            edge_variant_3b[3*i+p] = find_edge_variant(pair_idx, 1, chimes_3b_cutoff[tripidx][0][mapped], chimes_3b_cutoff[tripidx][1][mapped]);
+        }
+    }
+    
+    edge_variant_4b.assign(6*pair_int_quad_map.size(), -1);
+    
+    for ( int i = 0 ; i < pair_int_quad_map.size() ; i++ )
+    {
+        int quadidx = atom_int_quad_map[i];
+        
+        if (quadidx < 0)
+            continue;
+        
+        typ_idxs[0] = i / (natmtyps*natmtyps*natmtyps);
+        typ_idxs[1] = (i / (natmtyps*natmtyps)) % natmtyps;
+        typ_idxs[2] = (i / natmtyps) % natmtyps;
+        typ_idxs[3] = i % natmtyps;
+        
+        for ( int p = 0 ; p < 6 ; p++ )
+        {
+            int pair_idx = atom_int_pair_map[ typ_idxs[quad_pairs[p][0]]*natmtyps + typ_idxs[quad_pairs[p][1]] ];
+            int mapped   = pair_int_quad_map[i][p];
+            
+            edge_variant_4b[6*i+p] = find_edge_variant(pair_idx, 2, chimes_4b_cutoff[quadidx][0][mapped], chimes_4b_cutoff[quadidx][1][mapped]);
+        }
+    }
+}
@@ -18,6 +18,7 @@
 #include<algorithm>
 #include<cmath>
 #include<map>
+#include<chrono>
 
 #define pi 3.14159265359
 
@@ -31,7 +32,8 @@ using namespace std;
 
 
 #define CHDIM 3 // The number of spatial dimensions.
-#define USE_DISTANCE_TENSOR 1 // Use tensor of distances in computing stresses.
+
+#define CHIMES_BLOCK 16 // Number of clusters contracted together by compute_3B_block/compute_4B_block.
 
 // Temporary storage for ChIMES interaction.
 class chimes2BTmp
@@ -66,11 +68,13 @@ public:
 
     vector<double>  Tn_ij,   Tn_ik,   Tn_jk;   // The Chebyshev polymonials
     vector<double>  Tnd_ij,  Tnd_ik,  Tnd_jk;  // The Chebyshev polymonial derivatives
+    vector<double>  force_scalar;              // Pair force scalars, for compute_3B calls that do not return them
 
 } ;
 
 inline chimes3BTmp::chimes3BTmp(int poly_order) : Tn_ij(poly_order+1), Tn_ik(poly_order+1), Tn_jk(poly_order+1),
-                                                  Tnd_ij(poly_order+1), Tnd_ik(poly_order+1), Tnd_jk(poly_order+1)
+                                                  Tnd_ij(poly_order+1), Tnd_ik(poly_order+1), Tnd_jk(poly_order+1),
+                                                  force_scalar(3)
 {
     ;
 }
@@ -84,12 +88,14 @@ public:
 
     vector<double>  Tn_ij, Tn_ik, Tn_il, Tn_jk, Tn_jl, Tn_kl;   // The Chebyshev polymonials
     vector<double>  Tnd_ij,Tnd_ik, Tnd_il, Tnd_jk, Tnd_jl, Tnd_kl ;  // The Chebyshev polymonial derivatives
+    vector<double>  force_scalar;                                    // Pair force scalars, for compute_4B calls that do not return them
 } ;
 
 inline chimes4BTmp::chimes4BTmp(int poly_order) : Tn_ij(poly_order+1), Tn_ik(poly_order+1), Tn_il(poly_order+1),
                                                   Tn_jk(poly_order+1), Tn_jl(poly_order+1), Tn_kl(poly_order+1),
                                                   Tnd_ij(poly_order+1), Tnd_ik(poly_order+1), Tnd_il(poly_order+1),
-                                                  Tnd_jk(poly_order+1), Tnd_jl(poly_order+1), Tnd_kl(poly_order+1)
+                                                  Tnd_jk(poly_order+1), Tnd_jl(poly_order+1), Tnd_kl(poly_order+1),
+                                                  force_scalar(6)
 {
     ;
 }
@@ -116,12 +122,119 @@ inline void chimes3BTmp::resize(int poly_order)
         Tnd_jk.resize(poly_order+1) ;   
 }
 
+inline void chimes4BTmp::resize(int poly_order)
+{
+    vector<double> * polys[12] = {&Tn_ij,  &Tn_ik,  &Tn_il,  &Tn_jk,  &Tn_jl,  &Tn_kl,
+                                  &Tnd_ij, &Tnd_ik, &Tnd_il, &Tnd_jk, &Tnd_jl, &Tnd_kl};
+
+    for (int i=0; i<12; i++)
+        if ( polys[i]->size() < poly_order + 1 )
+            polys[i]->resize(poly_order+1) ;
+}
+
+// Temporary storage for blocked 3- and 4-body evaluation: the smoothed polynomials of all clusters of a block, 
+// stored as [constituent pair][power][cluster in block] so that the contraction runs over contiguous clusters.
+// Gf and dGf hold the same in single precision (see chimesFF::set_mixed_precision).
+class chimesBlockTmp
+{
+public:
+    inline void resize(int npairs, int poly_order) ;
+    inline void get(double *& G_out, double *& dG_out) { G_out = G .data() ; dG_out = dG .data() ; }
+    inline void get(float  *& G_out, float  *& dG_out) { G_out = Gf.data() ; dG_out = dGf.data() ; }
+    vector<double> G ;
+    vector<double> dG ;
+    vector<float>  Gf ;
+    vector<float>  dGf ;
+} ;
+
+inline void chimesBlockTmp::resize(int npairs, int poly_order)
+{
+    if ( G.size() < npairs * (poly_order + 1) * CHIMES_BLOCK )
+    {
+        G  .resize(npairs * (poly_order + 1) * CHIMES_BLOCK) ;
+        dG .resize(npairs * (poly_order + 1) * CHIMES_BLOCK) ;
+        Gf .resize(npairs * (poly_order + 1) * CHIMES_BLOCK) ;
+        dGf.resize(npairs * (poly_order + 1) * CHIMES_BLOCK) ;
+    }
+}
+
+// Optional instrumentation of the hot paths. Compiled in when CHIMES_INSTRUMENT is 1 (the default; CMake
+// option WITH_INSTRUMENTATION), in which case every chimesFF instance counts its compute_2B/3B/4B calls along
+// with the calls returned early for an excluded interaction or a distance beyond the outer cutoff, and 
+// serial_chimes_interface additionally records the wall time spent in each phase of calculate. With 
+// CHIMES_INSTRUMENT 0, the counters and timers compile away and stay at zero.
+
+#ifndef CHIMES_INSTRUMENT
+#define CHIMES_INSTRUMENT 1
+#endif
+
+#if CHIMES_INSTRUMENT
+#define CHIMES_COUNT(counter) (counter)++
+#else
+#define CHIMES_COUNT(counter)
+#endif
+
+inline double chimes_wtime()
+{
+    // Wall clock time in seconds, for phase timings
+    
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class chimesStats
+{
+public:
+
+    enum phase { GHOSTS, NEIGH_2B, NEIGH_MB, LOOP_2B, LOOP_3B, LOOP_4B, NPHASES } ;
+    
+    long long calls   [3];      // [bodiedness-2]; compute_2B/3B/4B calls
+    long long excluded[3];      // [bodiedness-2]; calls for interactions excluded by the parameter file
+    long long rejected[3];      // [bodiedness-2]; calls with at least one distance beyond the outer cutoff
+    long long ncalculate;       // serial_chimes_interface::calculate calls
+    double    time[NPHASES];    // Wall time (s) per calculate phase: ghost atoms, 2b neighbor list, 3b/4b neighbor lists, 1b/2b, 3b and 4b loops
+    
+    inline chimesStats();
+    inline void reset();
+    
+    void print(ostream & out) const;
+} ;
+
+inline chimesStats::chimesStats()
+{
+    reset();
+}
+
+inline void chimesStats::reset()
+{
+    for (int i=0; i<3; i++)
+    {
+        calls[i]    = 0;
+        excluded[i] = 0;
+        rejected[i] = 0;
+    }
+    for (int i=0; i<NPHASES; i++)
+        time[i] = 0.0;
+    
+    ncalculate = 0;
+}
+
 enum class fcutType
 {
     CUBIC,
     TERSOFF,
 } ;
     
+// Quantities computed by compute_2B/3B/4B. Energies are always computed. Force scalars are computed unless only the
+// energy is requested, in which case the polynomial derivatives are skipped altogether. Forces and the stress are 
+// only accumulated if requested.
+
+enum class evalMode
+{
+    ENERGY,
+    ENERGY_FORCES,
+    ENERGY_FORCES_STRESS,
+} ;
+
 class chimesFF
 {
 public:
@@ -152,9 +265,12 @@ public:
     void compute_1B(const int typ_idx, double & energy );
         
 	// 2+B compute functions overloaded with force_scalar_in var for compatibility with LAMMPS
+	// force_scalar_in[pair] returns the total force scalar of each pair (summed over all coefficients,
+	// and including the penalty for 2B), such that the pair contributes force_scalar*dr to the first atom,
+	// -force_scalar*dr to the second, and -force_scalar*dr*dr to the stress.
 
-	void compute_2B(const double dx, const vector<double> & dr, const vector<int> typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes2BTmp &tmp);
-	void compute_2B(const double dx, const vector<double> & dr, const vector<int> typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes2BTmp &tmp, double & force_scalar_in); 
+	void compute_2B(const double dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes2BTmp &tmp);
+	void compute_2B(const double dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes2BTmp &tmp, double & force_scalar_in); 
 
 	void compute_3B(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force,vector<double> & stress, double & energy, chimes3BTmp &tmp);
 	void compute_3B(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force,vector<double> & stress, double & energy, chimes3BTmp &tmp, vector<double> & force_scalar_in); 
@@ -162,23 +278,117 @@ public:
 	void compute_4B(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes4BTmp &tmp);
 	void compute_4B(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes4BTmp &tmp, vector<double> & force_scalar_in);
 
+    // Evaluates the 2-body Chebyshev polynomials and their derivatives at distance dx into tmp.Tn and tmp.Tnd,
+    // exactly as compute_2B does before contracting them with the coefficients (used for benchmarking).
+
+    void compute_2B_polys(const double dx, const vector<int> & typ_idxs, chimes2BTmp &tmp);
+
     void get_cutoff_2B(vector<vector<double> >  & cutoff_2b);   // Populates the 2b cutoffs
     
     double max_cutoff_2B(bool silent = false);    // Returns the largest 2B cutoff
     double max_cutoff_3B(bool silent = false);    // Returns the largest 3B cutoff
     double max_cutoff_4B(bool silent = false);    // Returns the largest 4B cutoff
-        
+    
+    // Per-type cluster cutoffs, so that neighbor lists only need to hold clusters that contribute. Available after
+    // build_pair_int_trip_map/build_pair_int_quad_map. max_cutoff_XB_pair returns the largest X-body outer cutoff
+    // of a pair of atom types over all non-excluded clusters containing it (0 if there are none). cluster_within_XB
+    // returns true if compute_XB would evaluate the cluster, i.e. if the cluster type is not excluded and all 
+    // distances (ordered as for compute_XB) are below their outer cutoff plus pad.
+    
+    inline double max_cutoff_3B_pair(const int typ_i, const int typ_j);
+    inline double max_cutoff_4B_pair(const int typ_i, const int typ_j);
+    inline bool   cluster_within_3B(const double *dx, const int *typ_idxs, const double pad = 0.0);
+    inline bool   cluster_within_4B(const double *dx, const int *typ_idxs, const double pad = 0.0);
+
+    // Per-edge polynomial caching. The smoothed polynomials of a cluster edge, G = fcut*Tn and dG = d(fcut*Tn)/dr,
+    // only depend on the edge length and on its "edge variant", i.e. the pair type, the bodiedness and the inner and
+    // outer cutoffs of the edge (special cutoffs can give a pair type several variants). A caller that holds the
+    // polynomials of each (edge, variant) combination of a frame can therefore evaluate every cluster sharing an edge
+    // from a single set_edge_polys call. Available after build_pair_int_trip_map/build_pair_int_quad_map.
+    //
+    // get_edge_variant_XB returns the variant of edge "edge" (ordered as for compute_XB) of a cluster, or -1 if the
+    // cluster type is excluded. set_edge_polys fills G and dG (get_edge_variant_order+1 values each; dG is not set in
+    // evalMode::ENERGY). compute_XB_edges are equivalent to compute_XB, given the polynomials of each edge (G[edge],
+    // dG[edge]). They require a cluster that compute_XB would evaluate (see cluster_within_XB).
+
+    int         get_num_edge_variants();
+    int         get_edge_variant_order(const int variant);
+    inline int  get_edge_variant_3B(const int *typ_idxs, const int edge);
+    inline int  get_edge_variant_4B(const int *typ_idxs, const int edge);
+    void        set_edge_polys(const int variant, const double dx, double *G, double *dG);
+
+    void compute_3B_edges(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, const double * const * G, const double * const * dG, vector<double> & force, vector<double> & stress, double & energy, vector<double> & force_scalar_in);
+    void compute_4B_edges(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, const double * const * G, const double * const * dG, vector<double> & force, vector<double> & stress, double & energy, vector<double> & force_scalar_in);
+
+    // Blocked evaluation of ncl clusters of the same type (typ_idxs, in the same order for all clusters), each of which
+    // compute_XB would evaluate. Takes the polynomials of each edge as compute_XB_edges, packed as [cluster][edge], along
+    // with the packed distances ([cluster][edge]) and distance vectors ([cluster][edge][x,y,z]). Forces are added per 
+    // cluster ([cluster][atom][x,y,z]), and the energy and stress are added up over all clusters. Clusters are contracted 
+    // with the coefficients CHIMES_BLOCK at a time, vectorized over the clusters of a block.
+    
+    void compute_3B_block(const int ncl, const int *typ_idxs, const double * const * G, const double * const * dG, const double *dx, const double *dr, double *force, double *stress, double & energy, chimesBlockTmp & tmp);
+    void compute_4B_block(const int ncl, const int *typ_idxs, const double * const * G, const double * const * dG, const double *dx, const double *dr, double *force, double *stress, double & energy, chimesBlockTmp & tmp);
+
     void set_atomtypes(vector<string> & type_list);
     
     int get_atom_pair_index(int pair_id);
     void build_pair_int_trip_map() ;
     void build_pair_int_quad_map() ;
     
+    // Optional tabulated 2-body interactions. When enabled, the 2-body energy and dE/dr (excluding the penalty)
+    // are interpolated with quintic Hermite splines between the inner and outer cutoff of each pair type. Grids 
+    // are refined until the splines agree with the exact polynomials to within tolerance (kcal/mol and 
+    // kcal/mol/Angstrom). Distances below the inner cutoff always use the exact polynomials, and the penalty
+    // is always computed exactly. Must be called after read_parameters.
+    
+    void set_2B_tabulation(bool tabulate, double tolerance = 1.0e-6);
+    
+    // Optional mixed precision for compute_3B_block/compute_4B_block. When enabled, the smoothed polynomials and
+    // the 3- and 4-body coefficients are rounded to float and the products of each coefficient are formed in single
+    // precision, while the sums over coefficients, and the energies, forces and stresses, are accumulated in double.
+    // All other compute functions are unaffected. chimescalc-bench --mode precision reports the resulting errors.
+    // Must be called after read_parameters.
+    
+    void set_mixed_precision(bool mixed);
+    bool get_mixed_precision();
+    
+    // Evaluation mode (default: evalMode::ENERGY_FORCES_STRESS). Skipping the stress saves work in runs that do
+    // not need the virial, e.g. NVT or fixed cell geometry optimizations; the stress argument of the compute 
+    // functions is then left untouched.
+    
+    void     set_eval_mode(evalMode mode);
+    evalMode get_eval_mode();
+    
+    // Penalty energy added by compute_2B (also included in its energy argument), accumulated over all calls until 
+    // reset by the caller; used to report the penalty separately from the 2-body energy
+    
+    double   energy_penalty;
+    
     // Functions to aid using ChIMES Calculator for fitting
     
     inline int  get_badness();
     inline void reset_badness();
     
+    // Silence-and-count mode for badness events. By default, every 2-body distance in the penalty region and every
+    // distance below an inner cutoff prints a warning from within the compute functions. With set_badness_silent(true),
+    // these events are instead counted per event kind and pair type, along with the shortest distance observed, and
+    // reported in aggregate by print_badness_summary. Counts accumulate until reset_badness_counts is called. Silent
+    // objects with nonzero counts print their summary when destroyed.
+    
+    enum badness_event { PENALTY_2B, INNER_2B, INNER_3B, INNER_4B, NBADNESS_EVENTS } ;
+    
+    vector<long long> badness_counts;      // [event*npairs + pair type]; number of events
+    vector<double>    badness_min_dist;    // [event*npairs + pair type]; shortest distance observed
+    
+    void set_badness_silent(bool silent);
+    void reset_badness_counts();
+    void print_badness_summary(ostream & out, bool all_ranks = false);   // all_ranks: counts were reduced over all ranks
+    
+    // Instrumentation (see chimesStats)
+    
+    chimesStats stats;
+    bool        print_stats_at_exit;    // If true, rank 0 prints stats when the object is destroyed
+    
 private:
         
     string            xform_style;    //  Morse, direct, inverse, etc...
@@ -188,6 +398,7 @@ private:
     vector<double>    morse_var;      // [npairs]; morse_lambda
     vector<double>    penalty_params; // [2];  Second dimension: [0] = A_pen, [1] = d_pen
     vector<double>    energy_offsets; // [natmtyps]; Single atom ChIMES energies
+    bool              badness_silent; // If true, count penalty/inner cutoff events instead of printing warnings
     int               badness;        // Keeps track of whether any interactions for atoms owned by proc rank are below rcutin, in the penalty region, or in the r>rcutin+dp region. 0 = good, 1 = in penalty region, 2 = below rcutin 
         
     // Names (chemical symbols for constituent atoms) .. handled differently for 2-body versus >2-body interactions
@@ -226,6 +437,7 @@ private:
     vector       <int>    atom_idx_trip_map;    // [nmaps] "slow" maps, based on atom chemical symbol    // Used to build int map -- gives correspoding parameter index (i.e. 3)
     vector       <int>    atom_int_trip_map;    // [nmaps] "fast" maps, based on atom type index         // gives the correspoding parameter index (i.e. 3) for a unique integer built from type index of three atoms of arbitrary order
     vector<vector<int> >   pair_int_trip_map ;  // Gives the atom pair indices for an arbitrary triplet of atom types.  
+    vector    <double>   chimes_3b_pair_maxcut; // [natmtyps*natmtyps]; largest 3b outer cutoff of each pair of atom types
 
     // 4-body maps
         
@@ -233,7 +445,20 @@ private:
     vector      <int>        atom_idx_quad_map; // [nmaps] "slow" maps, based on atom chemical symbol    // Used to build int map -- gives correspoding parameter index (i.e. 3)
     vector      <int>        atom_int_quad_map; // [nmaps] "fast" maps, based on atom type index         // gives the correspoding parameter index (i.e. 3) for a unique integer built from type index of four atoms of arbitrary order
     vector<vector<int> >    pair_int_quad_map ;  // Gives the atom pair indices for an arbitrary quad of atom types.
-        
+    vector    <double>     chimes_4b_pair_maxcut; // [natmtyps*natmtyps]; largest 4b outer cutoff of each pair of atom types
+
+    // Edge variants (see get_edge_variant_3B), rebuilt by build_edge_variants
+
+    vector<int>    edge_variant_3b;        // [natmtyps^3 * 3]; variant of each edge of each triplet type, -1 if excluded
+    vector<int>    edge_variant_4b;        // [natmtyps^4 * 6]; variant of each edge of each quadruplet type, -1 if excluded
+    vector<int>    edge_var_pair;          // [nvariants]; pair type index
+    vector<int>    edge_var_bodiedness;    // [nvariants]; bodiedness index (1 = 3-body, 2 = 4-body)
+    vector<double> edge_var_inner;         // [nvariants]; inner cutoff
+    vector<double> edge_var_outer;         // [nvariants]; outer cutoff
+
+    void build_edge_variants();
+    int  find_edge_variant(const int pair_idx, const int bodiedness_idx, const double inner_cutoff, const double outer_cutoff);
+
     ////////////////////////
     // Polynomial parameters 
     ////////////////////////
@@ -247,28 +472,99 @@ private:
     vector<vector<double> > chimes_2b_params;    // [npairs][npowers] 2-body polynomial coefficients 
     vector<vector<double> > chimes_2b_cutoff;    // [npairs][2] inner and outer cutoff for pair
 
+    // 2-body coefficients stored densely by polynomial order, for Clenshaw evaluation (see build_2B_dense)
+
+    vector<vector<double> > chimes_2b_dense;     // [npairs][poly_order+1] coefficient of T_n (0 if absent)
+    vector<double>          chimes_2b_xavg;      // [npairs] midpoint of the Morse-transformed distance range
+    vector<double>          chimes_2b_xdiff;     // [npairs] (negated) half-width of the Morse-transformed distance range
+
+    void build_2B_dense();
+
     vector<int>                      ncoeffs_3b;          // [ntrips]
     vector<vector<vector<int> > >    chimes_3b_powers;    // [ntrips][nparams][constit. pair]
     vector<vector<double> >          chimes_3b_params;    // [ntrips][nparams]    
     vector<vector<vector<double> > > chimes_3b_cutoff;    // [ntrips][2][constit. pair] inner and outer cutoff for pair 1
 
-        
+    // 3-body coefficients regrouped for factorized evaluation (see build_3B_factorization). Coefficients are
+    // sorted by their constituent pair powers (p0,p1,p2) and stored as a two-level tree: each distinct p0 owns
+    // a range of distinct (p0,p1) groups, and each (p0,p1) group owns a range of (p2, coefficient) leaves.
+
+    vector<vector<int> >             chimes_3b_fact_p0;        // [ntrips][n p0 groups] power of constit. pair 0
+    vector<vector<int> >             chimes_3b_fact_p0_end;    // [ntrips][n p0 groups] end of the group's (p0,p1) range
+    vector<vector<int> >             chimes_3b_fact_p1;        // [ntrips][n (p0,p1) groups] power of constit. pair 1
+    vector<vector<int> >             chimes_3b_fact_p1_end;    // [ntrips][n (p0,p1) groups] end of the group's leaf range
+    vector<vector<int> >             chimes_3b_fact_p2;        // [ntrips][nparams] power of constit. pair 2
+    vector<vector<double> >          chimes_3b_fact_params;    // [ntrips][nparams] coefficient
+
+    void build_3B_factorization();
+
     vector<int>                      ncoeffs_4b;          // [nquads]
     vector<vector<vector<int> > >    chimes_4b_powers;    // [nquads][nparams][constit. pair]
     vector<vector<double> >          chimes_4b_params;    // [nquads][nparams]    
+    
+    // Single precision copies of the 3- and 4-body coefficients for the blocked kernels (see set_mixed_precision)
+    
+    bool                             mixed_precision;
+    vector<vector<float> >           chimes_3b_fact_params_f;  // [ntrips][nparams] as chimes_3b_fact_params
+    vector<vector<float> >           chimes_4b_params_f;       // [nquads][nparams] as chimes_4b_params
     vector<vector<vector<double> > > chimes_4b_cutoff;    // [nquads][2][constit. pair] inner and outer cutoff for pair 1
 
+    // Polynomial order-specialized compute kernels. ORDER = 0 gives the generic kernel, which takes the 
+    // polynomial order from poly_orders and stores Tn/Tnd in the chimesXBTmp objects. Other instantiations 
+    // use fixed-size stack arrays and fully unrollable recursions. The kernel called by compute_XB is
+    // selected once, at the end of read_parameters (see select_compute_kernels).
+    
+    template<int ORDER> void compute_2B_kernel(const double dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes2BTmp &tmp, double & force_scalar_in); 
+    template<int ORDER> void compute_3B_kernel(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force,vector<double> & stress, double & energy, chimes3BTmp &tmp, vector<double> & force_scalar_in); 
+    template<int ORDER> void compute_4B_kernel(const vector<double> & dx, const vector<double> & dr, const vector<int> & typ_idxs, vector<double> & force, vector<double> & stress, double & energy, chimes4BTmp &tmp, vector<double> & force_scalar_in);
+
+    typedef void (chimesFF::*compute_2B_t)(const double, const vector<double> &, const vector<int> &, vector<double> &, vector<double> &, double &, chimes2BTmp &, double &);
+    typedef void (chimesFF::*compute_3B_t)(const vector<double> &, const vector<double> &, const vector<int> &, vector<double> &, vector<double> &, double &, chimes3BTmp &, vector<double> &);
+    typedef void (chimesFF::*compute_4B_t)(const vector<double> &, const vector<double> &, const vector<int> &, vector<double> &, vector<double> &, double &, chimes4BTmp &, vector<double> &);
+    
+    compute_2B_t compute_2B_fn;
+    compute_3B_t compute_3B_fn;
+    compute_4B_t compute_4B_fn;
+    
+    void select_compute_kernels();
+    
+    // Tabulated 2-body interactions (see set_2B_tabulation)
+    
+    // Each table is a uniform grid from the inner cutoff to r_split and a second uniform grid from r_split to 
+    // the outer cutoff. r_split is the Tersoff cutoff function kick-in distance (where d2E/dr2 is discontinuous),
+    // or the outer cutoff if there is no such point.
+    
+    evalMode                 eval_mode;          // Which quantities the compute functions update
+    
+    bool                     tabulate_2b;        // Interpolate 2-body interactions from tables?
+    vector<int>              tab_2b_nintervals;  // [npairs] total number of grid intervals
+    vector<int>              tab_2b_nlower;      // [npairs] number of grid intervals below r_split
+    vector<double>           tab_2b_rsplit;      // [npairs] r_split
+    vector<double>           tab_2b_inv_h_lower; // [npairs] inverse grid spacing below r_split
+    vector<double>           tab_2b_inv_h_upper; // [npairs] inverse grid spacing above r_split
+    vector<vector<double> >  tab_2b_coeffs;      // [npairs][6*nintervals] quintic coefficients of E(t) for each interval, t in [0,1]
+    
+    void build_2B_table(const int pair_idx, const int nintervals);
+    void get_2B_table_interval(const int pair_idx, const int k, double & r0, double & r1);
+    void get_2B_exact(const double dx, const int pair_idx, double & E, double & dEdr);
+    inline void get_2B_tabulated(const double dx, const int pair_idx, double & E, double & dEdr);
+    
     // Tools for compute functions
-        
-    inline void set_cheby_polys(vector<double> &Tn, vector<double> &Tnd, double dx, const int pair_idx,
-                                const double inner_cutoff, const double outer_cutoff, const int bodiedness_idx) ;
+    
+    template<int ORDER>
+    inline void set_cheby_polys(double *Tn, double *Tnd, double dx, const int pair_idx,
+                                const double inner_cutoff, const double outer_cutoff, const int bodiedness_idx, const bool derivs = true) ;
 
-	void set_polys_out_of_range(vector<double> &Tn, vector<double> &Tnd, double dx, double x,
+	void set_polys_out_of_range(double *Tn, double *Tnd, double dx, double x,
 								int poly_order, double inner_cutoff, double exprlen, double dx_dr) ;
+
+    template<int ORDER>
+    inline void get_2B_clenshaw(const double dx, const int pair_idx, const bool derivs, double & S, double & dSdr) ;
     
     inline void get_fcut(const double dx, const double outer_cutoff, double & fcut, double & fcutderiv);
         
     inline void get_penalty(const double dx, const int & pair_idx, double & E_penalty, double & force_scalar);
+    inline void count_badness(const int event, const int pair_idx, const double dx);
         
     inline void build_atom_and_pair_mappers(const int natoms, const int npairs, const vector<int> & typ_idxs,
                                             const vector<string> & clu_params_atm_chems, vector<int >  & mapped_pair_idx);
@@ -290,9 +586,25 @@ private:
         
     void print_pretty_stuff();
 
-    inline double dr2_3B(const double *dr2, int i, int j, int k, int l) ;
-    inline double dr2_4B(const double *dr2, int i, int j, int k, int l) ;
-    inline void init_distance_tensor(double *dr2, const vector<double> & dr, int natoms)    ;
+    template<int NATOMS>
+    inline void accumulate_cluster(const double *force_scalar, const double *dr, double *force, double *stress);
+    
+    // Contract the smoothed polynomials of each edge of a cluster (G = fcut*Tn, dG = d(fcut*Tn)/dr, ordered as dx)
+    // with the cluster coefficients, and accumulate the energy, forces and stress; shared by compute_XB and 
+    // compute_XB_edges
+    
+    inline void contract_3B(const int tripidx, const int *mapped_pair_idx, const double * const * G, const double * const * dG, const double *dx, const double *dr, 
+                            double *force, double *stress, double & energy, double *force_scalar_in, const bool derivs);
+    inline void contract_4B(const int quadidx, const int *mapped_pair_idx, const double * const * G, const double * const * dG, const double *dx, const double *dr, 
+                            double *force, double *stress, double & energy, double *force_scalar_in, const bool derivs);
+    
+    // Blocked contractions behind compute_XB_block, with the polynomials and coefficients in precision REAL (double,
+    // or float for mixed precision)
+    
+    template<typename REAL> void contract_3B_block(const int ncl, const int tripidx, const int *mapped_pair_idx, const REAL *coeff, const double * const * G, const double * const * dG, 
+                                                   const double *dx, const double *dr, double *force, double *stress, double & energy, chimesBlockTmp & tmp);
+    template<typename REAL> void contract_4B_block(const int ncl, const int quadidx, const int *mapped_pair_idx, const REAL *coeff, const double * const * G, const double * const * dG, 
+                                                   const double *dx, const double *dr, double *force, double *stress, double & energy, chimesBlockTmp & tmp);
 };
 
 
@@ -360,6 +672,12 @@ inline void chimesFF::get_penalty(const double dx, const int & pair_idx, double
 
         force_scalar = -3.0 * r_penalty * r_penalty * penalty_params[1];
 
+        if (badness_silent)
+        {
+            count_badness(PENALTY_2B, pair_idx, dx);
+        }
+        else
+        {
         //if (rank == 0) // Commenting out - we need all ranks to report if the penalty function has been sampled
         //{
             cout << "chimesFF: " << "Adding penalty in 2B Cheby calc, r < rmin+penalty_dist " << fixed 
@@ -368,9 +686,176 @@ inline void chimesFF::get_penalty(const double dx, const int & pair_idx, double
                  << " pair type: " << pair_idx << endl;
             cout << "chimesFF: " << "\t...Penalty potential = "<< E_penalty << endl;
         //}
+        }
     }   
 }
 
+inline void chimesFF::count_badness(const int event, const int pair_idx, const double dx)
+{
+    const int idx = event*chimes_2b_cutoff.size() + pair_idx;
+    
+    badness_counts[idx]++;
+    
+    if (dx < badness_min_dist[idx])
+        badness_min_dist[idx] = dx;
+}
+
+inline void chimesFF::get_2B_tabulated(const double dx, const int pair_idx, double & E, double & dEdr)
+{
+    // Evaluates the 2-body energy and dE/dr from the pair type's quintic spline table.
+    // Assumes inner cutoff <= dx < outer cutoff.
+    
+    double s, inv_h;
+    int    k;
+    
+    if (dx < tab_2b_rsplit[pair_idx])
+    {
+        inv_h = tab_2b_inv_h_lower[pair_idx];
+        s     = (dx - chimes_2b_cutoff[pair_idx][0]) * inv_h;
+        k     = (int) s;
+        
+        if (k >= tab_2b_nlower[pair_idx])
+            k = tab_2b_nlower[pair_idx] - 1;
+            
+        s -= k;
+    }
+    else
+    {
+        inv_h = tab_2b_inv_h_upper[pair_idx];
+        s     = (dx - tab_2b_rsplit[pair_idx]) * inv_h;
+        k     = (int) s;
+        
+        if (k >= tab_2b_nintervals[pair_idx] - tab_2b_nlower[pair_idx])
+            k = tab_2b_nintervals[pair_idx] - tab_2b_nlower[pair_idx] - 1;
+            
+        s -= k;
+        k += tab_2b_nlower[pair_idx];
+    }
+    
+    const double t  = s;
+    const double *c = &tab_2b_coeffs[pair_idx][6*k];
+    
+    E    = c[0] + t*(    c[1] + t*(    c[2] + t*(    c[3] + t*(    c[4] + t*c[5]))));
+    dEdr =             (c[1] + t*(2.0*c[2] + t*(3.0*c[3] + t*(4.0*c[4] + t*5.0*c[5])))) * inv_h;
+}
+
+template<int NATOMS>
+inline void chimesFF::accumulate_cluster(const double *force_scalar, const double *dr, double *force, double *stress)
+{
+    // Accumulates the forces and stress of a cluster from its per-pair force scalars, as requested by eval_mode.
+    // Pairs are ordered ij, ik, ..., jk, ... (e.g. ij, ik, il, jk, jl, kl for 4 atoms), with packed dr of each pair.
+    // Each pair contributes force_scalar*dr to its first atom, -force_scalar*dr to its second atom, and 
+    // -force_scalar*dr*dr to the stress [sxx, sxy, sxz, syy, syz, szz].
+    
+    if (eval_mode == evalMode::ENERGY)
+        return;
+    
+    int p = 0;
+    
+    for (int a=0; a<NATOMS; a++)
+    {
+        for (int b=a+1; b<NATOMS; b++, p++)
+        {
+            const double   fs = force_scalar[p];
+            const double * d  = dr + p*CHDIM;
+            
+            force[a*CHDIM+0] += fs * d[0];
+            force[a*CHDIM+1] += fs * d[1];
+            force[a*CHDIM+2] += fs * d[2];
+            
+            force[b*CHDIM+0] -= fs * d[0];
+            force[b*CHDIM+1] -= fs * d[1];
+            force[b*CHDIM+2] -= fs * d[2];
+        }
+    }
+    
+    if (eval_mode != evalMode::ENERGY_FORCES_STRESS)
+        return;
+    
+    for (p=0; p<NATOMS*(NATOMS-1)/2; p++)
+    {
+        const double   fs = force_scalar[p];
+        const double * d  = dr + p*CHDIM;
+        
+        stress[0] -= fs * d[0] * d[0]; // xx tensor component
+        stress[1] -= fs * d[0] * d[1]; // xy tensor component
+        stress[2] -= fs * d[0] * d[2]; // xz tensor component
+        stress[3] -= fs * d[1] * d[1]; // yy tensor component
+        stress[4] -= fs * d[1] * d[2]; // yz tensor component
+        stress[5] -= fs * d[2] * d[2]; // zz tensor component
+    }
+}
+
+inline double chimesFF::max_cutoff_3B_pair(const int typ_i, const int typ_j)
+{
+    if (chimes_3b_pair_maxcut.size() == 0)
+        return 0.0;
+    
+    return chimes_3b_pair_maxcut[typ_i*natmtyps + typ_j];
+}
+
+inline double chimesFF::max_cutoff_4B_pair(const int typ_i, const int typ_j)
+{
+    if (chimes_4b_pair_maxcut.size() == 0)
+        return 0.0;
+    
+    return chimes_4b_pair_maxcut[typ_i*natmtyps + typ_j];
+}
+
+inline bool chimesFF::cluster_within_3B(const double *dx, const int *typ_idxs, const double pad)
+{
+    // Same checks as compute_3B_kernel
+    
+    if (pair_int_trip_map.size() == 0)
+        return false;
+    
+    int type_idx = typ_idxs[0]*natmtyps*natmtyps + typ_idxs[1]*natmtyps + typ_idxs[2];
+    int tripidx  = atom_int_trip_map[type_idx];
+    
+    if (tripidx < 0)
+        return false;
+    
+    const vector<int> & mapped_pair_idx = pair_int_trip_map[type_idx];
+    
+    for (int i=0; i<3; i++)
+        if (dx[i] >= chimes_3b_cutoff[tripidx][1][mapped_pair_idx[i]] + pad)
+            return false;
+    
+    return true;
+}
+
+inline bool chimesFF::cluster_within_4B(const double *dx, const int *typ_idxs, const double pad)
+{
+    // Same checks as compute_4B_kernel
+    
+    if (pair_int_quad_map.size() == 0)
+        return false;
+    
+    int idx = typ_idxs[0]*natmtyps*natmtyps*natmtyps + typ_idxs[1]*natmtyps*natmtyps + typ_idxs[2]*natmtyps + typ_idxs[3];
+    int quadidx = atom_int_quad_map[idx];
+    
+    if (quadidx < 0)
+        return false;
+    
+    const vector<int> & mapped_pair_idx = pair_int_quad_map[idx];
+    
+    for (int i=0; i<6; i++)
+        if (dx[i] >= chimes_4b_cutoff[quadidx][1][mapped_pair_idx[i]] + pad)
+            return false;
+    
+    return true;
+}
+
+inline int chimesFF::get_edge_variant_3B(const int *typ_idxs, const int edge)
+{
+    return edge_variant_3b[(typ_idxs[0]*natmtyps*natmtyps + typ_idxs[1]*natmtyps + typ_idxs[2])*3 + edge];
+}
+
+inline int chimesFF::get_edge_variant_4B(const int *typ_idxs, const int edge)
+{
+    return edge_variant_4b[(typ_idxs[0]*natmtyps*natmtyps*natmtyps + typ_idxs[1]*natmtyps*natmtyps + typ_idxs[2]*natmtyps + typ_idxs[3])*6 + edge];
+}
+
 inline int chimesFF::get_badness()
 {
     return badness;
@@ -492,13 +977,19 @@ inline void chimesFF::build_atom_and_pair_mappers(const int natoms, const int np
 }
 
 
-inline void chimesFF::set_cheby_polys(vector<double> &Tn, vector<double> &Tnd, double dx, const int pair_idx,
-									  const double inner_cutoff, const double outer_cutoff, const int bodiedness_idx) 
+template<int ORDER>
+inline void chimesFF::set_cheby_polys(double *Tn, double *Tnd, double dx, const int pair_idx,
+									  const double inner_cutoff, const double outer_cutoff, const int bodiedness_idx, const bool derivs) 
 {
     // Currently assumes a Morse-style transformation has been requested
     
     // Sets the value of the Chebyshev polynomials (Tn) and their derivatives (Tnd).  Tnd is the derivative
-    // with respect to the interatomic distance, not the transformed distance (x).
+    // with respect to the interatomic distance, not the transformed distance (x). If derivs is false, Tnd is
+    // left unset (except below the inner cutoff).
+    //
+    // If ORDER > 0 it is used as the polynomial order, so that the recursions below have compile-time bounds.
+    
+    const int poly_order = (ORDER > 0) ? ORDER : poly_orders[bodiedness_idx];
     
     // Do the Morse transformation
     
@@ -545,6 +1036,14 @@ inline void chimesFF::set_cheby_polys(vector<double> &Tn, vector<double> &Tnd, d
         
         Tn[0] = 1.0;
         Tn[1] = x;
+        
+        if ( ! derivs )
+        {
+            for ( int i = 2; i <= poly_order; i++ ) 
+                Tn[i]  = 2.0 * x *  Tn[i-1] -  Tn[i-2];
+            
+            return;
+        }
     
         // Start the derivative setup. Set the first two 1st-kind Cheby's equal to the first two of the 2nd-kind
 
@@ -553,7 +1052,7 @@ inline void chimesFF::set_cheby_polys(vector<double> &Tn, vector<double> &Tnd, d
     
         // Use recursion to set up the higher n-value Tn and Tnd's
 
-        for ( int i = 2; i <= poly_orders[bodiedness_idx]; i++ ) 
+        for ( int i = 2; i <= poly_order; i++ ) 
         {
             Tn[i]  = 2.0 * x *  Tn[i-1] -  Tn[i-2];
             Tnd[i] = 2.0 * x * Tnd[i-1] - Tnd[i-2];
@@ -564,21 +1063,103 @@ inline void chimesFF::set_cheby_polys(vector<double> &Tn, vector<double> &Tnd, d
         // The following dx_dr compuation assumes a Morse transformation
         // DERIV_CONST is no longer used. (old way: dx_dr = DERIV_CONST*cheby_var_deriv(x_diff, rlen, ff_2body.LAMBDA, ff_2body.CHEBY_TYPE, exprlen);)
 
-        for ( int i = poly_orders[bodiedness_idx]; i >= 1; i-- ) 
+        for ( int i = poly_order; i >= 1; i-- ) 
             Tnd[i] = i * dx_dr * Tnd[i-1];
 
         Tnd[0] = 0.0;
     }
     else // out_of_range == true
     {
-		cout << "Warning: An intermolecular distance less than the inner cutoff = " << inner_cutoff << " was found\n " ;
-		cout << "         Distance = " << dx_orig << endl ;
-
-		set_polys_out_of_range(Tn, Tnd, dx_orig, x, poly_orders[bodiedness_idx], inner_cutoff, exprlen, dx_dr) ;
+		if (badness_silent)
+		{
+			count_badness(INNER_2B + bodiedness_idx, pair_idx, dx_orig);
+		}
+		else
+		{
+			cout << "Warning: An intermolecular distance less than the inner cutoff = " << inner_cutoff << " was found\n " ;
+			cout << "         Distance = " << dx_orig << endl ;
+		}
+
+		set_polys_out_of_range(Tn, Tnd, dx_orig, x, poly_order, inner_cutoff, exprlen, dx_dr) ;
     }        
 
 }
 
+template<int ORDER>
+inline void chimesFF::get_2B_clenshaw(const double dx, const int pair_idx, const bool derivs, double & S, double & dSdr)
+{
+    // Sums the 2-body polynomial, S = sum_n c_n T_n(x), and dS/dr with Clenshaw recurrences over the dense 
+    // coefficients, without forming Tn/Tnd. Matches contracting the output of set_cheby_polys with the coefficients, 
+    // including the treatment of distances below the inner cutoff (see set_polys_out_of_range). dSdr is only set 
+    // if derivs is true.
+    
+    const int      poly_order   = (ORDER > 0) ? ORDER : poly_orders[0];
+    const double * c            = chimes_2b_dense[pair_idx].data();
+    const double   inner_cutoff = chimes_2b_cutoff[pair_idx][0];
+    
+    const bool   out_of_range = (dx < inner_cutoff);
+    const double r            = out_of_range ? inner_cutoff : dx;
+    
+    double exprlen = exp(-1*r/morse_var[pair_idx]);
+    double x       = (exprlen - chimes_2b_xavg[pair_idx])/chimes_2b_xdiff[pair_idx];
+    double dx_dr   = (-exprlen/morse_var[pair_idx])/chimes_2b_xdiff[pair_idx];
+    
+    // b_k = c_k + 2x b_k+1 - b_k+2 gives S = c_0 + x b_1 - b_2. The derivative, dS/dx = sum_n n c_n U_n-1(x), 
+    // follows from the same recurrence for Chebyshev polynomials of the 2nd kind, with coefficients n c_n.
+    
+    double b1 = 0.0, b2 = 0.0;
+    double u1 = 0.0, u2 = 0.0;
+    double tmp;
+    
+    if ( ! (derivs || out_of_range) )
+    {
+        for ( int k = poly_order; k >= 1; k-- )
+        {
+            tmp = c[k] + 2.0 * x * b1 - b2;
+            b2  = b1;
+            b1  = tmp;
+        }
+        
+        S = c[0] + x * b1 - b2;
+        
+        return;
+    }
+    
+    for ( int k = poly_order; k >= 1; k-- )
+    {
+        tmp = c[k] + 2.0 * x * b1 - b2;
+        b2  = b1;
+        b1  = tmp;
+        
+        tmp = k * c[k] + 2.0 * x * u1 - u2;
+        u2  = u1;
+        u1  = tmp;
+    }
+    
+    S    = c[0] + x * b1 - b2;
+    dSdr = dx_dr * u1;
+    
+    if ( out_of_range )
+    {
+        if (badness_silent)
+        {
+            count_badness(INNER_2B, pair_idx, dx);
+        }
+        else
+        {
+            cout << "Warning: An intermolecular distance less than the inner cutoff = " << inner_cutoff << " was found\n " ;
+            cout << "         Distance = " << dx << endl ;
+        }
+        
+        // Exponential damping of the derivative, as in set_polys_out_of_range
+        
+        double damp_fac = exp( (dx-inner_cutoff) / inner_smooth_distance ) ;
+        
+        S    += inner_smooth_distance * (damp_fac-1.0) * dSdr ;
+        dSdr *= damp_fac ;
+    }
+}
+
 #endif
 
 
@@ -11,6 +11,9 @@ option(WITH_FORTRAN_API "Whether the Fortran API should be built" TRUE)
 # Enable if you want to build a Fortran 2008 style object oriented interface
 option(WITH_FORTRAN08_API "Whether the Fortran 2008 style API should be built" TRUE)
 
+# Hot-path timers and counters (see chimesStats in chimesFF.h); cheap enough to leave on in production
+option(WITH_INSTRUMENTATION "Whether the instrumentation timers and counters should be compiled in" TRUE)
+
 # Turn this on, if the libraries should be built as shared libraries
 option(BUILD_SHARED_LIBS "Whether the libraries built should be shared" TRUE)
 
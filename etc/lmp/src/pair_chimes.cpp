@@ -70,7 +70,24 @@ PairCHIMES::PairCHIMES(LAMMPS *lmp) : Pair(lmp)
 	MPI_Comm_rank(world,&me);
 	
 	chimes_calculator.init(me);  
-    for_fitting = false;
+    for_fitting   = false;
+	quiet_badness = false;
+	use_half_list = false;
+	list_mb       = NULL;
+	
+	tabulate_2b     = false;
+	tabulate_2b_tol = 1.0e-6;
+	
+	stream_4b       = false;
+	stream_4b_tile  = 4096;
+	
+	// Per-body-order energies for compute pair: 1-, 2- (excluding the penalty), 3-, 4-body, and penalty
+	
+	nextra  = 5;
+	pvector = new double[nextra];
+	
+	for (int n=0; n<nextra; n++)
+		pvector[n] = 0.0;
 	
 	// 2, 3, and 4-body vars for chimesFF access
 
@@ -90,6 +107,9 @@ PairCHIMES::PairCHIMES(LAMMPS *lmp) : Pair(lmp)
 	typ_idxs_3b.resize(3);
 	typ_idxs_4b.resize(4);
 	
+	fscalar_3b.resize(3);
+	fscalar_4b.resize(6);
+	
 	// Vars for neighlist construction
 	
 	tmp_3mer.resize(3);
@@ -108,6 +128,8 @@ PairCHIMES::PairCHIMES(LAMMPS *lmp) : Pair(lmp)
 
 PairCHIMES::~PairCHIMES()
 {
+	delete [] pvector;
+	
 	if (allocated) 
 	{   	    
 	    memory->destroy(setflag);
@@ -116,23 +138,69 @@ PairCHIMES::~PairCHIMES()
     
     if (badness_stream.is_open())
         badness_stream.close();
-}	
-
-void PairCHIMES::settings(int narg, char **arg)
-{
-	if (narg > 1) 
-		error -> all(FLERR,"Illegal pair_style command. Expects no more than one arguments (string: fitting)");
+    
+    // Report the badness counts of all ranks at once
+    
+    if (quiet_badness)
+    {
+        int nentries = chimes_calculator.badness_counts.size();
         
-    if (narg == 1) 
-    {  
-        if (utils::strmatch(arg[0],"fitting"))
+        vector<long long> counts  (nentries);
+        vector<double>    min_dist(nentries);
+        
+        MPI_Reduce(chimes_calculator.badness_counts.data(),   counts.data(),   nentries, MPI_LONG_LONG, MPI_SUM, 0, world);
+        MPI_Reduce(chimes_calculator.badness_min_dist.data(), min_dist.data(), nentries, MPI_DOUBLE,    MPI_MIN, 0, world);
+        
+        if (comm->me == 0)
         {
-            for_fitting   = true;
-            stringstream ss;
-            ss << chimes_calculator.rank;
-            badness_stream.open("rank-" + ss.str() + ".badness.log");    
+            chimes_calculator.badness_counts   = counts;
+            chimes_calculator.badness_min_dist = min_dist;
+            chimes_calculator.print_badness_summary(cout, true);
         }
+        
+        chimes_calculator.reset_badness_counts();   // Already reported
     }
+}	
+
+void PairCHIMES::settings(int narg, char **arg)
+{
+	// Expect: pair_style chimesFF [fitting] [quiet] [half] [tabulate <tolerance>] [stream4b]
+	
+	for (int iarg=0; iarg<narg; iarg++)
+	{  
+		if (utils::strmatch(arg[iarg],"fitting"))
+		{
+			for_fitting   = true;
+			stringstream ss;
+			ss << chimes_calculator.rank;
+			badness_stream.open("rank-" + ss.str() + ".badness.log");    
+		}
+		else if (utils::strmatch(arg[iarg],"quiet"))
+		{
+			quiet_badness = true;
+			chimes_calculator.set_badness_silent(true);
+		}
+		else if (utils::strmatch(arg[iarg],"half"))
+		{
+			use_half_list = true;
+		}
+		else if (utils::strmatch(arg[iarg],"tabulate"))
+		{
+			if (iarg+1 >= narg)
+				error -> all(FLERR,"Illegal pair_style command. Keyword tabulate expects a tolerance");
+				
+			tabulate_2b     = true;
+			tabulate_2b_tol = utils::numeric(FLERR,arg[++iarg],false,lmp);
+		}
+		else if (utils::strmatch(arg[iarg],"stream4b"))
+		{
+			stream_4b = true;
+		}
+		else
+		{
+			error -> all(FLERR,"Illegal pair_style command. Expects: pair_style chimesFF [fitting] [quiet] [half] [tabulate <tolerance>] [stream4b]");
+		}
+	}
 
 	return;	
 }
@@ -147,6 +215,13 @@ void PairCHIMES::coeff(int narg, char **arg)
 	chimesFF_paramfile = arg[2]; 
 	
 	chimes_calculator.read_parameters(chimesFF_paramfile);
+	
+	if (tabulate_2b)
+		chimes_calculator.set_2B_tabulation(true, tabulate_2b_tol);
+	
+	// The virial is tallied from the per-pair force scalars, so the ChIMES stress is never needed
+	
+	chimes_calculator.set_eval_mode(evalMode::ENERGY_FORCES);
 
 	set_chimes_type();
     
@@ -205,13 +280,52 @@ void PairCHIMES::init_style()
 	if (force->newton_pair == 0)
 		error->all(FLERR,"Pair style ChIMES requires newton pair on");	
 	
-	// Set up neighbor lists... borrowing this from pair_airebo:
-	// need a full neighbor list, including neighbors of ghosts
+	if (!use_half_list)
+	{
+		// Set up neighbor lists... borrowing this from pair_airebo:
+		// need a full neighbor list, including neighbors of ghosts
+
+		int irequest = neighbor->request(this,instance_me);
+		neighbor->requests[irequest]->half = 0;
+		neighbor->requests[irequest]->full = 1;
+		neighbor->requests[irequest]->ghost = 1;
+		
+		return;
+	}
+	
+	// Half list mode: a standard half list (newton on) for the 2-body term ...
 
 	int irequest = neighbor->request(this,instance_me);
-	neighbor->requests[irequest]->half = 0;
-	neighbor->requests[irequest]->full = 1;
-	neighbor->requests[irequest]->ghost = 1;
+	neighbor->requests[irequest]->id = 0;
+	
+	// ... and, only if the model has many-body terms, a full list (including neighbors of ghosts)
+	// trimmed to the largest 3-/4-body cutoff for cluster enumeration
+	
+	if ( (chimes_calculator.poly_orders[1] == 0) &&  (chimes_calculator.poly_orders[2] == 0))
+		return;
+
+	irequest = neighbor->request(this,instance_me);
+	neighbor->requests[irequest]->id     = 1;
+	neighbor->requests[irequest]->half   = 0;
+	neighbor->requests[irequest]->full   = 1;
+	neighbor->requests[irequest]->ghost  = 1;
+	neighbor->requests[irequest]->cut    = 1;
+	neighbor->requests[irequest]->cutoff = (maxcut_3b > maxcut_4b) ? maxcut_3b : maxcut_4b;
+}
+
+void PairCHIMES::init_list(int id, NeighList *ptr)
+{
+	// Default mode requests a single list, used for both 2-body and many-body interactions
+	
+	if (id == 0) 
+	{
+		list = ptr;
+		
+		if (!use_half_list)
+			list_mb = ptr;
+	}
+	else if (id == 1) 
+		list_mb = ptr;
 }
 
 double PairCHIMES::init_one(int i, int j)
@@ -245,6 +359,68 @@ inline double PairCHIMES::get_dist(int i, int j)
 	return get_dist(i,j, dummy_dr);
 }
 
+inline void PairCHIMES::tally_mb(const int natoms, const int * atoms, const double energy, const double * fscalar, const double * dr)
+{
+	// Tallies the energy and per-atom energy/virial of a single 1-, 2-, 3-, or 4-body cluster directly
+	// from the per-pair force scalars returned by chimesFF. Pair p contributes fscalar[p]*dr[p] to the 
+	// force on its first atom, so its virial is -fscalar[p]*dr[p]*dr[p], split evenly between both atoms.
+	// Energies are split evenly between all atoms in the cluster. Expects newton_pair = 1.
+	
+	static const int pair_atoms_2b[1][2] = {{0,1}};
+	static const int pair_atoms_3b[3][2] = {{0,1},{0,2},{1,2}};						// ij, ik, jk
+	static const int pair_atoms_4b[6][2] = {{0,1},{0,2},{0,3},{1,2},{1,3},{2,3}};	// ij, ik, il, jk, jl, kl
+	
+	if (eflag_global)
+	{
+		eng_vdwl += energy;
+		pvector[natoms-1] += energy;
+	}
+	
+	if (eflag_atom)
+	{
+		double eshare = energy / natoms;
+		
+		for (int a=0; a<natoms; a++)
+			eatom[atoms[a]] += eshare;
+	}
+	
+	if (!vflag_either || (natoms == 1))
+		return;
+		
+	const int (*pair_atoms)[2] = (natoms == 2) ? pair_atoms_2b : ((natoms == 3) ? pair_atoms_3b : pair_atoms_4b);
+	const int npairs           = natoms*(natoms-1)/2;
+	
+	double v[6];
+	
+	for (int p=0; p<npairs; p++)
+	{
+		const double * d = &dr[p*CHDIM];
+		
+		v[0] = -fscalar[p] * d[0] * d[0];
+		v[1] = -fscalar[p] * d[1] * d[1];
+		v[2] = -fscalar[p] * d[2] * d[2];
+		v[3] = -fscalar[p] * d[0] * d[1];
+		v[4] = -fscalar[p] * d[0] * d[2];
+		v[5] = -fscalar[p] * d[1] * d[2];
+		
+		if (vflag_global)
+			for (int idx=0; idx<6; idx++)
+				virial[idx] += v[idx];
+				
+		if (vflag_atom)
+		{
+			double * vi = vatom[atoms[pair_atoms[p][0]]];
+			double * vj = vatom[atoms[pair_atoms[p][1]]];
+			
+			for (int idx=0; idx<6; idx++)
+			{
+				vi[idx] += 0.5*v[idx];
+				vj[idx] += 0.5*v[idx];
+			}
+		}
+	}
+}
+
 void PairCHIMES::build_mb_neighlists()
 {
 
@@ -261,25 +437,37 @@ void PairCHIMES::build_mb_neighlists()
 	tagint 	*tag   = atom -> tag;					         // Access to global atom indices
 	int     itag, jtag, ktag, ltag;					         // holds tags	
 	double 	**x    = atom -> x;					             // Access to system coordinates
+	int     *type  = atom -> type;
 	
-	double maxcut_3b_padded = maxcut_3b + neighbor-> skin;
-	double maxcut_4b_padded = maxcut_4b + neighbor-> skin;
+	// Clusters are screened with the largest cutoffs of their pairs of atom types, and kept only if their type is not
+	// excluded and all distances are within the type-specific cutoffs (i.e. if compute_3B/4B would evaluate them).
+	// All cutoffs are padded by the skin, since the lists are reused until the next LAMMPS neighbor list update.
 	
-	double dist_ij, dist_ik, dist_il, dist_jk, dist_jl, dist_kl;
+	double skin = neighbor-> skin;
+	
+	double dist_3b_nl[3];	// ij, ik, jk
+	double dist_4b_nl[6];	// ij, ik, il, jk, jl, kl
+	int    typs[4];
+	int    ti, tj, tk, tl;
+	bool   valid_4b;
+	
+	double &dist_ij = dist_4b_nl[0], &dist_ik = dist_4b_nl[1], &dist_il = dist_4b_nl[2];
+	double &dist_jk = dist_4b_nl[3], &dist_jl = dist_4b_nl[4], &dist_kl = dist_4b_nl[5];
 	
 	////////////////////////////////////////
 	// Access to neighbor list vars
 	////////////////////////////////////////
 
-	inum       = list -> inum; 		 // length of the list
-	ilist      = list -> ilist; 	 // list of i atoms for which neighbor list exists
-	numneigh   = list -> numneigh;	 // length of each of the ilist neighbor lists
-	firstneigh = list -> firstneigh; // point to the list of neighbors of i	
+	inum       = list_mb -> inum; 		// length of the list
+	ilist      = list_mb -> ilist; 	 	// list of i atoms for which neighbor list exists
+	numneigh   = list_mb -> numneigh;	 	// length of each of the ilist neighbor lists
+	firstneigh = list_mb -> firstneigh; // point to the list of neighbors of i	
 	
 	for (ii = 0; ii < inum; ii++) // Loop over real atoms (ai)	
 	{
 		i     = ilist[ii];		
 		itag  = tag[i];			
+		ti    = chimes_type[type[i]-1];
 		jlist = firstneigh[i];		
 		jnum  = numneigh[i];	
 
@@ -294,11 +482,13 @@ void PairCHIMES::build_mb_neighlists()
 			if (jtag < itag) 
 				continue;				
 				
+			tj = chimes_type[type[j]-1];
+				
 			// Check ij distance
 
 			dist_ij = get_dist(i,j);
 			
-			if ( (dist_ij >= maxcut_3b_padded) && (dist_ij >= maxcut_4b_padded) )
+			if ( (dist_ij >= chimes_calculator.max_cutoff_3B_pair(ti,tj) + skin) && (dist_ij >= chimes_calculator.max_cutoff_4B_pair(ti,tj) + skin) )
 				continue;
 
 			klist = firstneigh[i];	// ChIMES assumes all atoms must be within cutoff of eachother for a valid interaction	
@@ -314,21 +504,31 @@ void PairCHIMES::build_mb_neighlists()
 					continue;
 				if ( (ktag < itag) || (ktag < jtag) )
 					continue;						
+					
+				tk = chimes_type[type[k]-1];
 							
  	 			// Check ik distance			
 
 				dist_ik = get_dist(i,k);
 
-				if ( (dist_ik >= maxcut_3b_padded) && (dist_ik >= maxcut_4b_padded) )
+				if ( (dist_ik >= chimes_calculator.max_cutoff_3B_pair(ti,tk) + skin) && (dist_ik >= chimes_calculator.max_cutoff_4B_pair(ti,tk) + skin) )
 					continue;
 					
 				// Check jk distance			
 
 				dist_jk = get_dist(j,k);
 				
-				if( (dist_ij < maxcut_3b_padded) &&  (dist_ik < maxcut_3b_padded) && (dist_jk < maxcut_3b_padded) )
+				typs[0] = ti;
+				typs[1] = tj;
+				typs[2] = tk;
+				
+				dist_3b_nl[0] = dist_ij;
+				dist_3b_nl[1] = dist_ik;
+				dist_3b_nl[2] = dist_jk;
+				
+				if (chimes_calculator.cluster_within_3B(dist_3b_nl, typs, skin))
 				{
-					// If we're here and valid_3mer == true, then add the triplet to the chimes neigh list        
+					// If we're here, then add the triplet to the chimes neigh list        
 
 					tmp_3mer[0] = i;
 					tmp_3mer[1] = j;
@@ -336,13 +536,17 @@ void PairCHIMES::build_mb_neighlists()
 				
 					neighborlist_3mers.push_back(tmp_3mer);
 				}
+				
+				valid_4b = (dist_ij < chimes_calculator.max_cutoff_4B_pair(ti,tj) + skin)
+				        && (dist_ik < chimes_calculator.max_cutoff_4B_pair(ti,tk) + skin)
+				        && (dist_jk < chimes_calculator.max_cutoff_4B_pair(tj,tk) + skin);
 									
-				if ((dist_ij >= maxcut_4b_padded) || (dist_ik >= maxcut_4b_padded) || (dist_jk >= maxcut_4b_padded) )	
+				if (!valid_4b)	
 					continue;					
 				
 				// Now decide if we should continue on to 4-body neighbor list construction
 
-				if (chimes_calculator.poly_orders[2] == 0)
+				if ( (chimes_calculator.poly_orders[2] == 0) || stream_4b )
 					continue;
 
 				llist = firstneigh[i];	
@@ -358,29 +562,36 @@ void PairCHIMES::build_mb_neighlists()
 						continue;
 					if ((ltag < itag) ||(ltag < jtag)||(ltag < ktag)) 
 						continue;
+						
+					tl = chimes_type[type[l]-1];
 											
 					// Check il distance			
 
 					dist_il = get_dist(i,l); 
 
-					if (dist_il >= maxcut_4b_padded)
+					if (dist_il >= chimes_calculator.max_cutoff_4B_pair(ti,tl) + skin)
 						continue;	
 
 					// Check jl distance			
 	
 					dist_jl = get_dist(j,l);
 	
-					if (dist_jl >= maxcut_4b_padded)
+					if (dist_jl >= chimes_calculator.max_cutoff_4B_pair(tj,tl) + skin)
 						continue;
 								
 					// Check kl distance			
 
 					dist_kl = get_dist(k,l);
 	
-					if (dist_kl >= maxcut_4b_padded)
+					if (dist_kl >= chimes_calculator.max_cutoff_4B_pair(tk,tl) + skin)
+						continue;
+						
+					typs[3] = tl;
+					
+					if (!chimes_calculator.cluster_within_4B(dist_4b_nl, typs, skin))
 						continue;
 		
-					// If we're here and valid_4mer == true, then add the quadruplet to the chimes neigh list
+					// If we're here, then add the quadruplet to the chimes neigh list
 					
 					tmp_4mer[0] = i;
 					tmp_4mer[1] = j;
@@ -395,18 +606,128 @@ void PairCHIMES::build_mb_neighlists()
 	}
 }
 
+int PairCHIMES::build_4mer_tile(int ii_start, int max_quads)
+{
+	// Enumerates the quadruplets of build_mb_neighlists, for the list_mb atoms from ii_start on, into tile_4mers until it 
+	// holds at least max_quads clusters. Since the tiles are rebuilt at every step, cutoffs are not padded by the skin.
+	// Returns the first list_mb index not done.
+	
+	int i,j,k,l,jnum, ii, jj, kk, ll;
+	int *jlist;
+	tagint 	*tag   = atom -> tag;
+	int     itag, jtag, ktag, ltag;
+	int     *type  = atom -> type;
+	
+	double dist_4b_nl[6];	// ij, ik, il, jk, jl, kl
+	int    typs[4];
+	
+	double &dist_ij = dist_4b_nl[0], &dist_ik = dist_4b_nl[1], &dist_il = dist_4b_nl[2];
+	double &dist_jk = dist_4b_nl[3], &dist_jl = dist_4b_nl[4], &dist_kl = dist_4b_nl[5];
+	
+	int inum        = list_mb -> inum;
+	int *ilist      = list_mb -> ilist;
+	int *numneigh   = list_mb -> numneigh;
+	int **firstneigh = list_mb -> firstneigh;
+	
+	tile_4mers.clear();
+	
+	for (ii = ii_start; (ii < inum) && (tile_4mers.size() < 4*max_quads); ii++)
+	{
+		i       = ilist[ii];
+		itag    = tag[i];
+		typs[0] = chimes_type[type[i]-1];
+		jlist   = firstneigh[i];
+		jnum    = numneigh[i];
+		
+		for (jj = 0; jj < jnum; jj++)
+		{
+			j     = jlist[jj];
+			jtag  = tag[j];
+			j    &= NEIGHMASK;
+			
+			if ( (j == i) || (jtag < itag) )
+				continue;
+			
+			typs[1] = chimes_type[type[j]-1];
+			dist_ij = get_dist(i,j);
+			
+			if (dist_ij >= chimes_calculator.max_cutoff_4B_pair(typs[0],typs[1]))
+				continue;
+			
+			for (kk = 0; kk < jnum; kk++)
+			{
+				k     = jlist[kk];
+				ktag  = tag[k];
+				k    &= NEIGHMASK;
+				
+				if ( (k==i) || (k==j) )
+					continue;
+				if ( (ktag < itag) || (ktag < jtag) )
+					continue;
+				
+				typs[2] = chimes_type[type[k]-1];
+				dist_ik = get_dist(i,k);
+				
+				if (dist_ik >= chimes_calculator.max_cutoff_4B_pair(typs[0],typs[2]))
+					continue;
+				
+				dist_jk = get_dist(j,k);
+				
+				if (dist_jk >= chimes_calculator.max_cutoff_4B_pair(typs[1],typs[2]))
+					continue;
+				
+				for (ll = 0; ll < jnum; ll++)
+				{
+					l     = jlist[ll];
+					ltag  = tag[l];
+					l    &= NEIGHMASK;
+					
+					if ( (l==i) || (l==j) || (l==k))
+						continue;
+					if ((ltag < itag) ||(ltag < jtag)||(ltag < ktag)) 
+						continue;
+					
+					typs[3] = chimes_type[type[l]-1];
+					
+					dist_il = get_dist(i,l);
+					
+					if (dist_il >= chimes_calculator.max_cutoff_4B_pair(typs[0],typs[3]))
+						continue;
+					
+					dist_jl = get_dist(j,l);
+					
+					if (dist_jl >= chimes_calculator.max_cutoff_4B_pair(typs[1],typs[3]))
+						continue;
+					
+					dist_kl = get_dist(k,l);
+					
+					if (dist_kl >= chimes_calculator.max_cutoff_4B_pair(typs[2],typs[3]))
+						continue;
+					
+					if (!chimes_calculator.cluster_within_4B(dist_4b_nl, typs))
+						continue;
+					
+					tile_4mers.push_back(i);
+					tile_4mers.push_back(j);
+					tile_4mers.push_back(k);
+					tile_4mers.push_back(l);
+				}
+			}
+		}
+	}
+	
+	return ii;
+}
+
 void PairCHIMES::compute(int eflag, int vflag)
 {
 	// Vars for access to chimesFF compute_XB functions
 	
-	std::vector  <double>  stensor(6);	// pointers to system stress tensor
+	std::vector  <double>  stensor(6);	// unused stress tensor argument (eval mode excludes the stress); the virial is tallied from per-pair force scalars instead
     
-	// Temp vars to hold chimes output for passing to ev_tally function
+	// Cluster atom indices for passing to tally_mb
 	
-    std::vector<double>  fscalar(6);
-    std::vector<double>  tmp_dist(1);
-    std::vector<double>  tmp_dr(6);
-    int                  atmidxlst[6][2];
+	int                  atmidxlst[4];
 	
 	// General LAMMPS compute vars
 	
@@ -465,7 +786,8 @@ void PairCHIMES::compute(int eflag, int vflag)
 		if (chimes_calculator.rank == 0)
 		{
 			std::cout << "	Rank " << me << " 3-body list size: " << neighborlist_3mers.size() << std::endl;
-			std::cout << "	Rank " << me << " 4-body list size: " << neighborlist_4mers.size() << std::endl;
+			if (!stream_4b)
+				std::cout << "	Rank " << me << " 4-body list size: " << neighborlist_4mers.size() << std::endl;
 			std::cout << "	...update complete" << std::endl;
 		}
 	}
@@ -473,6 +795,14 @@ void PairCHIMES::compute(int eflag, int vflag)
     // Prepare the badness variable
     
     chimes_calculator.reset_badness();
+    
+    // Per-body-order energies
+    
+    if (eflag_global)
+    	for (int n=0; n<nextra; n++)
+    		pvector[n] = 0.0;
+    
+    chimes_calculator.energy_penalty = 0.0;
 
 	////////////////////////////////////////
 	// Compute 1- and 2-body interactions
@@ -493,7 +823,10 @@ void PairCHIMES::compute(int eflag, int vflag)
 		chimes_calculator.compute_1B(type[i]-1, energy);
 		
 		if(evflag)
-			ev_tally_mb(0, atmidxlst, energy, fscalar, tmp_dist, tmp_dr);
+		{
+			atmidxlst[0] = i;
+			tally_mb(1, atmidxlst, energy, NULL, NULL);
+		}
 
 		// Now move on to two-body force, stress, and energy
 		
@@ -504,7 +837,7 @@ void PairCHIMES::compute(int eflag, int vflag)
 			j    &= NEIGHMASK;			// Strip possible extra bits of j
 				
 			
-			if (jtag <= itag) // only allow calculation for j<i, since we've requested a full neighbor list
+			if ( (!use_half_list) && (jtag <= itag) ) // only allow calculation for j<i when using a full neighbor list
 				continue;
 				
 			// Get distance using ghost atoms... don't need MIC since we're using ghost atoms
@@ -517,12 +850,9 @@ void PairCHIMES::compute(int eflag, int vflag)
 			// Using std::fill for maximum efficiency.
 			std::fill(force_2b.begin(), force_2b.end(), 0.0) ;
 
-			// Do the same for stress tensors
-			std::fill(stensor.begin(), stensor.end(), 0.0) ;
-
 			energy = 0.0;	
 		
-			chimes_calculator.compute_2B( dist, dr, typ_idxs_2b, force_2b, stensor, energy, chimes_2btmp);	// Auto-updates badness		
+			chimes_calculator.compute_2B( dist, dr, typ_idxs_2b, force_2b, stensor, energy, chimes_2btmp, fscalar_2b);	// Auto-updates badness		
 
 			for (idx=0; idx<3; idx++)
 			{
@@ -530,18 +860,16 @@ void PairCHIMES::compute(int eflag, int vflag)
 				f[j][idx] += force_2b[1*CHDIM+idx] ;
 			}
 
-			// "Save"/tally up the energy and stresses to the global virial/energy data objects (see pair.cpp ~ line 1000)
+			// "Save"/tally up the energy and stresses to the global virial/energy data objects
 			// Compute pressure, (in contrast to chimes_md) AFTER penalty has been added		
 			
-			if(vflag_atom)
-            {
-			    atmidxlst[0][0] = i;
-			    atmidxlst[0][1] = j;
-            }
-			tmp_dist    [0] = dist;
-			
 			if (evflag)
-				ev_tally_mb(2, atmidxlst, energy, fscalar, tmp_dist, dr);         
+			{
+				atmidxlst[0] = i;
+				atmidxlst[1] = j;
+				
+				tally_mb(2, atmidxlst, energy, &fscalar_2b, &dr[0]);
+			}
 		}
 	}
     
@@ -571,11 +899,10 @@ void PairCHIMES::compute(int eflag, int vflag)
 			typ_idxs_3b[2] = chimes_type[type[k]-1];
 
 			std::fill(force_3b.begin(), force_3b.end(), 0.0) ;
-			std::fill(stensor.begin(), stensor.end(), 0.0) ;
 				
 			energy = 0.0 ;
 			
-			chimes_calculator.compute_3B( dist_3b, dr_3b, typ_idxs_3b, force_3b, stensor, energy, chimes_3btmp);
+			chimes_calculator.compute_3B( dist_3b, dr_3b, typ_idxs_3b, force_3b, stensor, energy, chimes_3btmp, fscalar_3b);
 
 			for (idx=0; idx<3; idx++)
 			{
@@ -584,18 +911,14 @@ void PairCHIMES::compute(int eflag, int vflag)
 				f[k][idx] += force_3b[2*CHDIM+idx] ;
 			}
 
-            if (vflag_atom)
-            {
-			    atmidxlst[0][0] = i;
-			    atmidxlst[0][1] = j;
-			    atmidxlst[1][0] = i;
-			    atmidxlst[1][1] = k;
-			    atmidxlst[2][0] = j;
-			    atmidxlst[2][1] = k;
-            }
-			
 			if (evflag)
-				ev_tally_mb(3, atmidxlst, energy, fscalar, dist_3b, dr_3b);		            
+			{
+				atmidxlst[0] = i;
+				atmidxlst[1] = j;
+				atmidxlst[2] = k;
+				
+				tally_mb(3, atmidxlst, energy, &fscalar_3b[0], &dr_3b[0]);
+			}
 		}		
 	}
 
@@ -605,60 +928,72 @@ void PairCHIMES::compute(int eflag, int vflag)
 		// Compute 4-body interactions
 		////////////////////////////////////////
 		
-		for (ii = 0; ii < neighborlist_4mers.size(); ii++)		
+		// With stream4b, quadruplets come in tiles built from the current coordinates; otherwise from neighborlist_4mers
+		
+		int ii_next = 0;
+		
+		do
 		{
-			i     = neighborlist_4mers[ii][0];
-			j     = neighborlist_4mers[ii][1];
-			k     = neighborlist_4mers[ii][2];
-			l     = neighborlist_4mers[ii][3];			
+			if (stream_4b)
+				ii_next = build_4mer_tile(ii_next, stream_4b_tile);
 			
-			dist_4b[0] = get_dist(i,j,&dr_4b[0*CHDIM]);				      
-			dist_4b[1] = get_dist(i,k,&dr_4b[1*CHDIM]);
-			dist_4b[2] = get_dist(i,l,&dr_4b[2*CHDIM]);
-			dist_4b[3] = get_dist(j,k,&dr_4b[3*CHDIM]);
-			dist_4b[4] = get_dist(j,l,&dr_4b[4*CHDIM]);
-			dist_4b[5] = get_dist(k,l,&dr_4b[5*CHDIM]);
-
-			typ_idxs_4b[0] = chimes_type[type[i]-1];
-			typ_idxs_4b[1] = chimes_type[type[j]-1];
-			typ_idxs_4b[2] = chimes_type[type[k]-1];
-			typ_idxs_4b[3] = chimes_type[type[l]-1];
-
-			std::fill(force_4b.begin(), force_4b.end(), 0.0) ;
-			std::fill(stensor.begin(), stensor.end(), 0.0) ;
-
-			energy = 0.0 ;	
+			const int n_quads = stream_4b ? tile_4mers.size()/4 : neighborlist_4mers.size();
 			
-			chimes_calculator.compute_4B( dist_4b, dr_4b, typ_idxs_4b, force_4b, stensor, energy, chimes_4btmp);
-
-			for (idx=0; idx<3; idx++)
+			for (ii = 0; ii < n_quads; ii++)		
 			{
-				f[i][idx] += force_4b[0*CHDIM+idx] ;
-				f[j][idx] += force_4b[1*CHDIM+idx] ;
-				f[k][idx] += force_4b[2*CHDIM+idx] ;
-				f[l][idx] += force_4b[3*CHDIM+idx] ;
-			}
+				const int * quad = stream_4b ? &tile_4mers[4*ii] : &neighborlist_4mers[ii][0];
+				
+				i     = quad[0];
+				j     = quad[1];
+				k     = quad[2];
+				l     = quad[3];
 			
-            if (vflag_atom)
-            {
-			    atmidxlst[0][0] = i;
-			    atmidxlst[0][1] = j;
-			    atmidxlst[1][0] = i;
-			    atmidxlst[1][1] = k;
-			    atmidxlst[2][0] = i;
-			    atmidxlst[2][1] = l;
-			    atmidxlst[3][0] = j;
-			    atmidxlst[3][1] = k;
-			    atmidxlst[4][0] = j;
-			    atmidxlst[4][1] = l;
-			    atmidxlst[5][0] = k;
-			    atmidxlst[5][1] = l;
-            }
+				dist_4b[0] = get_dist(i,j,&dr_4b[0*CHDIM]);				      
+				dist_4b[1] = get_dist(i,k,&dr_4b[1*CHDIM]);
+				dist_4b[2] = get_dist(i,l,&dr_4b[2*CHDIM]);
+				dist_4b[3] = get_dist(j,k,&dr_4b[3*CHDIM]);
+				dist_4b[4] = get_dist(j,l,&dr_4b[4*CHDIM]);
+				dist_4b[5] = get_dist(k,l,&dr_4b[5*CHDIM]);
+
+				typ_idxs_4b[0] = chimes_type[type[i]-1];
+				typ_idxs_4b[1] = chimes_type[type[j]-1];
+				typ_idxs_4b[2] = chimes_type[type[k]-1];
+				typ_idxs_4b[3] = chimes_type[type[l]-1];
+
+				std::fill(force_4b.begin(), force_4b.end(), 0.0) ;
+
+				energy = 0.0 ;	
 			
-			if (evflag)
-				ev_tally_mb(4, atmidxlst, energy, fscalar, dist_4b, dr_4b);	
-            
+				chimes_calculator.compute_4B( dist_4b, dr_4b, typ_idxs_4b, force_4b, stensor, energy, chimes_4btmp, fscalar_4b);
+
+				for (idx=0; idx<3; idx++)
+				{
+					f[i][idx] += force_4b[0*CHDIM+idx] ;
+					f[j][idx] += force_4b[1*CHDIM+idx] ;
+					f[k][idx] += force_4b[2*CHDIM+idx] ;
+					f[l][idx] += force_4b[3*CHDIM+idx] ;
+				}
+			
+				if (evflag)
+				{
+					atmidxlst[0] = i;
+					atmidxlst[1] = j;
+					atmidxlst[2] = k;
+					atmidxlst[3] = l;
+				
+					tally_mb(4, atmidxlst, energy, &fscalar_4b[0], &dr_4b[0]);
+				}
+			}
 		}
+		while (stream_4b && (ii_next < list_mb->inum));
+	}
+
+	// The penalty is included in the 2-body energies
+	
+	if (eflag_global)
+	{
+		pvector[4]  = chimes_calculator.energy_penalty;
+		pvector[1] -= pvector[4];
 	}
 
 if (vflag_fdotr) 
@@ -70,11 +70,36 @@ namespace LAMMPS_NS
 			
 			std::vector<std::vector<int> > neighborlist_3mers;	// custom neighbor list; neighborlist_Xmers[cluster idx][atom in cluster idx]
 			std::vector<std::vector<int> > neighborlist_4mers;
+			
+			// Neighbor list modes: by default a single full list (with ghosts) is used for everything and
+			// 2-body pairs are filtered by tag. With "half", 2-body interactions are evaluated from a LAMMPS
+			// half list and a separate full list, trimmed to the largest 3-/4-body cutoff, is used to build
+			// the many-body cluster lists.
+			
+			bool             use_half_list;
+			class NeighList *list_mb;		// list used to build neighborlist_Xmers (== list unless use_half_list)
             
             // Prepare files necessary for ChIMES fitting 
             
             bool     for_fitting;
             ofstream badness_stream;			
+            
+            // Count penalty/inner cutoff events instead of printing warnings (see chimesFF::set_badness_silent); 
+            // the counts of all ranks are reduced and reported once, when the pair style is destroyed
+            
+            bool     quiet_badness;
+            
+            // Optional tabulated 2-body interactions (see chimesFF::set_2B_tabulation)
+            
+            bool     tabulate_2b;
+            double   tabulate_2b_tol;
+            
+            // With "stream4b", neighborlist_4mers is not stored. Quadruplets are enumerated at every step, in tiles of
+            // about stream_4b_tile clusters (see build_4mer_tile), and each tile is evaluated before the next is built.
+            
+            bool             stream_4b;
+            int              stream_4b_tile;
+            std::vector<int> tile_4mers;	// [cluster][atom]; current tile
 
 			// 2-body vars for chimesFF access
 
@@ -93,6 +118,12 @@ namespace LAMMPS_NS
 			std::vector<int> typ_idxs_2b;
 			std::vector<int> typ_idxs_3b;
 			std::vector<int> typ_idxs_4b;	
+			
+			// Per-pair force scalars returned by chimesFF, used for per-atom virial tallies
+			
+			double              fscalar_2b;
+			std::vector<double> fscalar_3b;
+			std::vector<double> fscalar_4b;
 
 			// Vars for neighlist construction
 
@@ -109,11 +140,14 @@ namespace LAMMPS_NS
 
 			void   settings(int narg, char **arg);
 			void   init_style();	
+			void   init_list(int id, class NeighList *ptr);
 			void   coeff(int narg, char **arg);
 			void   allocate();
 			double init_one(int i, int j);	
 			void   compute(int eflag, int vflag);
 			void   build_mb_neighlists();
+			int    build_4mer_tile(int ii_start, int max_quads);
+			inline void tally_mb(const int natoms, const int * atoms, const double energy, const double * fscalar, const double * dr);
 		    inline double get_dist(int i, int j, double* dr);
 		    inline double get_dist(int i, int j);
 			void   set_chimes_type();
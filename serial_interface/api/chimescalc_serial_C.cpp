@@ -19,7 +19,11 @@ using namespace std;
 
 #include "serial_chimes_interface.h"
 #include "chimescalc_serial_C.h"
-static  serial_chimes_interface chimes, *chimes_ptr;
+
+// Default instance of the functions without a handle argument. It is shared by all callers, so only one thread
+// may use these functions at a time; concurrent callers should each open their own instance.
+
+static  serial_chimes_interface chimes, *chimes_ptr = &chimes;
 
 void *chimes_open_instance()
 {
@@ -122,3 +126,198 @@ void calculate_chimes_instance(void *handle, int natom, double *xc, double *yc,
     stress[i] = stress_vec[i];
   }
 }
+void calculate_chimes_per_atom(int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double *energy, double fx[], double fy[], double fz[], double stress[9], double atom_energy[], double atom_stress[])
+{
+        calculate_chimes_per_atom_instance(chimes_ptr, natom, xc, yc, zc, atom_types, ca, cb, cc, energy, fx, fy, fz, stress, atom_energy, atom_stress);
+}
+void calculate_chimes_per_atom_instance(void *handle, int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double *energy, double fx[], double fy[], double fz[], double stress[9], double atom_energy[], double atom_stress[])
+{
+        auto new_ptr = (serial_chimes_interface *) handle;
+
+        vector<double> x_vec(xc, xc+natom);
+        vector<double> y_vec(yc, yc+natom);
+        vector<double> z_vec(zc, zc+natom);
+        vector<string> atom_types_vec(atom_types, atom_types+natom);
+
+        vector<double> cell_a_vec(ca, ca+3);
+        vector<double> cell_b_vec(cb, cb+3);
+        vector<double> cell_c_vec(cc, cc+3);
+
+        vector<vector<double> > force_vec(natom, vector<double>(3));
+        vector<double>          stress_vec(stress, stress+9);
+        vector<double>          atom_energy_vec(atom_energy, atom_energy+natom);
+        vector<vector<double> > atom_stress_vec(natom, vector<double>(9));
+
+        for (int i = 0; i < natom; i++) {
+                force_vec[i][0] = fx[i];
+                force_vec[i][1] = fy[i];
+                force_vec[i][2] = fz[i];
+                for (int j = 0; j < 9; j++)
+                        atom_stress_vec[i][j] = atom_stress[9*i+j];
+        }
+
+        new_ptr->calculate(x_vec, y_vec, z_vec, cell_a_vec, cell_b_vec, cell_c_vec, atom_types_vec, *energy, force_vec, stress_vec, atom_energy_vec, atom_stress_vec);
+
+        for (int i = 0; i < natom; i++) {
+                fx[i] = force_vec[i][0];
+                fy[i] = force_vec[i][1];
+                fz[i] = force_vec[i][2];
+                atom_energy[i] = atom_energy_vec[i];
+                for (int j = 0; j < 9; j++)
+                        atom_stress[9*i+j] = atom_stress_vec[i][j];
+        }
+        for (int i = 0; i < 9; i++)
+                stress[i] = stress_vec[i];
+}
+void get_chimes_serial_stats(long long calls[3], long long excluded[3], long long rejected[3], double phase_times[6], long long *ncalculate)
+{
+        get_chimes_serial_stats_instance(chimes_ptr, calls, excluded, rejected, phase_times, ncalculate);
+}
+void get_chimes_serial_stats_instance(void *handle, long long calls[3], long long excluded[3], long long rejected[3], double phase_times[6], long long *ncalculate)
+{
+        auto new_ptr = (serial_chimes_interface *) handle;
+        for (int i = 0; i < 3; i++) {
+                calls[i]    = new_ptr->stats.calls[i];
+                excluded[i] = new_ptr->stats.excluded[i];
+                rejected[i] = new_ptr->stats.rejected[i];
+        }
+        for (int i = 0; i < chimesStats::NPHASES; i++) {
+                phase_times[i] = new_ptr->stats.time[i];
+        }
+        *ncalculate = new_ptr->stats.ncalculate;
+}
+void reset_chimes_serial_stats()
+{
+        reset_chimes_serial_stats_instance(chimes_ptr);
+}
+void reset_chimes_serial_stats_instance(void *handle)
+{
+        auto new_ptr = (serial_chimes_interface *) handle;
+        new_ptr->stats.reset();
+}
+void print_chimes_serial_stats(int at_exit)
+{
+        print_chimes_serial_stats_instance(chimes_ptr, at_exit);
+}
+void print_chimes_serial_stats_instance(void *handle, int at_exit)
+{
+        // Prints now (at_exit = 0), or when the instance is destroyed (at_exit = 1; chimes_close_instance, or
+        // program exit for the default instance)
+        
+        auto new_ptr = (serial_chimes_interface *) handle;
+        if (at_exit)
+                new_ptr->print_stats_at_exit = true;
+        else
+                new_ptr->stats.print(cout);
+}
+void set_chimes_serial_badness_silent(int silent)
+{
+        set_chimes_serial_badness_silent_instance(chimes_ptr, silent);
+}
+void set_chimes_serial_badness_silent_instance(void *handle, int silent)
+{
+        auto new_ptr = (serial_chimes_interface *) handle;
+        new_ptr->set_badness_silent(silent != 0);
+}
+void print_chimes_serial_badness_summary()
+{
+        print_chimes_serial_badness_summary_instance(chimes_ptr);
+}
+void print_chimes_serial_badness_summary_instance(void *handle)
+{
+        auto new_ptr = (serial_chimes_interface *) handle;
+        new_ptr->print_badness_summary(cout);
+}
+void set_chimes_serial_eval_mode(int mode)
+{
+        set_chimes_serial_eval_mode_instance(chimes_ptr, mode);
+}
+void set_chimes_serial_eval_mode_instance(void *handle, int mode)
+{
+        auto new_ptr = (serial_chimes_interface *) handle;
+        if ((mode < 0) || (mode > 2))
+        {
+                cout << "ERROR: Evaluation mode must be 0 (energy), 1 (energy and forces), or 2 (energy, forces, and stress)" << endl;
+                cout << "Received: " << mode << endl;
+                exit(0);
+        }
+        new_ptr->set_eval_mode((evalMode) mode);
+}
+void get_chimes_serial_energy_terms(double terms[5])
+{
+        get_chimes_serial_energy_terms_instance(chimes_ptr, terms);
+}
+void get_chimes_serial_energy_terms_instance(void *handle, double terms[5])
+{
+        auto new_ptr = (serial_chimes_interface *) handle;
+        vector<double> terms_vec;
+        new_ptr->get_energy_terms(terms_vec);
+        for (int i = 0; i < 5; i++)
+                terms[i] = terms_vec[i];
+}
+void calculate_chimes_energy(int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double *energy)
+{
+        calculate_chimes_energy_instance(chimes_ptr, natom, xc, yc, zc, atom_types, ca, cb, cc, energy);
+}
+void calculate_chimes_energy_instance(void *handle, int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double *energy)
+{
+        auto new_ptr = (serial_chimes_interface *) handle;
+
+        vector<double> x_vec(xc, xc+natom);
+        vector<double> y_vec(yc, yc+natom);
+        vector<double> z_vec(zc, zc+natom);
+        vector<string> atom_types_vec(atom_types, atom_types+natom);
+
+        vector<double> cell_a_vec(ca, ca+3);
+        vector<double> cell_b_vec(cb, cb+3);
+        vector<double> cell_c_vec(cc, cc+3);
+
+        new_ptr->calculate(x_vec, y_vec, z_vec, cell_a_vec, cell_b_vec, cell_c_vec, atom_types_vec, *energy);
+}
+void init_chimes_serial_mc(int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double skin, double *energy)
+{
+        init_chimes_serial_mc_instance(chimes_ptr, natom, xc, yc, zc, atom_types, ca, cb, cc, skin, energy);
+}
+void init_chimes_serial_mc_instance(void *handle, int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double skin, double *energy)
+{
+        auto new_ptr = (serial_chimes_interface *) handle;
+
+        vector<double> x_vec(xc, xc+natom);
+        vector<double> y_vec(yc, yc+natom);
+        vector<double> z_vec(zc, zc+natom);
+        vector<string> atom_types_vec(atom_types, atom_types+natom);
+
+        vector<double> cell_a_vec(ca, ca+3);
+        vector<double> cell_b_vec(cb, cb+3);
+        vector<double> cell_c_vec(cc, cc+3);
+
+        new_ptr->mc_skin = skin;
+        new_ptr->mc_init(x_vec, y_vec, z_vec, cell_a_vec, cell_b_vec, cell_c_vec, atom_types_vec, *energy);
+}
+double chimes_serial_mc_delta_energy(int atom, double dx, double dy, double dz)
+{
+        return chimes_serial_mc_delta_energy_instance(chimes_ptr, atom, dx, dy, dz);
+}
+double chimes_serial_mc_delta_energy_instance(void *handle, int atom, double dx, double dy, double dz)
+{
+        auto new_ptr = (serial_chimes_interface *) handle;
+        return new_ptr->mc_delta_energy(atom, dx, dy, dz);
+}
+void chimes_serial_mc_accept()
+{
+        chimes_serial_mc_accept_instance(chimes_ptr);
+}
+void chimes_serial_mc_accept_instance(void *handle)
+{
+        auto new_ptr = (serial_chimes_interface *) handle;
+        new_ptr->mc_accept();
+}
+void chimes_serial_mc_reject()
+{
+        chimes_serial_mc_reject_instance(chimes_ptr);
+}
+void chimes_serial_mc_reject_instance(void *handle)
+{
+        auto new_ptr = (serial_chimes_interface *) handle;
+        new_ptr->mc_reject();
+}
@@ -8,6 +8,10 @@
 extern "C" {
 #endif 
 
+/* Functions without a handle argument act on a single default instance, and must not be called from several threads
+   at once. Instances opened with chimes_open_instance hold all of their state, so different threads may each use their
+   own instance concurrently (but not share one). */
+
 void *chimes_open_instance();
 void chimes_close_instance(void *handle);
 void set_chimes_serial(int small);
@@ -16,6 +20,56 @@ void init_chimes_serial(char *param_file, int *rank);
 void init_chimes_serial_instance(void *handle, char *param_file, int rank);
 void calculate_chimes(int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double *energy, double fx[], double fy[], double fz[], double stress[9]); 
 void calculate_chimes_instance(void *handle, int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double *energy, double fx[], double fy[], double fz[], double stress[9]); 
+
+/* As calculate_chimes, also returning per-atom energies ([natom]) and virials ([natom*9], with components ordered as stress) */
+
+void calculate_chimes_per_atom(int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double *energy, double fx[], double fy[], double fz[], double stress[9], double atom_energy[], double atom_stress[]);
+void calculate_chimes_per_atom_instance(void *handle, int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double *energy, double fx[], double fy[], double fz[], double stress[9], double atom_energy[], double atom_stress[]);
+
+/* Instrumentation counters and timings (see chimesStats in chimesFF.h); arrays are indexed by bodiedness-2 and 
+   by calculate phase (ghost atoms, 2b neighbor list, 3b/4b neighbor lists, 1b/2b loop, 3b loop, 4b loop) */
+
+void get_chimes_serial_stats(long long calls[3], long long excluded[3], long long rejected[3], double phase_times[6], long long *ncalculate);
+void get_chimes_serial_stats_instance(void *handle, long long calls[3], long long excluded[3], long long rejected[3], double phase_times[6], long long *ncalculate);
+void reset_chimes_serial_stats();
+void reset_chimes_serial_stats_instance(void *handle);
+void print_chimes_serial_stats(int at_exit);
+void print_chimes_serial_stats_instance(void *handle, int at_exit);
+
+/* Count penalty and inner cutoff events instead of printing a warning for each (silent = 0/1 for false/true);
+   the aggregate summary is printed on request or when the instance is destroyed */
+
+void set_chimes_serial_badness_silent(int silent);
+void set_chimes_serial_badness_silent_instance(void *handle, int silent);
+void print_chimes_serial_badness_summary();
+void print_chimes_serial_badness_summary_instance(void *handle);
+/* Quantities computed by calculate_chimes: 0 = energy, 1 = energy and forces, 2 = energy, forces and stress (default) */
+
+void set_chimes_serial_eval_mode(int mode);
+void set_chimes_serial_eval_mode_instance(void *handle, int mode);
+
+/* 1-, 2- (excluding the penalty), 3-, 4-body and penalty energies of the last calculate_chimes call */
+
+void get_chimes_serial_energy_terms(double terms[5]);
+void get_chimes_serial_energy_terms_instance(void *handle, double terms[5]);
+
+/* Energy-only calculation: skips the polynomial derivatives, forces and stress, whatever the evaluation mode */
+
+void calculate_chimes_energy(int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double *energy);
+void calculate_chimes_energy_instance(void *handle, int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double *energy);
+
+/* Single-atom Monte Carlo moves: init_chimes_serial_mc stores the system (and adds its energy to energy), using neighbor
+   lists padded by skin (Angstrom); chimes_serial_mc_delta_energy moves an atom (index from 0) on trial by at most skin/2 
+   and returns the energy change; the trial must then be accepted or rejected */
+
+void init_chimes_serial_mc(int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double skin, double *energy);
+void init_chimes_serial_mc_instance(void *handle, int natom, double *xc, double *yc, double *zc, char *atom_types[], double ca[3], double cb[3], double cc[3], double skin, double *energy);
+double chimes_serial_mc_delta_energy(int atom, double dx, double dy, double dz);
+double chimes_serial_mc_delta_energy_instance(void *handle, int atom, double dx, double dy, double dz);
+void chimes_serial_mc_accept();
+void chimes_serial_mc_accept_instance(void *handle);
+void chimes_serial_mc_reject();
+void chimes_serial_mc_reject_instance(void *handle);
 #ifdef __cplusplus
 }
 #endif
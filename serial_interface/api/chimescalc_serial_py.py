@@ -10,6 +10,12 @@
 		wrapper_py.init_chimes()
 		wrapper_py.read_params("some_parameter_file.txt")
 
+	The functions act on a single default instance unless given a handle
+	from open_instance. Each instance holds all of its own state, so several
+	threads may evaluate frames concurrently, each with its own instance
+	(ctypes releases the GIL during the calls). An instance must not be used 
+	by more than one thread at a time.
+
     ChIMES Calculator
     Copyright (C) 2020 Rebecca K. Lindsey, Nir Goldman, and Laurence E. Fried
 	Contributing Author: Rebecca K. Lindsey (2020)
@@ -22,25 +28,42 @@ import ctypes
 chimes_wrapper = None
 
 def init_chimes_wrapper(lib_name):
-	return ctypes.CDLL(lib_name)
+	lib = ctypes.CDLL(lib_name)
+	lib.chimes_open_instance.restype = ctypes.c_void_p
+	return lib
+
+def open_instance():
+	""" Creates a new chimesFF object and returns its handle """
+	return chimes_wrapper.chimes_open_instance()
+
+def close_instance(handle):
+	""" Destroys a chimesFF object created by open_instance """
+	chimes_wrapper.chimes_close_instance(ctypes.c_void_p(handle))
+	return
 
-def set_chimes(small=False):
+def set_chimes(small=False, handle=None):
 	""" Instantiates the chimesFF object """
-	chimes_wrapper.set_chimes_serial(small)
+	if handle is None:
+		chimes_wrapper.set_chimes_serial(small)
+	else:
+		chimes_wrapper.set_chimes_serial_instance(ctypes.c_void_p(handle), int(small))
 	return
 
 
-def init_chimes(param_file, rank):
+def init_chimes(param_file, rank, handle=None):
 	""" 
 	Initializes the chimesFF object (sets MPI rank)
 	Optionally takes an  MPI rank as input
 	"""
 	in_paramfile = ctypes.c_char_p(param_file.encode())
 	in_rank      = ctypes.c_int(rank)
-	chimes_wrapper.init_chimes_serial(in_paramfile, ctypes.byref(in_rank))
+	if handle is None:
+		chimes_wrapper.init_chimes_serial(in_paramfile, ctypes.byref(in_rank))
+	else:
+		chimes_wrapper.init_chimes_serial_instance(ctypes.c_void_p(handle), in_paramfile, in_rank)
 	return
 
-def calculate_chimes(natoms,xcrd,ycrd,zcrd,atmtyps,cell_a,cell_b,cell_c,energy,fx,fy,fz,stress):
+def calculate_chimes(natoms,xcrd,ycrd,zcrd,atmtyps,cell_a,cell_b,cell_c,energy,fx,fy,fz,stress,handle=None):
 	""" 
 	Computes the ChIMES forces, energy, and stress tensor for a given system
 	
@@ -58,6 +81,7 @@ def calculate_chimes(natoms,xcrd,ycrd,zcrd,atmtyps,cell_a,cell_b,cell_c,energy,f
 	fy:	Y force components for system atoms
 	fz:	Z force components for system atoms
 	stress:	System stress tensor
+	handle:	Instance from open_instance (default instance if None)
 	
 	Returns updated fx, fy, fz, stress, and energy
 	
@@ -82,19 +106,24 @@ def calculate_chimes(natoms,xcrd,ycrd,zcrd,atmtyps,cell_a,cell_b,cell_c,energy,f
 	in_fz      = (ctypes.c_double * natoms) (*fz)
 	in_stress  = (ctypes.c_double * 9) (*stress)
 
-	chimes_wrapper.calculate_chimes(in_natom,
-					in_xcrd,   
-					in_ycrd,   
-					in_zcrd,   
-					in_atmtyps,   
-					in_cell_a,
-					in_cell_b, 
-					in_cell_c, 
-					ctypes.byref (in_energy), 
-					in_fx,     
-					in_fy,     
-					in_fz,     
-					in_stress)
+	in_args = (in_natom,
+		   in_xcrd,   
+		   in_ycrd,   
+		   in_zcrd,   
+		   in_atmtyps,   
+		   in_cell_a,
+		   in_cell_b, 
+		   in_cell_c, 
+		   ctypes.byref (in_energy), 
+		   in_fx,     
+		   in_fy,     
+		   in_fz,     
+		   in_stress)
+
+	if handle is None:
+		chimes_wrapper.calculate_chimes(*in_args)
+	else:
+		chimes_wrapper.calculate_chimes_instance(ctypes.c_void_p(handle), *in_args)
 					
 	return in_fx, in_fy, in_fz, in_stress, in_energy.value
 
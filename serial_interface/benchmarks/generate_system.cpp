@@ -0,0 +1,168 @@
+/*
+    ChIMES Calculator
+    Copyright (C) 2020 Rebecca K. Lindsey, Nir Goldman, and Laurence E. Fried
+*/
+
+#include<iostream>
+#include<iomanip>
+#include<fstream>
+#include<sstream>
+#include<cstdlib>
+#include<cmath>
+#include<random>
+
+using namespace std;
+
+#include "generate_system.h"
+
+static string get_next_line(istream& str)
+{
+    // Read a line and return it, with error checking.
+
+    string line;
+
+    getline(str, line);
+
+    if ( ! str.good() )
+    {
+        cout << "Error reading line" << line << endl;
+        exit(0);
+    }
+
+    return line;
+}
+
+void read_xyz(string in_xyz, xyz_system & system)
+{
+    ifstream coordfile;
+    coordfile.open(in_xyz);
+    if (!coordfile.good())
+    {
+        cout << "ERROR: Cannot open xyz file " << in_xyz << endl;
+        exit(0);
+    }
+
+    int natoms = stoi(get_next_line(coordfile));
+
+    system.cell_a.resize(3);
+    system.cell_b.resize(3);
+    system.cell_c.resize(3);
+
+    stringstream sstream(get_next_line(coordfile));
+
+    for (int i=0; i<3; i++) sstream >> system.cell_a[i];
+    for (int i=0; i<3; i++) sstream >> system.cell_b[i];
+    for (int i=0; i<3; i++) sstream >> system.cell_c[i];
+
+    if (sstream.fail())
+    {
+        cout << "ERROR: Expected a, b, and c cell vectors in the comment line of " << in_xyz << endl;
+        exit(0);
+    }
+
+    system.atom_types.resize(natoms);
+    system.xcrds     .resize(natoms);
+    system.ycrds     .resize(natoms);
+    system.zcrds     .resize(natoms);
+
+    for(int i=0; i<natoms; i++)
+    {
+        stringstream atom_line(get_next_line(coordfile));
+
+        atom_line >> system.atom_types[i] >> system.xcrds[i] >> system.ycrds[i] >> system.zcrds[i];
+    }
+
+    coordfile.close();
+}
+
+void write_xyz(string out_xyz, const xyz_system & system)
+{
+    ofstream coordfile;
+    coordfile.open(out_xyz);
+    if (!coordfile.good())
+    {
+        cout << "ERROR: Cannot open xyz file " << out_xyz << endl;
+        exit(0);
+    }
+
+    int natoms = system.xcrds.size();
+
+    coordfile << natoms << endl;
+
+    coordfile << fixed << setprecision(8);
+
+    for (int i=0; i<3; i++) coordfile << system.cell_a[i] << " ";
+    for (int i=0; i<3; i++) coordfile << system.cell_b[i] << " ";
+    for (int i=0; i<3; i++) coordfile << system.cell_c[i] << " ";
+    coordfile << endl;
+
+    for (int i=0; i<natoms; i++)
+        coordfile << system.atom_types[i] << " " << system.xcrds[i] << " " << system.ycrds[i] << " " << system.zcrds[i] << endl;
+
+    coordfile.close();
+}
+
+void generate_system(const xyz_system & input, int n_target, double density_scale, double perturb, unsigned int seed, xyz_system & output)
+{
+    int natoms = input.xcrds.size();
+
+    if ((natoms == 0) || (density_scale <= 0.0))
+    {
+        cout << "ERROR: generate_system requires a non-empty system and a positive density scale" << endl;
+        exit(0);
+    }
+
+    int n_rep = 1;
+
+    while ((long) n_rep*n_rep*n_rep*natoms < n_target)
+        n_rep++;
+
+    double scale = pow(density_scale, -1.0/3.0);    // Length scale for the requested density
+
+    output.cell_a.resize(3);
+    output.cell_b.resize(3);
+    output.cell_c.resize(3);
+
+    for (int i=0; i<3; i++)
+    {
+        output.cell_a[i] = input.cell_a[i] * n_rep * scale;
+        output.cell_b[i] = input.cell_b[i] * n_rep * scale;
+        output.cell_c[i] = input.cell_c[i] * n_rep * scale;
+    }
+
+    output.atom_types.resize(0);
+    output.xcrds     .resize(0);
+    output.ycrds     .resize(0);
+    output.zcrds     .resize(0);
+
+    mt19937                          generator(seed);
+    uniform_real_distribution<double> displacement(-perturb, perturb);
+
+    for (int i=0; i<n_rep; i++)
+    {
+        for (int j=0; j<n_rep; j++)
+        {
+            for (int k=0; k<n_rep; k++)
+            {
+                for (int a=0; a<natoms; a++)
+                {
+                    double x = (input.xcrds[a] + i*input.cell_a[0] + j*input.cell_b[0] + k*input.cell_c[0]) * scale;
+                    double y = (input.ycrds[a] + i*input.cell_a[1] + j*input.cell_b[1] + k*input.cell_c[1]) * scale;
+                    double z = (input.zcrds[a] + i*input.cell_a[2] + j*input.cell_b[2] + k*input.cell_c[2]) * scale;
+
+                    if (perturb > 0.0)
+                    {
+                        x += displacement(generator);
+                        y += displacement(generator);
+                        z += displacement(generator);
+                    }
+
+                    output.atom_types.push_back(input.atom_types[a]);
+                    output.xcrds     .push_back(x);
+                    output.ycrds     .push_back(y);
+                    output.zcrds     .push_back(z);
+                }
+            }
+        }
+    }
+}
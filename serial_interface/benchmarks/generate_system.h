@@ -0,0 +1,44 @@
+/*
+    ChIMES Calculator
+    Copyright (C) 2020 Rebecca K. Lindsey, Nir Goldman, and Laurence E. Fried
+*/
+
+/* ----------------------------------------------------------------------
+
+Tools to read/write .xyz configurations (a, b, and c cell vectors in the
+comment line) and to generate large synthetic systems from them, for the
+scaling benchmarks of chimescalc-bench.
+
+---------------------------------------------------------------------- */
+
+#ifndef _generate_system_h
+#define _generate_system_h
+
+#include<vector>
+#include<string>
+
+using namespace std;
+
+struct xyz_system
+{
+    vector<string> atom_types;
+    vector<double> xcrds;
+    vector<double> ycrds;
+    vector<double> zcrds;
+
+    vector<double> cell_a;
+    vector<double> cell_b;
+    vector<double> cell_c;
+};
+
+void read_xyz (string in_xyz,  xyz_system & system);
+void write_xyz(string out_xyz, const xyz_system & system);
+
+// Builds a system of at least n_target atoms by replicating the input cell n times along each cell vector
+// (n chosen as the smallest integer with n^3*natoms >= n_target). The result is then scaled uniformly so that
+// its density is density_scale times the input density, and each coordinate is displaced by a uniform random
+// amount in [-perturb, perturb] Angstrom (random generator seeded with seed).
+
+void generate_system(const xyz_system & input, int n_target, double density_scale, double perturb, unsigned int seed, xyz_system & output);
+
+#endif
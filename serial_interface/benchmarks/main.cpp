@@ -0,0 +1,889 @@
+/*
+    ChIMES Calculator
+    Copyright (C) 2020 Rebecca K. Lindsey, Nir Goldman, and Laurence E. Fried
+*/
+
+/* ----------------------------------------------------------------------
+
+Benchmark driver for the ChIMES calculator (built as chimescalc-bench).
+
+For each force field/configuration pair of the regression test matrix
+(serial_interface/tests/test_list.dat) this code times:
+
+    cheby_polys_2B: chimesFF::compute_2B_polys over all 2-body interactions
+    compute_2B:     chimesFF::compute_2B over all 2-body interactions
+    compute_3B:     chimesFF::compute_3B over all 3-body interactions
+    compute_4B:     chimesFF::compute_4B over all 4-body interactions
+    neighbor_lists: ghost atom and 2/3/4-body neighbor list construction
+    calculate:      serial_chimes_interface::calculate (end-to-end)
+
+Interactions are taken from the neighbor lists of the configuration itself,
+so the kernels see realistic distance and atom type distributions. Each
+measurement is repeated until at least --min-time seconds have elapsed.
+
+In scaling mode, each force field is instead run on synthetic systems of
+(at least) --sizes atoms, generated by replicating its first configuration
+(see generate_system.h), with 1, 2, ... --threads independent instances
+calling calculate concurrently. Generate mode only writes such a system
+(built from --config, with at least --atoms atoms) to the --output .xyz file.
+
+Precision mode times calculate for each test case with double precision
+(calculate) and with chimesFF::set_mixed_precision enabled
+(calculate_mixed), and reports the errors of the latter relative to the
+former.
+
+Results are written as JSON, one record per measurement, with fields:
+
+    name, force_field, configuration, n_atoms, threads, interactions,
+    repeats, seconds, ns_per_interaction, interactions_per_s, ns_per_atom,
+    peak_rss_kb
+
+interactions counts the kernel calls per repeat (for calculate, scaling and
+neighbor_lists, the total number of 2-, 3- and 4-body interactions). With
+several threads, repeats counts the calls of all threads, so the per
+interaction/atom timings give the aggregate throughput. peak_rss_kb is the
+process high-water mark after the measurement. calculate_mixed records
+additionally give energy_error_per_atom (kcal/mol/atom), force_error_max and
+force_error_rms (over all force components, kcal/mol/Angstrom), and
+stress_error_max (over all stress tensor components, in the units of calculate).
+
+Run with:
+
+    ./chimescalc-bench [--testdir <dir>] [--labels <regex>] [--mode <all|micro|e2e|scaling|precision>]
+                       [--min-time <seconds>] [--output <file, or - for stdout>]
+                       [--sizes <n1,n2,...>] [--threads <t1,t2,...>]
+                       [--density <scale>] [--perturb <Angstrom>] [--seed <int>]
+
+    ./chimescalc-bench --mode generate --config <xyz file> --atoms <n> --output <xyz file>
+                       [--density <scale>] [--perturb <Angstrom>] [--seed <int>]
+
+By default, test cases labeled "short" are run, and results are written to
+chimescalc_bench.json.
+
+---------------------------------------------------------------------- */
+
+#include<iostream>
+#include<iomanip>
+#include<fstream>
+#include<vector>
+#include<string>
+#include<sstream>
+#include<cstring>
+#include<chrono>
+#include<regex>
+#include<functional>
+#include<algorithm>
+#include<thread>
+#include<cmath>
+
+#include<sys/resource.h>
+
+using namespace std;
+
+#include "serial_chimes_interface.h"
+#include "generate_system.h"
+
+#ifndef CHIMESCALC_TEST_DIR
+#define CHIMESCALC_TEST_DIR "serial_interface/tests"
+#endif
+
+struct bench_case
+{
+    string paramfile;
+    string geometry;
+    bool   small;
+};
+
+struct bench_result
+{
+    string name;
+    string force_field;
+    string configuration;
+    int    n_atoms;
+    int    threads;
+    long   interactions;
+    long   repeats;
+    double seconds;
+    long   peak_rss_kb;
+    
+    bool   has_errors;              // Precision mode: errors relative to double precision
+    double energy_error_per_atom;
+    double force_error_max;
+    double force_error_rms;
+    double stress_error_max;
+};
+
+// Prototypes for some simple helper functions
+
+string strip(string str);
+
+void   read_test_list(string testdir, string labels, vector<bench_case> & cases);
+void   run_case(const bench_case & bcase, string testdir, bool run_micro, bool run_e2e, double min_time, vector<bench_result> & results);
+void   run_precision(const bench_case & bcase, string testdir, double min_time, vector<bench_result> & results);
+void   run_scaling(const bench_case & bcase, string testdir, const vector<int> & sizes, const vector<int> & threads, double density, double perturb, int seed, double min_time, vector<bench_result> & results);
+long   count_interactions(serial_chimes_interface & chimes, xyz_system & system, bool small);
+vector<int> parse_int_list(string list);
+long   peak_rss_kb();
+void   time_loop(const function<void()> & pass, double min_time, long & repeats, double & seconds);
+void   write_json(ostream & out, double min_time, const vector<bench_result> & results);
+
+int main(int argc, char **argv)
+{
+    string testdir  = CHIMESCALC_TEST_DIR;
+    string labels   = "short";
+    string mode     = "all";
+    string outfile  = "";
+    double min_time = 0.2;
+
+    // Scaling and generate mode options
+
+    string config   = "";
+    string sizes    = "1000,8000,27000";
+    string threads  = "1,2,4";
+    int    n_target = 1000;
+    double density  = 1.0;
+    double perturb  = 0.0;
+    int    seed     = 1;
+
+    for (int i=1; i<argc; i++)
+    {
+        string arg = argv[i];
+
+        if (i+1 == argc)
+        {
+            cout << "ERROR: Missing value for argument " << arg << endl;
+            exit(0);
+        }
+
+        if      (arg == "--testdir")  testdir  = argv[++i];
+        else if (arg == "--labels")   labels   = argv[++i];
+        else if (arg == "--mode")     mode     = argv[++i];
+        else if (arg == "--output")   outfile  = argv[++i];
+        else if (arg == "--min-time") min_time = stod(argv[++i]);
+        else if (arg == "--config")   config   = argv[++i];
+        else if (arg == "--sizes")    sizes    = argv[++i];
+        else if (arg == "--threads")  threads  = argv[++i];
+        else if (arg == "--atoms")    n_target = stoi(argv[++i]);
+        else if (arg == "--density")  density  = stod(argv[++i]);
+        else if (arg == "--perturb")  perturb  = stod(argv[++i]);
+        else if (arg == "--seed")     seed     = stoi(argv[++i]);
+        else
+        {
+            cout << "ERROR: Unknown argument " << arg << endl;
+            exit(0);
+        }
+    }
+
+    if ((mode != "all") && (mode != "micro") && (mode != "e2e") && (mode != "scaling") && (mode != "precision") && (mode != "generate"))
+    {
+        cout << "ERROR: Unknown mode " << mode << " (expected all, micro, e2e, scaling, precision or generate)" << endl;
+        exit(0);
+    }
+
+    // Generate mode: write a synthetic system and exit
+
+    if (mode == "generate")
+    {
+        if ((config == "") || (outfile == ""))
+        {
+            cout << "ERROR: generate mode requires --config <xyz file> and --output <xyz file>" << endl;
+            exit(0);
+        }
+
+        xyz_system input, output;
+
+        read_xyz(config, input);
+        generate_system(input, n_target, density, perturb, seed, output);
+        write_xyz(outfile, output);
+
+        cout << "chimescalc-bench: Wrote " << output.xcrds.size() << " atoms to " << outfile << endl;
+
+        return 0;
+    }
+
+    if (outfile == "")
+        outfile = "chimescalc_bench.json";
+
+    bool run_micro = (mode == "all") || (mode == "micro");
+    bool run_e2e   = (mode == "all") || (mode == "e2e");
+
+    vector<bench_case> cases;
+
+    read_test_list(testdir, labels, cases);
+
+    vector<bench_result> results;
+
+    if (mode == "scaling")
+    {
+        // One sweep per force field, using the first matching configuration as the seed system
+
+        vector<string> done;
+
+        for (int c=0; c<cases.size(); c++)
+        {
+            if (find(done.begin(), done.end(), cases[c].paramfile) != done.end())
+                continue;
+
+            done.push_back(cases[c].paramfile);
+
+            cout << "chimescalc-bench: " << cases[c].paramfile << " " << cases[c].geometry << " (scaling)" << endl;
+
+            run_scaling(cases[c], testdir, parse_int_list(sizes), parse_int_list(threads), density, perturb, seed, min_time, results);
+        }
+    }
+    else if (mode == "precision")
+    {
+        for (int c=0; c<cases.size(); c++)
+        {
+            cout << "chimescalc-bench: " << cases[c].paramfile << " " << cases[c].geometry << " (precision)" << endl;
+
+            run_precision(cases[c], testdir, min_time, results);
+        }
+    }
+    else
+    {
+        for (int c=0; c<cases.size(); c++)
+        {
+            cout << "chimescalc-bench: " << cases[c].paramfile << " " << cases[c].geometry << endl;
+
+            run_case(cases[c], testdir, run_micro, run_e2e, min_time, results);
+        }
+    }
+
+    // Write the results
+
+    if (outfile == "-")
+    {
+        write_json(cout, min_time, results);
+    }
+    else
+    {
+        ofstream out;
+        out.open(outfile);
+
+        if (!out.good())
+        {
+            cout << "ERROR: Cannot open output file " << outfile << endl;
+            exit(0);
+        }
+
+        write_json(out, min_time, results);
+        out.close();
+
+        cout << "chimescalc-bench: Wrote " << results.size() << " results to " << outfile << endl;
+    }
+}
+
+void run_case(const bench_case & bcase, string testdir, bool run_micro, bool run_e2e, double min_time, vector<bench_result> & results)
+{
+    // Kernel microbenchmarks and end-to-end timings for one force field/configuration pair
+
+    // Read the configuration and force field
+
+    xyz_system config;
+
+    read_xyz(testdir + "/configurations/" + bcase.geometry, config);
+
+    vector<string> & atom_types = config.atom_types;
+    vector<double> & xcrds      = config.xcrds;
+    vector<double> & ycrds      = config.ycrds;
+    vector<double> & zcrds      = config.zcrds;
+    vector<double> & cell_a     = config.cell_a;
+    vector<double> & cell_b     = config.cell_b;
+    vector<double> & cell_c     = config.cell_c;
+
+    int natoms = xcrds.size();
+
+    serial_chimes_interface chimes(bcase.small);
+
+    chimes.init_chimesFF(testdir + "/force_fields/" + bcase.paramfile, 1);    // Non-zero rank: no parameter printout
+
+    vector<string> type_list;
+    chimes.set_atomtypes(type_list);
+
+    double max_2b_cut = chimes.max_cutoff_2B(true);
+    double max_3b_cut = chimes.max_cutoff_3B(true);
+    double max_4b_cut = chimes.max_cutoff_4B(true);
+
+    bench_result result;
+
+    result.force_field   = bcase.paramfile;
+    result.configuration = bcase.geometry;
+    result.n_atoms       = natoms;
+    result.threads       = 1;
+    result.has_errors    = false;
+
+    // Build the system and neighbor lists the same way serial_chimes_interface::calculate does
+
+    vector<vector<int> > neighlist_2b;
+    vector<int>          neighlist_3b, neighlist_4b;    // [cluster][atom]
+
+    simulation_system sys;
+    simulation_system neigh;
+
+    sys.init(atom_types, type_list, xcrds, ycrds, zcrds, cell_a, cell_b, cell_c, max_2b_cut, bcase.small);
+    sys.build_layered_system(chimes.poly_orders, max_2b_cut, max_3b_cut, max_4b_cut);
+
+    function<void()> build_neighbors = [&]()
+    {
+        neigh.init(atom_types, type_list, xcrds, ycrds, zcrds, cell_a, cell_b, cell_c, max_2b_cut, bcase.small);
+        neigh.reorient();
+        neigh.build_layered_system(chimes.poly_orders, max_2b_cut, max_3b_cut, max_4b_cut);
+        neigh.build_neigh_lists(chimes.poly_orders, neighlist_2b, neighlist_3b, neighlist_4b, max_2b_cut, max_3b_cut, max_4b_cut, &chimes);
+    };
+
+    build_neighbors();
+
+    long n_2b = 0;
+
+    for (int i=0; i<sys.n_atoms; i++)
+        n_2b += neighlist_2b[i].size();
+
+    long n_3b = (chimes.poly_orders[1] > 0) ? neighlist_3b.size()/3 : 0;
+    long n_4b = (chimes.poly_orders[2] > 0) ? neighlist_4b.size()/4 : 0;
+
+    // End-to-end timings (first, so that peak_rss_kb is not inflated by the interaction samples below)
+
+    if (run_e2e)
+    {
+        double                  energy;
+        vector<double>          stress(9);
+        vector<vector<double> > force(natoms, vector<double>(3));
+
+        result.name         = "calculate";
+        result.interactions = n_2b + n_3b + n_4b;
+
+        time_loop([&]()
+        {
+            energy = 0.0;
+
+            for (int i=0; i<natoms; i++)
+                force[i][0] = force[i][1] = force[i][2] = 0.0;
+
+            chimes.calculate(xcrds, ycrds, zcrds, cell_a, cell_b, cell_c, atom_types, energy, force, stress);
+        }, min_time, result.repeats, result.seconds);
+
+        result.peak_rss_kb = peak_rss_kb();
+        results.push_back(result);
+    }
+
+    if (!run_micro)
+        return;
+
+    result.name         = "neighbor_lists";
+    result.interactions = n_2b + n_3b + n_4b;
+
+    time_loop(build_neighbors, min_time, result.repeats, result.seconds);
+
+    result.peak_rss_kb = peak_rss_kb();
+    results.push_back(result);
+
+    // Collect the interactions seen by calculate: distances, displacements and atom types, packed per interaction
+
+    vector<double> dx_2b, dr_2b, dx_3b, dr_3b, dx_4b, dr_4b;
+    vector<int>    typ_2b, typ_3b, typ_4b;
+
+    vector<double> dr(6*CHDIM);
+
+    for (int i=0; i<sys.n_atoms; i++)
+    {
+        for (int j=0; j<neighlist_2b[i].size(); j++)
+        {
+            int jj = neighlist_2b[i][j];
+
+            dx_2b.push_back(sys.get_dist(i, jj, &dr[0]));
+            dr_2b.insert(dr_2b.end(), dr.begin(), dr.begin()+CHDIM);
+
+            typ_2b.push_back(sys.sys_atmtyp_indices[i ]);
+            typ_2b.push_back(sys.sys_atmtyp_indices[jj]);
+        }
+    }
+
+    for (int i=0; i<n_3b; i++)
+    {
+        const int * atoms = &neighlist_3b[3*i];
+
+        dx_3b.push_back(sys.get_dist(atoms[0], atoms[1], &dr[0*CHDIM]));
+        dx_3b.push_back(sys.get_dist(atoms[0], atoms[2], &dr[1*CHDIM]));
+        dx_3b.push_back(sys.get_dist(atoms[1], atoms[2], &dr[2*CHDIM]));
+        dr_3b.insert(dr_3b.end(), dr.begin(), dr.begin()+3*CHDIM);
+
+        for (int a=0; a<3; a++)
+            typ_3b.push_back(sys.sys_atmtyp_indices[atoms[a]]);
+    }
+
+    for (int i=0; i<n_4b; i++)
+    {
+        const int * atoms = &neighlist_4b[4*i];
+
+        dx_4b.push_back(sys.get_dist(atoms[0], atoms[1], &dr[0*CHDIM]));
+        dx_4b.push_back(sys.get_dist(atoms[0], atoms[2], &dr[1*CHDIM]));
+        dx_4b.push_back(sys.get_dist(atoms[0], atoms[3], &dr[2*CHDIM]));
+        dx_4b.push_back(sys.get_dist(atoms[1], atoms[2], &dr[3*CHDIM]));
+        dx_4b.push_back(sys.get_dist(atoms[1], atoms[3], &dr[4*CHDIM]));
+        dx_4b.push_back(sys.get_dist(atoms[2], atoms[3], &dr[5*CHDIM]));
+        dr_4b.insert(dr_4b.end(), dr.begin(), dr.begin()+6*CHDIM);
+
+        for (int a=0; a<4; a++)
+            typ_4b.push_back(sys.sys_atmtyp_indices[atoms[a]]);
+    }
+
+    // Kernel microbenchmarks. Each call unpacks its interaction into the argument vectors, as
+    // serial_chimes_interface::calculate does.
+
+    double         energy = 0.0;
+    vector<double> stress(6, 0.0);
+    vector<double> force_2b(2*CHDIM, 0.0), force_3b(3*CHDIM, 0.0), force_4b(4*CHDIM, 0.0);
+
+    vector<double> dist(6), disp(6*CHDIM);
+    vector<int>    typ_idxs_2b(2), typ_idxs_3b(3), typ_idxs_4b(4);
+
+    chimes2BTmp chimes_2btmp(chimes.poly_orders[0]);
+    chimes3BTmp chimes_3btmp(chimes.poly_orders[1]);
+    chimes4BTmp chimes_4btmp(chimes.poly_orders[2]);
+
+    if (n_2b > 0)
+    {
+        result.name         = "cheby_polys_2B";
+        result.interactions = n_2b;
+
+        time_loop([&]()
+        {
+            for (int i=0; i<n_2b; i++)
+            {
+                typ_idxs_2b.assign(&typ_2b[2*i], &typ_2b[2*i+2]);
+
+                chimes.compute_2B_polys(dx_2b[i], typ_idxs_2b, chimes_2btmp);
+            }
+        }, min_time, result.repeats, result.seconds);
+
+        result.peak_rss_kb = peak_rss_kb();
+        results.push_back(result);
+
+        result.name = "compute_2B";
+
+        time_loop([&]()
+        {
+            for (int i=0; i<n_2b; i++)
+            {
+                disp       .assign(&dr_2b [CHDIM*i], &dr_2b [CHDIM*i+CHDIM]);
+                typ_idxs_2b.assign(&typ_2b[2*i],     &typ_2b[2*i+2]);
+
+                chimes.compute_2B(dx_2b[i], disp, typ_idxs_2b, force_2b, stress, energy, chimes_2btmp);
+            }
+        }, min_time, result.repeats, result.seconds);
+
+        result.peak_rss_kb = peak_rss_kb();
+        results.push_back(result);
+    }
+
+    if (n_3b > 0)
+    {
+        result.name         = "compute_3B";
+        result.interactions = n_3b;
+
+        time_loop([&]()
+        {
+            for (int i=0; i<n_3b; i++)
+            {
+                dist       .assign(&dx_3b [3*i],       &dx_3b [3*i+3]);
+                disp       .assign(&dr_3b [3*CHDIM*i], &dr_3b [3*CHDIM*i+3*CHDIM]);
+                typ_idxs_3b.assign(&typ_3b[3*i],       &typ_3b[3*i+3]);
+
+                chimes.compute_3B(dist, disp, typ_idxs_3b, force_3b, stress, energy, chimes_3btmp);
+            }
+        }, min_time, result.repeats, result.seconds);
+
+        result.peak_rss_kb = peak_rss_kb();
+        results.push_back(result);
+    }
+
+    if (n_4b > 0)
+    {
+        result.name         = "compute_4B";
+        result.interactions = n_4b;
+
+        time_loop([&]()
+        {
+            for (int i=0; i<n_4b; i++)
+            {
+                dist       .assign(&dx_4b [6*i],       &dx_4b [6*i+6]);
+                disp       .assign(&dr_4b [6*CHDIM*i], &dr_4b [6*CHDIM*i+6*CHDIM]);
+                typ_idxs_4b.assign(&typ_4b[4*i],       &typ_4b[4*i+4]);
+
+                chimes.compute_4B(dist, disp, typ_idxs_4b, force_4b, stress, energy, chimes_4btmp);
+            }
+        }, min_time, result.repeats, result.seconds);
+
+        result.peak_rss_kb = peak_rss_kb();
+        results.push_back(result);
+    }
+}
+
+void run_scaling(const bench_case & bcase, string testdir, const vector<int> & sizes, const vector<int> & threads, double density, double perturb, int seed, double min_time, vector<bench_result> & results)
+{
+    // Times serial_chimes_interface::calculate for synthetic systems of increasing size, generated from the
+    // configuration of bcase. For T threads, T independent interface instances run calculate concurrently
+    // on their own copy of the system; results report the aggregate throughput.
+
+    xyz_system config;
+
+    read_xyz(testdir + "/configurations/" + bcase.geometry, config);
+
+    string paramfile = testdir + "/force_fields/" + bcase.paramfile;
+
+    for (int n=0; n<sizes.size(); n++)
+    {
+        xyz_system system;
+
+        generate_system(config, sizes[n], density, perturb, seed, system);
+
+        int natoms = system.xcrds.size();
+
+        bench_result result;
+
+        result.name          = "scaling";
+        result.force_field   = bcase.paramfile;
+        result.configuration = bcase.geometry;
+        result.n_atoms       = natoms;
+        result.has_errors    = false;
+
+        serial_chimes_interface counter(bcase.small);
+        counter.init_chimesFF(paramfile, 1);
+
+        result.interactions = count_interactions(counter, system, bcase.small);
+
+        for (int t=0; t<threads.size(); t++)
+        {
+            int nthreads = threads[t];
+
+            cout << "chimescalc-bench: \t" << natoms << " atoms, " << nthreads << " thread(s)" << endl;
+
+            vector<serial_chimes_interface> instances(nthreads, serial_chimes_interface(bcase.small));
+            vector<xyz_system>              systems  (nthreads, system);
+            vector<long>                    calls    (nthreads, 0);
+
+            for (int i=0; i<nthreads; i++)
+                instances[i].init_chimesFF(paramfile, 1);
+
+            function<void(int, bool)> worker = [&](int i, bool warmup)
+            {
+                double                  energy;
+                vector<double>          stress(9);
+                vector<vector<double> > force(natoms, vector<double>(3));
+
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+                do
+                {
+                    energy = 0.0;
+
+                    for (int a=0; a<natoms; a++)
+                        force[a][0] = force[a][1] = force[a][2] = 0.0;
+
+                    instances[i].calculate(systems[i].xcrds, systems[i].ycrds, systems[i].zcrds, systems[i].cell_a, systems[i].cell_b, systems[i].cell_c, systems[i].atom_types, energy, force, stress);
+
+                    if (!warmup)
+                        calls[i]++;
+                }
+                while ((!warmup) && (chrono::duration<double>(chrono::steady_clock::now() - start).count() < min_time));
+            };
+
+            for (int i=0; i<nthreads; i++)    // Untimed warm-up pass, one instance at a time
+                worker(i, true);
+
+            vector<thread> pool;
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+            for (int i=0; i<nthreads; i++)
+                pool.push_back(thread(worker, i, false));
+
+            for (int i=0; i<nthreads; i++)
+                pool[i].join();
+
+            result.threads     = nthreads;
+            result.seconds     = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            result.repeats     = 0;
+            result.peak_rss_kb = peak_rss_kb();
+
+            for (int i=0; i<nthreads; i++)
+                result.repeats += calls[i];
+
+            results.push_back(result);
+        }
+    }
+}
+
+void run_precision(const bench_case & bcase, string testdir, double min_time, vector<bench_result> & results)
+{
+    // Times calculate in double and mixed precision for one force field/configuration pair, and compares the
+    // mixed precision energy, forces and stress with the double precision ones
+
+    xyz_system config;
+
+    read_xyz(testdir + "/configurations/" + bcase.geometry, config);
+
+    int natoms = config.xcrds.size();
+
+    serial_chimes_interface chimes(bcase.small);
+
+    chimes.init_chimesFF(testdir + "/force_fields/" + bcase.paramfile, 1);
+
+    bench_result result;
+
+    result.force_field   = bcase.paramfile;
+    result.configuration = bcase.geometry;
+    result.n_atoms       = natoms;
+    result.threads       = 1;
+    result.interactions  = count_interactions(chimes, config, bcase.small);
+    result.has_errors    = false;
+
+    double                   energy[2];
+    vector<vector<double> >  stress(2, vector<double>(9));
+    vector<vector<vector<double> > > force(2, vector<vector<double> >(natoms, vector<double>(3)));
+
+    for (int m=0; m<2; m++)
+    {
+        chimes.set_mixed_precision(m == 1);
+
+        result.name = (m == 1) ? "calculate_mixed" : "calculate";
+
+        time_loop([&]()
+        {
+            energy[m] = 0.0;
+
+            for (int i=0; i<natoms; i++)
+                force[m][i][0] = force[m][i][1] = force[m][i][2] = 0.0;
+
+            chimes.calculate(config.xcrds, config.ycrds, config.zcrds, config.cell_a, config.cell_b, config.cell_c, config.atom_types, energy[m], force[m], stress[m]);
+        }, min_time, result.repeats, result.seconds);
+
+        result.peak_rss_kb = peak_rss_kb();
+
+        if (m == 1)
+        {
+            result.has_errors            = true;
+            result.energy_error_per_atom = fabs(energy[1] - energy[0]) / natoms;
+            result.force_error_max       = 0.0;
+            result.force_error_rms       = 0.0;
+            result.stress_error_max      = 0.0;
+
+            for (int i=0; i<natoms; i++)
+            {
+                for (int k=0; k<3; k++)
+                {
+                    double err = fabs(force[1][i][k] - force[0][i][k]);
+
+                    result.force_error_max  = max(result.force_error_max, err);
+                    result.force_error_rms += err*err;
+                }
+            }
+
+            result.force_error_rms = sqrt(result.force_error_rms / (3*natoms));
+
+            for (int k=0; k<9; k++)
+                result.stress_error_max = max(result.stress_error_max, fabs(stress[1][k] - stress[0][k]));
+
+            cout << "chimescalc-bench: \t" << scientific << setprecision(3)
+                 << "energy error/atom " << result.energy_error_per_atom << ", force error max " << result.force_error_max
+                 << ", rms " << result.force_error_rms << ", stress error max " << result.stress_error_max << defaultfloat << endl;
+        }
+
+        results.push_back(result);
+    }
+}
+
+long count_interactions(serial_chimes_interface & chimes, xyz_system & system, bool small)
+{
+    // Number of 2-, 3- and 4-body interactions evaluated by serial_chimes_interface::calculate for system
+
+    vector<string> type_list;
+
+    chimes.set_atomtypes(type_list);
+
+    double max_2b_cut = chimes.max_cutoff_2B(true);
+    double max_3b_cut = chimes.max_cutoff_3B(true);
+    double max_4b_cut = chimes.max_cutoff_4B(true);
+
+    simulation_system    neigh;
+    vector<vector<int> > neighlist_2b;
+    vector<int>          neighlist_3b, neighlist_4b;
+
+    neigh.init(system.atom_types, type_list, system.xcrds, system.ycrds, system.zcrds, system.cell_a, system.cell_b, system.cell_c, max_2b_cut, small);
+    neigh.reorient();
+    neigh.build_layered_system(chimes.poly_orders, max_2b_cut, max_3b_cut, max_4b_cut);
+    neigh.build_neigh_lists(chimes.poly_orders, neighlist_2b, neighlist_3b, neighlist_4b, max_2b_cut, max_3b_cut, max_4b_cut, &chimes);
+
+    long n_interactions = 0;
+
+    for (int i=0; i<neigh.n_atoms; i++)
+        n_interactions += neighlist_2b[i].size();
+
+    if (chimes.poly_orders[1] > 0)
+        n_interactions += neighlist_3b.size()/3;
+
+    if (chimes.poly_orders[2] > 0)
+        n_interactions += neighlist_4b.size()/4;
+
+    return n_interactions;
+}
+
+vector<int> parse_int_list(string list)
+{
+    // Parse a comma separated list of integers, e.g. 1000,8000,27000
+
+    vector<int>  values;
+    stringstream sstream(list);
+    string       item;
+
+    while (getline(sstream, item, ','))
+        if (strip(item) != "")
+            values.push_back(stoi(item));
+
+    return values;
+}
+
+void read_test_list(string testdir, string labels, vector<bench_case> & cases)
+{
+    // Read the force field/configuration pairs from test_list.dat, keeping those whose label matches the labels regex.
+    // Each line has the form: parameter file; geometry file; allow replicates (0/1); label
+
+    ifstream listfile;
+    listfile.open(testdir + "/test_list.dat");
+
+    if (!listfile.good())
+    {
+        cout << "ERROR: Cannot open test list " << testdir + "/test_list.dat" << endl;
+        exit(0);
+    }
+
+    regex  label_regex(labels);
+    string line;
+
+    while (getline(listfile, line))
+    {
+        vector<string> fields;
+        stringstream   sstream(line);
+        string         field;
+
+        while (getline(sstream, field, ';'))
+            fields.push_back(strip(field));
+
+        if ((fields.size() < 4) || (fields[0].size() == 0) || (fields[0][0] == '#'))
+            continue;
+
+        if (!regex_search(fields[3], label_regex))
+            continue;
+
+        bench_case entry;
+
+        entry.paramfile = fields[0];
+        entry.geometry  = fields[1];
+        entry.small     = (fields[2] == "1") || (fields[2] == "true") || (fields[2] == "True") || (fields[2] == "TRUE");
+
+        cases.push_back(entry);
+    }
+
+    listfile.close();
+
+    if (cases.size() == 0)
+    {
+        cout << "ERROR: No test cases match labels " << labels << endl;
+        exit(0);
+    }
+}
+
+long peak_rss_kb()
+{
+    // Peak resident set size of the process so far (ru_maxrss is in kilobytes on Linux)
+
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
+
+void time_loop(const function<void()> & pass, double min_time, long & repeats, double & seconds)
+{
+    // Run one untimed warm-up pass, then repeat the pass until at least min_time seconds have elapsed
+
+    pass();
+
+    repeats = 0;
+    seconds = 0.0;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    while ((repeats == 0) || (seconds < min_time))
+    {
+        pass();
+
+        repeats++;
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+}
+
+void write_json(ostream & out, double min_time, const vector<bench_result> & results)
+{
+    out << "{" << endl;
+    out << "  \"benchmark\": \"chimescalc-bench\"," << endl;
+    out << "  \"min_time_s\": " << min_time << "," << endl;
+    out << "  \"results\": [" << endl;
+
+    for (int i=0; i<results.size(); i++)
+    {
+        const bench_result & r = results[i];
+
+        double per_repeat = r.seconds / r.repeats;    // With several threads, repeats counts the calls of all threads
+
+        double ns_per_interaction = (r.interactions > 0) ? 1.0e9 * per_repeat / r.interactions : 0.0;
+        double interactions_per_s = (per_repeat > 0.0)   ? r.interactions / per_repeat         : 0.0;
+        double ns_per_atom        = (r.n_atoms > 0)      ? 1.0e9 * per_repeat / r.n_atoms      : 0.0;
+
+        out << "    {"
+            << "\"name\": \""          << r.name          << "\", "
+            << "\"force_field\": \""   << r.force_field   << "\", "
+            << "\"configuration\": \"" << r.configuration << "\", "
+            << "\"n_atoms\": "         << r.n_atoms       << ", "
+            << "\"threads\": "         << r.threads       << ", "
+            << "\"interactions\": "    << r.interactions  << ", "
+            << "\"repeats\": "         << r.repeats       << ", "
+            << scientific << setprecision(6)
+            << "\"seconds\": "             << r.seconds             << ", "
+            << "\"ns_per_interaction\": "  << ns_per_interaction    << ", "
+            << "\"interactions_per_s\": "  << interactions_per_s    << ", "
+            << "\"ns_per_atom\": "         << ns_per_atom           << ", "
+            << defaultfloat
+            << "\"peak_rss_kb\": "     << r.peak_rss_kb;
+
+        if (r.has_errors)
+            out << scientific << setprecision(6)
+                << ", \"energy_error_per_atom\": " << r.energy_error_per_atom
+                << ", \"force_error_max\": "       << r.force_error_max
+                << ", \"force_error_rms\": "       << r.force_error_rms
+                << ", \"stress_error_max\": "      << r.stress_error_max
+                << defaultfloat;
+
+        out << "}"
+            << ((i+1 < results.size()) ? "," : "") << endl;
+    }
+
+    out << "  ]" << endl;
+    out << "}" << endl;
+}
+
+string strip(string str)
+{
+    // Remove leading and trailing white space
+
+    size_t first = str.find_first_not_of(" \t\r\n");
+
+    if (first == string::npos)
+        return "";
+
+    size_t last = str.find_last_not_of(" \t\r\n");
+
+    return str.substr(first, last-first+1);
+}
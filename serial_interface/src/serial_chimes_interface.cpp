@@ -15,46 +15,38 @@ using namespace std;
 
 #include "serial_chimes_interface.h"
 
-// Simple linear algebra functions (for arbitrary triclinic cell support)
+// Simple linear algebra functions (for arbitrary triclinic cell support), on 3-vectors
 
-double mag_a    (const vector<double> & a)
+double mag_a    (const double (&a)[3])
 {
     double mag = 0;
     
-    for(int i=0; i<a.size(); i++)
+    for(int i=0; i<3; i++)
         mag += a[i]*a[i];
     
     mag = sqrt(mag);
     
     return mag;
 }
-void   unit_a   (const vector<double> & a, vector<double> & unit)        
+void   unit_a   (const double (&a)[3], double (&unit)[3])        
 {
     double mag = mag_a(a);
 
-    unit.resize(a.size());
-    
-    for(int i=0; i<a.size(); i++)
-        unit[i] += a[i]/mag;
+    for(int i=0; i<3; i++)
+        unit[i] = a[i]/mag;
     
     return;
 }
-double a_dot_b  (const vector<double> & a, const vector<double> & b)
+double a_dot_b  (const double (&a)[3], const double (&b)[3])
 {
     double dot = 0;
     
-    if (a.size() != b.size())
-    {
-        cout << "ERROR in a_dot_b: Vectors of different length!" << endl;
-        exit(0);
-    }
-    
-    for(int i=0; i<a.size(); i++)
+    for(int i=0; i<3; i++)
         dot += a[i]*b[i];
     
     return dot;
 }
-double angle_ab (const vector<double> & a, const vector<double> & b)
+double angle_ab (const double (&a)[3], const double (&b)[3])
 {
     double ang = a_dot_b(a,b);
 
@@ -63,26 +55,14 @@ double angle_ab (const vector<double> & a, const vector<double> & b)
 
     return acos(ang);    
 }        
-void   a_cross_b(const vector<double> & a, const vector<double> & b, vector<double> & cross)
+void   a_cross_b(const double (&a)[3], const double (&b)[3], double (&cross)[3])
 {
-    if( a.size() != b.size())
-    {
-        cout << "ERROR in a_cross_b: Vectors of different length!" << endl;
-        exit(0);
-    }
-    if(a.size() != 3)
-    {
-        cout << "ERROR in a_cross_b: Vectors should be of length 3!" << endl;
-        exit(0);
-    }
-    
-    cross.resize(3);
     cross[0] =    (a[1]*b[2] - a[2]*b[1]);
     cross[1] = -1*(a[0]*b[2] - a[2]*b[0]);
     cross[2] =    (a[0]*b[1] - a[1]*b[0]);
     return;
 }    
-void set_hmat(const vector<double> & cell_a,const vector<double> & cell_b, const vector<double> & cell_c, vector<double> & hmat, vector<double> & invr_hmat, int replicates)
+void set_hmat(const double * cell_a, const double * cell_b, const double * cell_c, vector<double> & hmat, vector<double> & invr_hmat, int replicates)
 {
     // Define the h-matrix (stores the cell vectors locally)
 
@@ -96,7 +76,7 @@ void set_hmat(const vector<double> & cell_a,const vector<double> & cell_b, const
                     - hmat[1] * (hmat[3]*hmat[8] - hmat[5]*hmat[6])
                     + hmat[2] * (hmat[3]*hmat[7] - hmat[4]*hmat[6]);
 
-    vector<double> tmp_vec(9);
+    double tmp_vec[9];
     
     tmp_vec[0] =      (hmat[4]*hmat[8] - hmat[5]*hmat[7]); tmp_vec[3] = -1 * (hmat[1]*hmat[8] - hmat[2]*hmat[7]); tmp_vec[6] =      (hmat[1]*hmat[5] - hmat[2]*hmat[4]);
     tmp_vec[1] = -1 * (hmat[3]*hmat[8] - hmat[5]*hmat[6]); tmp_vec[4] =      (hmat[0]*hmat[8] - hmat[2]*hmat[6]); tmp_vec[7] = -1 * (hmat[0]*hmat[5] - hmat[2]*hmat[3]);
@@ -119,39 +99,19 @@ simulation_system::simulation_system()
 {
     hmat     .resize(9);
     invr_hmat.resize(9);
+    
+    time_neigh_2b = 0.0;
+    time_neigh_mb = 0.0;
+    
+    build_edges      = false;
+    root_edge_nslots = 0;
 }
 simulation_system::~simulation_system()
 {}
-void simulation_system::set_atomtyp_indices(vector<string> & type_list)
-{
-    sys_atmtyp_indices.resize(n_ghost);
-
-    for(int i=0; i<n_ghost; i++)
-    {
-        sys_atmtyp_indices[i] = -1;
-        
-        for (int j=0; j<type_list.size(); j++)
-        {
-            if ( sys_atmtyps[i] == type_list[j])
-            {
-                sys_atmtyp_indices[i] = j;
-                break;
-            }
-        }
-        
-        if (sys_atmtyp_indices[i] == -1)
-        {
-            cout << "ERROR: Couldn't assign an atom type index for (index/type) " << sys_parent[i] << " " << sys_atmtyps[i] << endl;
-            exit(0);
-        }
-    }
-}
-
-void simulation_system::init(vector<string> & atmtyps, vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, double max_2b_cut, bool small)
+void simulation_system::init(const vector<string> & atmtyps, const vector<string> & type_list, vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, double max_2b_cut, bool small)
 {
     allow_replication = small;
     max_cut = max_2b_cut;
-    static bool called_before = false;
     
     //////////////////////////////////////////
     // STEP 1: Copy the system
@@ -171,28 +131,52 @@ void simulation_system::init(vector<string> & atmtyps, vector<double> & x_in, ve
         cout << "ERROR: x and z coordinate vector lengths do not match!" << endl;
         exit(0);
     }
+    if (n_atoms > atmtyps.size())
+    {
+        cout << "ERROR: Fewer atom types than coordinates were given!" << endl;
+        exit(0);
+    }
     
     // Copy over the system
     
     n_ghost = n_atoms;
     n_repl  = n_atoms;
     
-    sys_atmtyp_indices.resize(0);
+    sys_atmtyp_indices.resize(n_atoms);
+    sys_parent        .resize(n_atoms);
+    sys_rep_parent    .resize(n_atoms);
     
-    sys_x.resize(0);
-    sys_y.resize(0);
-    sys_z.resize(0);
+    sys_x.resize(n_atoms);
+    sys_y.resize(n_atoms);
+    sys_z.resize(n_atoms);
     
     for (int a=0; a<n_atoms; a++)
     {
-        sys_atmtyps.push_back(atmtyps[a]);    
+        // Resolve the chemical symbol once; replicates and ghosts copy the index of their parent
+        
+        sys_atmtyp_indices[a] = -1;
+        
+        for (int j=0; j<type_list.size(); j++)
+        {
+            if (atmtyps[a] == type_list[j])
+            {
+                sys_atmtyp_indices[a] = j;
+                break;
+            }
+        }
+        
+        if (sys_atmtyp_indices[a] == -1)
+        {
+            cout << "ERROR: Couldn't assign an atom type index for (index/type) " << a << " " << atmtyps[a] << endl;
+            exit(0);
+        }
 
-        sys_x.push_back( x_in[a] );
-        sys_y.push_back( y_in[a] );
-        sys_z.push_back( z_in[a] );
+        sys_x[a] = x_in[a];
+        sys_y[a] = y_in[a];
+        sys_z[a] = z_in[a];
         
-        sys_parent.push_back(a); // for ghost
-        sys_rep_parent.push_back(a);    // for replicates
+        sys_parent[a]     = a; // for ghost
+        sys_rep_parent[a] = a; // for replicates
     }  
     
     // Determine if system is large enough  
@@ -213,27 +197,24 @@ void simulation_system::init(vector<string> & atmtyps, vector<double> & x_in, ve
     if (allow_replication)
         n_replicates = ceil(max_cut/min_latcon)-1;
 
-    if (n_replicates > 0)
-    {
-            if (!called_before)
-            {
-                called_before = true;
-
-                // Avoid printing the number of replicates on each MD step (LEF).
-                cout << "SerialchimesFF: " << "Replicating the system " << n_replicates << " times prior to generating ghost atoms" << endl;    
-    
-                cout << "SerialchimesFF: " << "\t" << "Warning: At least one cell length is smaller than the ChIMES outer cutoff." << endl;
-                cout << "SerialchimesFF: " << "\t" << "System will be replicated prior to ghost atom generation." << endl;
-                cout << "SerialchimesFF: " << "\t" << "Results will only be correct for perfectly crystalline cells." << endl;
-                cout << "SerialchimesFF: " << "\t" << "For any other case, system size should be increased." << endl;
-            }
-    }
-
-    set_hmat(cella_in, cellb_in, cellc_in, hmat, invr_hmat, 0);
+    set_hmat(cella_in.data(), cellb_in.data(), cellc_in.data(), hmat, invr_hmat, 0);
     
     // Build the replicates
 
     double tmp_x, tmp_y, tmp_z;
+    
+    n_repl  = n_atoms*(n_replicates+1)*(n_replicates+1)*(n_replicates+1);
+    n_ghost = n_repl;
+    
+    sys_atmtyp_indices.resize(n_repl);
+    sys_parent        .resize(n_repl);
+    sys_rep_parent    .resize(n_repl);
+    
+    sys_x.resize(n_repl);
+    sys_y.resize(n_repl);
+    sys_z.resize(n_repl);
+    
+    int r = n_atoms;    // Next replicate
 
 
     for (int i=0; i<=n_replicates; i++) // x
@@ -245,17 +226,9 @@ void simulation_system::init(vector<string> & atmtyps, vector<double> & x_in, ve
                 if ((i==0)&&(j==0)&&(k==0))
                    continue;
                 
-                for (int a=0; a<n_atoms; a++)
+                for (int a=0; a<n_atoms; a++, r++)
                 {
-                    n_ghost++;
-                    n_repl++;    
-                    
-                    atmtyps.push_back(atmtyps[a]);
-                    sys_atmtyps.push_back(atmtyps[a]);    
-                    
-                    sys_x.push_back(0.0); // Holder    
-                    sys_y.push_back(0.0);
-                    sys_z.push_back(0.0);
+                    sys_atmtyp_indices[r] = sys_atmtyp_indices[a];
                     
                     // Transform into inverse space 
                     
@@ -267,12 +240,12 @@ void simulation_system::init(vector<string> & atmtyps, vector<double> & x_in, ve
                     tmp_y += j;    
                     tmp_z += k;
                     
-                    sys_x[n_ghost-1] = hmat[0]*tmp_x + hmat[1]*tmp_y + hmat[2]*tmp_z;
-                    sys_y[n_ghost-1] = hmat[3]*tmp_x + hmat[4]*tmp_y + hmat[5]*tmp_z;
-                    sys_z[n_ghost-1] = hmat[6]*tmp_x + hmat[7]*tmp_y + hmat[8]*tmp_z;    
+                    sys_x[r] = hmat[0]*tmp_x + hmat[1]*tmp_y + hmat[2]*tmp_z;
+                    sys_y[r] = hmat[3]*tmp_x + hmat[4]*tmp_y + hmat[5]*tmp_z;
+                    sys_z[r] = hmat[6]*tmp_x + hmat[7]*tmp_y + hmat[8]*tmp_z;    
                     
-                    sys_parent.push_back(n_repl-1); // As far as ghosts are concerned, these are real atoms
-                    sys_rep_parent.push_back(a);    // replicates know they have a parent
+                    sys_parent[r]     = r; // As far as ghosts are concerned, these are real atoms
+                    sys_rep_parent[r] = a; // replicates know they have a parent
                 }
             }
         }
@@ -283,7 +256,7 @@ void simulation_system::init(vector<string> & atmtyps, vector<double> & x_in, ve
 
     n_atoms = n_repl;
 
-    set_hmat(cella_in, cellb_in, cellc_in, hmat, invr_hmat, n_replicates);
+    set_hmat(cella_in.data(), cellb_in.data(), cellc_in.data(), hmat, invr_hmat, n_replicates);
 
     //////////////////////////////////////////
     // STEP 2: Wrap atoms
@@ -362,15 +335,15 @@ void simulation_system::reorient()
     
     // Rotate the cell
     
-    vector<double> tmp_cella(3);
-    vector<double> tmp_cellb(3);
-    vector<double> tmp_cellc(3);
-    vector<double> tmp_unit (3);
-    vector<double> tmp_cross(3);
+    double tmp_cella[3];
+    double tmp_cellb[3];
+    double tmp_cellc[3];
+    double tmp_unit [3];
+    double tmp_cross[3];
     
-    vector<double> cella_in = {hmat[0], hmat[3], hmat[6]};
-    vector<double> cellb_in = {hmat[1], hmat[4], hmat[7]};
-    vector<double> cellc_in = {hmat[2], hmat[5], hmat[8]};
+    double cella_in[3] = {hmat[0], hmat[3], hmat[6]};
+    double cellb_in[3] = {hmat[1], hmat[4], hmat[7]};
+    double cellc_in[3] = {hmat[2], hmat[5], hmat[8]};
     
     
     unit_a   (cella_in, tmp_unit);
@@ -392,7 +365,7 @@ void simulation_system::reorient()
             
     // Determine the new cell h-matrix and its inverse
 
-    set_hmat({tmp_cella[0], tmp_cella[1], tmp_cella[2]}, {tmp_cellb[0], tmp_cellb[1], tmp_cellb[2]}, {tmp_cellc[0], tmp_cellc[1], tmp_cellc[2]}, hmat, invr_hmat, 0);
+    set_hmat(tmp_cella, tmp_cellb, tmp_cellc, hmat, invr_hmat, 0);
 
     // Transform to the new nominally rotated cell  
 
@@ -470,14 +443,12 @@ void simulation_system::reorient()
 
 
 }
-void simulation_system::build_layered_system(vector<string> & atmtyps, vector<int> & poly_orders, double max_2b_cut, double max_3b_cut, double max_4b_cut)
+void simulation_system::build_layered_system(vector<int> & poly_orders, double max_2b_cut, double max_3b_cut, double max_4b_cut)
 {
     
     // use smallest lattice length to determine number of ghost atom layers (n_layers)
      
-    vector<double> latdist = {latcon_a,latcon_b,latcon_c};
-    
-    double lat_min = *min_element(latdist.begin(),latdist.end());
+    double lat_min = min(latcon_a, min(latcon_b, latcon_c));
     
     double eff_length = max_2b_cut*2.0;
     
@@ -529,9 +500,20 @@ void simulation_system::build_layered_system(vector<string> & atmtyps, vector<in
         }
     }
 
-    // Build the layers
+    // Build the layers. Ghosts only carry the type index and parent of their real atom; all arrays are sized up front.
 
     double tmp_x, tmp_y, tmp_z;
+    
+    n_ghost = n_atoms*(2*n_layers+1)*(2*n_layers+1)*(2*n_layers+1);
+    
+    sys_atmtyp_indices.resize(n_ghost);
+    sys_parent        .resize(n_ghost);
+    
+    sys_x.resize(n_ghost);
+    sys_y.resize(n_ghost);
+    sys_z.resize(n_ghost);
+    
+    int g = n_atoms;    // Next ghost
 
     for (int i=-n_layers; i<=n_layers; i++) // x
     {
@@ -542,15 +524,9 @@ void simulation_system::build_layered_system(vector<string> & atmtyps, vector<in
                 if ((i==0)&&(j==0)&&(k==0))
                     continue;
                     
-                for (int a=0; a<n_atoms; a++)
+                for (int a=0; a<n_atoms; a++, g++)
                 {
-                    n_ghost++;    
-                    
-                    sys_atmtyps.push_back(atmtyps[a]);    
-                    
-                    sys_x.push_back(0.0); // Holder    
-                    sys_y.push_back(0.0);
-                    sys_z.push_back(0.0);
+                    sys_atmtyp_indices[g] = sys_atmtyp_indices[a];
                     
                     // Transform into inverse space 
 
@@ -562,20 +538,24 @@ void simulation_system::build_layered_system(vector<string> & atmtyps, vector<in
                     tmp_y += j;    
                     tmp_z += k;
 
-                    sys_x[n_ghost-1] = hmat[0]*tmp_x + hmat[1]*tmp_y + hmat[2]*tmp_z;
-                    sys_y[n_ghost-1] = hmat[3]*tmp_x + hmat[4]*tmp_y + hmat[5]*tmp_z;
-                    sys_z[n_ghost-1] = hmat[6]*tmp_x + hmat[7]*tmp_y + hmat[8]*tmp_z;    
+                    sys_x[g] = hmat[0]*tmp_x + hmat[1]*tmp_y + hmat[2]*tmp_z;
+                    sys_y[g] = hmat[3]*tmp_x + hmat[4]*tmp_y + hmat[5]*tmp_z;
+                    sys_z[g] = hmat[6]*tmp_x + hmat[7]*tmp_y + hmat[8]*tmp_z;    
 
-                    sys_parent.push_back(a);
+                    sys_parent[g] = a;
                 }
             }
         }
     }
 }
-void simulation_system::build_neigh_lists(vector<int> & poly_orders, vector<vector<int> > & neighlist_2b, vector<vector<int> > & neighlist_3b, vector<vector<int> > & neighlist_4b, double max_2b_cut, double max_3b_cut, double max_4b_cut)
+void simulation_system::build_neigh_lists(vector<int> & poly_orders, vector<vector<int> > & neighlist_2b, vector<int> & neighlist_3b, vector<int> & neighlist_4b, double max_2b_cut, double max_3b_cut, double max_4b_cut, chimesFF * ff, double skin, bool build_4b)
 {
-    vector<double> maxpos(3, -1.0e100) ;
-    vector<double> minpos(3, +1.0e100) ;
+#if CHIMES_INSTRUMENT
+    double t_start = chimes_wtime();
+#endif
+    
+    double maxpos[3] = {-1.0e100, -1.0e100, -1.0e100};
+    double minpos[3] = {+1.0e100, +1.0e100, +1.0e100};
 
     // Determine limits on position of all particles.
     for(int i=0; i<n_ghost; i++)
@@ -628,14 +608,12 @@ void simulation_system::build_neigh_lists(vector<int> & poly_orders, vector<vect
     
     int total_bins = nbins_x * nbins_y * nbins_z;
     
-    vector<vector<int> > bin(total_bins);
-
-    for (int i=0; i<total_bins; i++) 
-        vector<int>().swap(bin[i]);
-    
     int bin_x_idx, bin_y_idx, bin_z_idx, ibin;
 
-    // Populate bins    
+    // Populate bins: the atoms of bin b are bin_atoms[bin_start[b]] to bin_atoms[bin_start[b+1]-1], in index order
+    
+    bin_start.assign(total_bins+1, 0);
+    atom_bin .resize(n_ghost);
 
     for(int i=0; i<n_ghost; i++)
     {
@@ -659,10 +637,18 @@ void simulation_system::build_neigh_lists(vector<int> & poly_orders, vector<vect
             exit(1);
         }
 
-        // Push the atom into the bin 
-        bin[ibin].push_back(i);
-        
+        atom_bin[i] = ibin;
+        bin_start[ibin+1]++;
     }
+    
+    for (int b=0; b<total_bins; b++)
+        bin_start[b+1] += bin_start[b];
+    
+    bin_next .assign(bin_start.begin(), bin_start.end()-1);
+    bin_atoms.resize(n_ghost);
+    
+    for(int i=0; i<n_ghost; i++)
+        bin_atoms[ bin_next[atom_bin[i]]++ ] = i;
 
     // Generate neighbor lists on basis of bins
     
@@ -699,11 +685,11 @@ void simulation_system::build_neigh_lists(vector<int> & poly_orders, vector<vect
                         exit(1);
                     }
 
-                    ajend = bin[ibin].size();
+                    ajend = bin_start[ibin+1];
                     
-                    for (int aj=0; aj<ajend; aj++) 
+                    for (int aj=bin_start[ibin]; aj<ajend; aj++) 
                     {
-                        ajj = bin[ibin][aj];
+                        ajj = bin_atoms[aj];
 
                         if ( ajj == ai ) 
                             continue;
@@ -717,39 +703,72 @@ void simulation_system::build_neigh_lists(vector<int> & poly_orders, vector<vect
         }
     }    
 
-    if ((poly_orders[1] == 0)&&(poly_orders[2]==0))
+    // Number the pair edges (see build_edges)
+    
+    edges_3b.resize(0);
+    edges_4b.resize(0);
+    
+    if (build_edges)
+    {
+        edge_2b_start.resize(n_atoms);
+        edge_atoms   .resize(0);
+        
+        for (int i=0; i<n_atoms; i++)
+        {
+            edge_2b_start[i] = edge_atoms.size()/2;
+            
+            for (int j=0; j<neighlist_2b[i].size(); j++)
+            {
+                edge_atoms.push_back(i);
+                edge_atoms.push_back(neighlist_2b[i][j]);
+            }
+        }
+    }
+
+#if CHIMES_INSTRUMENT
+    double t_2b = chimes_wtime();
+    
+    time_neigh_2b = t_2b - t_start;
+    time_neigh_mb = 0.0;
+#endif
+
+    build_4b = build_4b && (poly_orders[2] > 0);
+    
+    if ((poly_orders[1] == 0) && !build_4b)
         return;    
     
-    // Make the 3- and 4-b neighbor lists
+    // Make the 3- and 4-b neighbor lists. With a force field, candidate pairs are screened with the largest cutoff of
+    // their pair of atom types, and clusters are only kept if their type is not excluded and all distances are 
+    // within the type-specific cutoffs (i.e. if compute_3B/compute_4B would evaluate them), padded by skin.
 
     bool valid_3mer;
     bool valid_4mer;
     
-    vector<int> tmp_3mer(3);
-    vector<int> tmp_4mer(4);
+    int jj, kk;
+    int ti, tj, tk;
     
-    int jj, kk, ll;
-    
-    double dist;
-    double dist_ij, dist_ik, dist_il, dist_jk, dist_jl, dist_kl;
+    double dist_3b[3];
+    double dist_4b[6];
+    int    typs[4];
     
     for(int i=0; i<n_atoms; i++)
     {
+        ti = sys_atmtyp_indices[i];
+        
+        if (build_edges)
+            edge_root(i, neighlist_2b[i]);
+        
         for(int j=0; j<neighlist_2b[i].size(); j++) // Neighbors of i
         {
-            valid_3mer = true;
-            valid_4mer = true;
-            
             jj = neighlist_2b[i][j];
+            tj = sys_atmtyp_indices[jj];
             
-            dist_ij = get_dist(i,jj);
+            dist_4b[0] = dist_3b[0] = get_dist(i,jj);   // ij
 
-            if (dist_ij >= max_3b_cut)
-                valid_3mer = false;
-            if (dist_ij >= max_4b_cut)
-                valid_4mer = false;
+            bool ij_3b = (dist_3b[0] < (ff ? ff->max_cutoff_3B_pair(ti,tj) + skin : max_3b_cut));
+            bool ij_4b = (dist_3b[0] < (ff ? ff->max_cutoff_4B_pair(ti,tj) + skin : max_4b_cut)) && build_4b;
                 
-            if (!valid_3mer && !valid_4mer)
+            if (!ij_3b && !ij_4b)
                 continue;
             
             for(int k=0; k<neighlist_2b[i].size(); k++)
@@ -761,100 +780,206 @@ void simulation_system::build_neigh_lists(vector<int> & poly_orders, vector<vect
                 if (sys_parent[jj] > sys_parent[kk])
                     continue;
                 
-                dist_ik = get_dist(i,kk); // Check i/k distance
-            
-                if (dist_ik >= max_3b_cut)
-                    valid_3mer = false;
-                if (dist_ik >= max_4b_cut)
-                    valid_4mer = false;
-                    
-                dist_jk = get_dist(jj,kk); // Check j/k distance
-        
-                if (dist_jk >= max_3b_cut)
-                    valid_3mer = false;
-                if (dist_jk >= max_4b_cut)
-                    valid_4mer = false;                                        
+                tk = sys_atmtyp_indices[kk];
                 
-                if (!valid_3mer && !valid_4mer)
-                {
-                    if(dist_ij<max_3b_cut)
-                        valid_3mer = true;
-                    
-                    if(dist_ij<max_4b_cut)
-                        valid_4mer = true;
+                dist_4b[1] = dist_3b[1] = get_dist(i,kk);   // ik
+                dist_4b[3] = dist_3b[2] = get_dist(jj,kk);  // jk
                 
-                    continue;
-                }
+                valid_3mer = ij_3b && (dist_3b[1] < (ff ? ff->max_cutoff_3B_pair(ti,tk) + skin : max_3b_cut))
+                                   && (dist_3b[2] < (ff ? ff->max_cutoff_3B_pair(tj,tk) + skin : max_3b_cut));
+                valid_4mer = ij_4b && (dist_3b[1] < (ff ? ff->max_cutoff_4B_pair(ti,tk) + skin : max_4b_cut))
+                                   && (dist_3b[2] < (ff ? ff->max_cutoff_4B_pair(tj,tk) + skin : max_4b_cut));
                 
                 // If we're here then we have a valid 3-mer ... add it to the 3b neighbor list    
                 
-                tmp_3mer[0] = i;
-                tmp_3mer[1] = jj;
-                tmp_3mer[2] = kk;
-                
                 if (valid_3mer)
-                    neighlist_3b.push_back(tmp_3mer);
+                {
+                    typs[0] = ti;
+                    typs[1] = tj;
+                    typs[2] = tk;
+                    
+                    if (!ff || ff->cluster_within_3B(dist_3b, typs, skin))
+                    {
+                        neighlist_3b.push_back(i);
+                        neighlist_3b.push_back(jj);
+                        neighlist_3b.push_back(kk);
+                        
+                        if (build_edges)
+                        {
+                            edges_3b.push_back(find_edge(i, neighlist_2b[i], 0,   j+1));
+                            edges_3b.push_back(find_edge(i, neighlist_2b[i], 0,   k+1));
+                            edges_3b.push_back(find_edge(i, neighlist_2b[i], j+1, k+1));
+                        }
+                    }
+                }
                 
                 // Continue on to 4-body list
                 
-                if (poly_orders[2] == 0)
-                    continue;
-                
                 if (!valid_4mer)
-                {
-                    if(dist_ij<max_4b_cut)
-                        valid_4mer = true;
                     continue;
-                }
-                
-                for(int l=0; l<neighlist_2b[i].size(); l++) 
-                {                                
-                    ll = neighlist_2b[i][l];
-                
-                    if (jj == ll)
-                        continue;
-                    if (kk == ll)
-                        continue;
-                    if (sys_parent[jj] > sys_parent[ll])
-                        continue;                
-                    if (sys_parent[kk] > sys_parent[ll])
-                        continue;                
-
-                    if (get_dist(i ,ll) >= max_4b_cut) // Check i/l distance
-                        continue;                
-
-                    if (get_dist(jj,ll) >= max_4b_cut) // Check j/l distance
-                        continue;    
-
-                    if (get_dist(kk,ll) >= max_4b_cut) // Check k/l distance
-                        continue;        
-                    
-                    // If we're here then we have a valid 4-mer ... add it to the 4b neighbor list    
                 
-                    tmp_4mer[0] = i;
-                    tmp_4mer[1] = jj;
-                    tmp_4mer[2] = kk;
-                    tmp_4mer[3] = ll;
-                
-                    if (valid_4mer)
-                        neighlist_4b.push_back(tmp_4mer);        
-                }                                                                        
+                add_4mers(i, j, k, dist_4b, neighlist_2b[i], max_4b_cut, ff, skin, neighlist_4b, build_edges ? &edges_4b : NULL);
             }
         }
     }
+
+#if CHIMES_INSTRUMENT
+    time_neigh_mb = chimes_wtime() - t_2b;
+#endif
+
     /*
     cout << "2B neighbor list is of length:" << neighlist_2b.size() << endl;
-    cout << "3B neighbor list is of length:" << neighlist_3b.size() << endl;
-    cout << "4B neighbor list is of length:" << neighlist_4b.size() << endl;
+    cout << "3B neighbor list is of length:" << neighlist_3b.size()/3 << endl;
+    cout << "4B neighbor list is of length:" << neighlist_4b.size()/4 << endl;
     */
 
 }
 
-void simulation_system::run_checks(const vector<double>& max_cuts, vector<int>&poly_orders)
+void simulation_system::add_4mers(int i, int j, int k, double * dist_4b, const vector<int> & nlist, double max_4b_cut, chimesFF * ff, double skin, vector<int> & quads, vector<int> * quad_edges)
+{
+    int jj = nlist[j];
+    int kk = nlist[k];
+    int ll;
+    int ti = sys_atmtyp_indices[i ];
+    int tj = sys_atmtyp_indices[jj];
+    int tk = sys_atmtyp_indices[kk];
+    int tl;
+    int typs[4] = {ti, tj, tk, 0};
+    
+    for(int l=0; l<nlist.size(); l++) 
+    {                                
+        ll = nlist[l];
+    
+        if (jj == ll)
+            continue;
+        if (kk == ll)
+            continue;
+        if (sys_parent[jj] > sys_parent[ll])
+            continue;                
+        if (sys_parent[kk] > sys_parent[ll])
+            continue;                
+        
+        tl = sys_atmtyp_indices[ll];
+
+        dist_4b[2] = get_dist(i ,ll); // Check i/l distance
+        
+        if (dist_4b[2] >= (ff ? ff->max_cutoff_4B_pair(ti,tl) + skin : max_4b_cut)) 
+            continue;                
+
+        dist_4b[4] = get_dist(jj,ll); // Check j/l distance
+        
+        if (dist_4b[4] >= (ff ? ff->max_cutoff_4B_pair(tj,tl) + skin : max_4b_cut))
+            continue;    
+
+        dist_4b[5] = get_dist(kk,ll); // Check k/l distance
+        
+        if (dist_4b[5] >= (ff ? ff->max_cutoff_4B_pair(tk,tl) + skin : max_4b_cut))
+            continue;        
+        
+        typs[3] = tl;
+        
+        if (ff && !ff->cluster_within_4B(dist_4b, typs, skin))
+            continue;
+        
+        // If we're here then we have a valid 4-mer ... add it to the list    
+    
+        quads.push_back(i);
+        quads.push_back(jj);
+        quads.push_back(kk);
+        quads.push_back(ll);
+        
+        if (quad_edges)
+        {
+            const int slots[4]    = {0, j+1, k+1, l+1};
+            const int edges[6][2] = {{0,1}, {0,2}, {0,3}, {1,2}, {1,3}, {2,3}};    // ij, ik, il, jk, jl, kl
+            
+            for (int e=0; e<6; e++)
+                quad_edges->push_back(find_edge(i, nlist, slots[edges[e][0]], slots[edges[e][1]]));
+        }
+    }
+}
+
+void simulation_system::edge_root(int i, const vector<int> & nlist)
+{
+    // Drop the neighbor edges numbered for the previous root
+    
+    for (int s=0; s<root_edge_set.size(); s++)
+        root_edge[ root_edge_set[s] ] = -1;
+    
+    root_edge_set.resize(0);
+    
+    root_edge_nslots = nlist.size() + 1;
+    
+    if (root_edge.size() < root_edge_nslots*root_edge_nslots)
+        root_edge.assign(root_edge_nslots*root_edge_nslots, -1);
+}
+
+int simulation_system::build_4b_tile(int root, int max_quads, const vector<vector<int> > & neighlist_2b, vector<int> & quads, double max_4b_cut, chimesFF * ff, double skin, vector<int> * quad_edges)
+{
+    // Same enumeration as the 4-body part of build_neigh_lists, one root atom at a time
+    
+    double dist_4b[6];
+    int    jj, kk;
+    int    ti, tj, tk;
+    
+    quads.resize(0);
+    
+    if (quad_edges)
+        quad_edges->resize(0);
+    
+    int i = root;
+    
+    for ( ; (i<n_atoms) && (quads.size() < 4*max_quads); i++)
+    {
+        ti = sys_atmtyp_indices[i];
+        
+        if (quad_edges)
+            edge_root(i, neighlist_2b[i]);
+        
+        for(int j=0; j<neighlist_2b[i].size(); j++)
+        {
+            jj = neighlist_2b[i][j];
+            tj = sys_atmtyp_indices[jj];
+            
+            dist_4b[0] = get_dist(i,jj);   // ij
+            
+            if (dist_4b[0] >= (ff ? ff->max_cutoff_4B_pair(ti,tj) + skin : max_4b_cut))
+                continue;
+            
+            for(int k=0; k<neighlist_2b[i].size(); k++)
+            {
+                kk = neighlist_2b[i][k];
+                
+                if (jj == kk)
+                    continue;
+                if (sys_parent[jj] > sys_parent[kk])
+                    continue;
+                
+                tk = sys_atmtyp_indices[kk];
+                
+                dist_4b[1] = get_dist(i,kk);    // ik
+                
+                if (dist_4b[1] >= (ff ? ff->max_cutoff_4B_pair(ti,tk) + skin : max_4b_cut))
+                    continue;
+                
+                dist_4b[3] = get_dist(jj,kk);   // jk
+                
+                if (dist_4b[3] >= (ff ? ff->max_cutoff_4B_pair(tj,tk) + skin : max_4b_cut))
+                    continue;
+                
+                add_4mers(i, j, k, dist_4b, neighlist_2b[i], max_4b_cut, ff, skin, quads, quad_edges);
+            }
+        }
+    }
+    
+    return i;
+}
+
+void simulation_system::run_checks(const double (&max_cuts)[3], vector<int>&poly_orders)
 {
     // Sanity check 1: Are the cell vectors long enough?
     
-    for(int i=0;i<max_cuts.size(); i++)
+    for(int i=0;i<3; i++)
     {
         if ( 
             (max_cuts[i] > 2*latcon_a * (2*n_layers + 1)) || 
@@ -893,7 +1018,7 @@ void simulation_system::run_checks(const vector<double>& max_cuts, vector<int>&p
     
 // serial_chimes_interface member functions
 
-serial_chimes_interface::serial_chimes_interface(bool small)
+serial_chimes_interface::serial_chimes_interface(bool small) : chimes_2btmp(0), chimes_3btmp(0), chimes_4btmp(0), mc_2btmp(0), mc_3btmp(0), mc_4btmp(0)
 {
     // For small systems, allow explicit replication prior to ghost atom construction
     // This should ONLY be done for perfectly crystalline systems
@@ -916,14 +1041,54 @@ serial_chimes_interface::serial_chimes_interface(bool small)
     typ_idxs_3b.resize(3);
     typ_idxs_4b.resize(4);
     
+    force_2b     .resize(2*CHDIM);
+    force_3b     .resize(3*CHDIM);
+    force_4b     .resize(4*CHDIM);
+    stress_chimes.resize(6);
+    stress_cl    .resize(6);
+    
     max_2b_cut = 0.0;
     max_3b_cut = 0.0;
     max_4b_cut = 0.0;
     
+    for (int n=0; n<5; n++)
+        energy_terms[n] = 0.0;
+    
+    mc_skin       = 1.0;
+    mc_trial_atom = -1;
+    
+    cache_edge_polys = true;
+    stream_4b        = false;
+    stream_4b_tile   = 4096;
+    use_edge_table   = true;
+    spatial_sort     = false;
+    edge_nslots      = 0;
+    edge_root        = -1;
+    
+    warned_replication = false;
+    
+    force_scalar_mb.resize(6);
 }
 serial_chimes_interface::~serial_chimes_interface()
 {}
 
+void serial_chimes_interface::warn_replication(const simulation_system & system)
+{
+    // Warn once per instance, rather than on each MD step (LEF)
+    
+    if ((system.n_replicates == 0) || warned_replication)
+        return;
+    
+    warned_replication = true;
+    
+    cout << "SerialchimesFF: " << "Replicating the system " << system.n_replicates << " times prior to generating ghost atoms" << endl;    
+
+    cout << "SerialchimesFF: " << "\t" << "Warning: At least one cell length is smaller than the ChIMES outer cutoff." << endl;
+    cout << "SerialchimesFF: " << "\t" << "System will be replicated prior to ghost atom generation." << endl;
+    cout << "SerialchimesFF: " << "\t" << "Results will only be correct for perfectly crystalline cells." << endl;
+    cout << "SerialchimesFF: " << "\t" << "For any other case, system size should be increased." << endl;
+}
+
 void serial_chimes_interface::init_chimesFF(string chimesFF_paramfile, int rank)
 {
     // Initialize the chimesFF object, read parameters
@@ -937,94 +1102,332 @@ void serial_chimes_interface::init_chimesFF(string chimesFF_paramfile, int rank)
 
 void serial_chimes_interface::build_neigh_lists(vector<string> & atmtyps, vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in)
 {
-    neigh.init(atmtyps, x_in, y_in, z_in, cella_in, cellb_in, cellc_in, max_cutoff_2B(true), allow_replication);
+    neigh.init(atmtyps, type_list, x_in, y_in, z_in, cella_in, cellb_in, cellc_in, max_cutoff_2B(true), allow_replication);
     neigh.reorient();
-    neigh.build_layered_system(atmtyps, poly_orders, max_cutoff_2B(true), max_cutoff_3B(true), max_cutoff_4B(true));
-    neigh.set_atomtyp_indices(type_list);
-    neigh.build_neigh_lists(poly_orders, neighlist_2b, neighlist_3b, neighlist_4b, max_cutoff_2B(true), max_cutoff_3B(true), max_cutoff_4B(true));
+    neigh.build_layered_system(poly_orders, max_cutoff_2B(true), max_cutoff_3B(true), max_cutoff_4B(true));
+    neigh.build_edges = use_edge_table;
+    neigh.build_neigh_lists(poly_orders, neighlist_2b, neighlist_3b, neighlist_4b, max_cutoff_2B(true), max_cutoff_3B(true), max_cutoff_4B(true), this, 0.0, !stream_4b);
 }
 
-void serial_chimes_interface::calculate(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy, vector<vector<double> > & force, vector<double> & stress)
-{   
-    // Read system, set up lattice constants/hmats
+void serial_chimes_interface::fill_edge_table(int first)
+{
+    // Distances and displacements of the neigh edges from first on, from the input (sys) coordinates
+    
+    const int n_edges = neigh.num_edges();
+    
+    edge_dx.resize(n_edges);
+    edge_dr.resize(n_edges*CHDIM);
+    
+    for (int e=first; e<n_edges; e++)
+        edge_dx[e] = sys.get_dist(neigh.edge_atoms[2*e], neigh.edge_atoms[2*e+1], &edge_dr[e*CHDIM]);
+}
 
-    // Determine the max outer cutoff (MUST be 2-body, based on ChIMES logic)
+void serial_chimes_interface::calculate(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy, vector<vector<double> > & force, vector<double> & stress)
+{
+    calculate_system(x_in, y_in, z_in, cella_in, cellb_in, cellc_in, atmtyps, energy, force, stress, NULL, NULL);
+}
 
-    // Initialize private members (LEF)
-    max_2b_cut = max_cutoff_2B(true) ;
-    max_3b_cut = max_cutoff_3B(true) ;
-    max_4b_cut = max_cutoff_4B(true) ;
+void serial_chimes_interface::calculate(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy, vector<vector<double> > & force, vector<double> & stress, vector<double> & atom_energy, vector<vector<double> > & atom_stress)
+{
+    calculate_system(x_in, y_in, z_in, cella_in, cellb_in, cellc_in, atmtyps, energy, force, stress, &atom_energy, &atom_stress);
+}
 
-    vector<double> stress_chimes(6,0.0) ; // Switch Chimes to a packed stressed tensor.
+void serial_chimes_interface::calculate_system(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy, vector<vector<double> > & force, vector<double> & stress, vector<double> * atom_energy, vector<vector<double> > * atom_stress)
+{
+    if (!spatial_sort)
+    {
+        evaluate_system(x_in, y_in, z_in, cella_in, cellb_in, cellc_in, atmtyps, energy, force, stress, atom_energy, atom_stress);
+        return;
+    }
     
-    sys.init(atmtyps, x_in, y_in, z_in, cella_in, cellb_in, cellc_in, max_2b_cut, allow_replication);   
+    // Evaluate the sorted copy of the system, then add its forces and per-atom quantities to the input atoms
     
-    sys.build_layered_system(atmtyps,poly_orders, max_2b_cut, max_3b_cut, max_4b_cut);
-
-    sys.set_atomtyp_indices(type_list);
+    const int n_atoms = x_in.size();
     
-    sys.run_checks({max_2b_cut,max_3b_cut,max_4b_cut},poly_orders);
-
-    build_neigh_lists(atmtyps, x_in, y_in, z_in, cella_in, cellb_in, cellc_in);
-
+    sort_system(x_in, y_in, z_in, cella_in, cellb_in, cellc_in, atmtyps);
     
-    // Setup vars
+    // Inner vectors are reset in place, so that their storage is reused across calls
     
-    int ii, jj, kk, ll;
+    sort_force.resize(n_atoms);
     
-    vector<double> force_4b(4*CHDIM) ;
-    vector<double> force_3b(3*CHDIM) ;
-    vector<double> force_2b(2*CHDIM) ;
-    chimes2BTmp chimes_2btmp(poly_orders[0]) ;
-    chimes3BTmp chimes_3btmp(poly_orders[1]) ;
-    chimes4BTmp chimes_4btmp(poly_orders[2]) ;      
+    for (int a=0; a<n_atoms; a++)
+        sort_force[a].assign(3, 0.0);
     
-    ////////////////////////
-    // interate over 1- and 2b's 
-    ////////////////////////
-
-    for(int i=0; i<sys.n_atoms; i++)
+    if (atom_energy != NULL)
     {
-        compute_1B(sys.sys_atmtyp_indices[i], energy);
-
-        for(int j=0; j<neighlist_2b[i].size(); j++) // Neighbors of i
+        sort_atom_energy.assign(n_atoms, 0.0);
+        sort_atom_stress.resize(n_atoms);
+        
+        for (int a=0; a<n_atoms; a++)
+            sort_atom_stress[a].assign(9, 0.0);
+    }
+    
+    evaluate_system(sort_x, sort_y, sort_z, cella_in, cellb_in, cellc_in, sort_atmtyps, energy, sort_force, stress, 
+                    (atom_energy != NULL) ? &sort_atom_energy : NULL, (atom_energy != NULL) ? &sort_atom_stress : NULL);
+    
+    if (get_eval_mode() != evalMode::ENERGY)
+    for (int a=0; a<n_atoms; a++)
+        for (int idx=0; idx<3; idx++)
+            force[sort_order[a]][idx] += sort_force[a][idx];
+    
+    if (atom_energy != NULL)
+    {
+        atom_energy->resize(n_atoms, 0.0);
+        if (atom_stress->size() != n_atoms)
+            atom_stress->resize(n_atoms, vector<double>(9,0.0));
+        
+        for (int a=0; a<n_atoms; a++)
         {
-            jj = neighlist_2b[i][j];
-
-            dist = sys.get_dist(i,jj,dr); // Populates dr, which is passed by ref (overloaded)
+            (*atom_energy)[sort_order[a]] += sort_atom_energy[a];
             
-            typ_idxs_2b[0] = sys.sys_atmtyp_indices[i ];
-            typ_idxs_2b[1] = sys.sys_atmtyp_indices[jj];
-            
-            for (int idx=0; idx<2*CHDIM; idx++) {
-                force_2b[idx] = 0.0 ;
-            }
+            (*atom_stress)[sort_order[a]].resize(9, 0.0);
             
-            compute_2B(dist, dr, typ_idxs_2b, force_2b, stress_chimes, energy, chimes_2btmp);
-
-            for (int idx=0; idx<3; idx++)
-            {
-                force[sys.sys_rep_parent[i]][idx]                  += force_2b[0*CHDIM+idx] ;
-                force[sys.sys_rep_parent[sys.sys_parent[jj]]][idx] += force_2b[1*CHDIM+idx] ;     
-            }
+            for (int idx=0; idx<9; idx++)
+                (*atom_stress)[sort_order[a]][idx] += sort_atom_stress[a][idx];
         }
     }
+}
+
+// Interleave the lowest 10 bits of v with two zero bits each (bit b moves to bit 3b)
+
+static inline unsigned int morton_spread(unsigned int v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v <<  8)) & 0x0300f00f;
+    v = (v | (v <<  4)) & 0x030c30c3;
+    v = (v | (v <<  2)) & 0x09249249;
+    
+    return v;
+}
+
+void serial_chimes_interface::sort_system(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps)
+{
+    // Order the atoms by the Morton code of their wrapped fractional coordinates, on a 1024^3 grid. Atoms in the same
+    // grid cell keep their input order.
+    
+    const int n_atoms = x_in.size();
+    
+    if ((y_in.size() != n_atoms) || (z_in.size() != n_atoms) || (atmtyps.size() < n_atoms))
+    {
+        cout << "ERROR: Coordinate and atom type vector lengths do not match!" << endl;
+        exit(0);
+    }
+    
+    vector<double> & invr_hmat = sort_invr_hmat;
+    
+    sort_hmat     .resize(9);
+    sort_invr_hmat.resize(9);
+    
+    set_hmat(cella_in.data(), cellb_in.data(), cellc_in.data(), sort_hmat, sort_invr_hmat, 0);
+    
+    vector<pair<unsigned int, int> > & keys = sort_keys;
+    
+    keys.resize(n_atoms);
+    
+    double frac[3];
+    
+    for (int a=0; a<n_atoms; a++)
+    {
+        unsigned int code = 0;
+        
+        for (int d=0; d<3; d++)
+        {
+            frac[d]  = invr_hmat[3*d+0]*x_in[a] + invr_hmat[3*d+1]*y_in[a] + invr_hmat[3*d+2]*z_in[a];
+            frac[d] -= floor(frac[d]);
+            
+            code |= morton_spread(min(1023, (int) (frac[d]*1024.0))) << d;
+        }
+        keys[a] = make_pair(code, a);
+    }
+    
+    sort(keys.begin(), keys.end());
+    
+    sort_order  .resize(n_atoms);
+    sort_x      .resize(n_atoms);
+    sort_y      .resize(n_atoms);
+    sort_z      .resize(n_atoms);
+    sort_atmtyps.resize(n_atoms);
+    
+    for (int a=0; a<n_atoms; a++)
+    {
+        const int i = keys[a].second;
+        
+        sort_order[a]   = i;
+        sort_x[a]       = x_in[i];
+        sort_y[a]       = y_in[i];
+        sort_z[a]       = z_in[i];
+        sort_atmtyps[a] = atmtyps[i];
+    }
+}
+
+void serial_chimes_interface::evaluate_system(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy, vector<vector<double> > & force, vector<double> & stress, vector<double> * atom_energy, vector<vector<double> > * atom_stress)
+{   
+    // Read system, set up lattice constants/hmats
+
+    // Determine the max outer cutoff (MUST be 2-body, based on ChIMES logic)
+
+    // Initialize private members (LEF)
+    max_2b_cut = max_cutoff_2B(true) ;
+    max_3b_cut = max_cutoff_3B(true) ;
+    max_4b_cut = max_cutoff_4B(true) ;
+
+    fill(stress_chimes.begin(), stress_chimes.end(), 0.0); // Switch Chimes to a packed stressed tensor.
+    
+#if CHIMES_INSTRUMENT
+    double t_phase = chimes_wtime();
+    double t_now;
+    
+    stats.ncalculate++;
+#endif
+    
+    sys.init(atmtyps, type_list, x_in, y_in, z_in, cella_in, cellb_in, cellc_in, max_2b_cut, allow_replication);   
+    warn_replication(sys);
+    
+    sys.build_layered_system(poly_orders, max_2b_cut, max_3b_cut, max_4b_cut);
+    
+    sys.run_checks({max_2b_cut,max_3b_cut,max_4b_cut},poly_orders);
+
+    build_neigh_lists(atmtyps, x_in, y_in, z_in, cella_in, cellb_in, cellc_in);
+
+#if CHIMES_INSTRUMENT
+    // Ghost atom construction covers the sys and neigh setup; build_neigh_lists times its own list building
+    
+    t_now = chimes_wtime();
+    stats.time[chimesStats::GHOSTS]   += t_now - t_phase - neigh.time_neigh_2b - neigh.time_neigh_mb;
+    stats.time[chimesStats::NEIGH_2B] += neigh.time_neigh_2b;
+    stats.time[chimesStats::NEIGH_MB] += neigh.time_neigh_mb;
+    t_phase = t_now;
+#endif
+    
+    // Setup vars
+    
+    int ii, jj, kk, ll;
+    
+    const bool do_forces = (get_eval_mode() != evalMode::ENERGY);    // Skip gathering per-atom forces if not computed
+    
+    // Per-atom energies and virials, if requested: each cluster contribution is split evenly among its atoms, and 
+    // accumulated for the input atom each atom is a copy of
+    
+    const bool per_atom = (atom_energy != NULL);
+    
+    double energy_order[4] = {0.0, 0.0, 0.0, 0.0};    // 1-, 2- (including penalty), 3-, and 4-body energies
+    
+    energy_penalty = 0.0;
+    
+    double                  energy_cl;
+    int                     atoms_cl[4];
+    
+    if (per_atom)
+    {
+        energy_atoms.assign(x_in.size(), 0.0);
+        stress_atoms.resize(x_in.size());
+        
+        for (int a=0; a<x_in.size(); a++)
+            stress_atoms[a].assign(9, 0.0);
+    }
+    
+    chimes_2btmp.resize(poly_orders[0]);
+    chimes_3btmp.resize(poly_orders[1]);
+    chimes_4btmp.resize(poly_orders[2]);
+    
+    if (use_edge_table)
+        fill_edge_table(0);
+    
+    ////////////////////////
+    // interate over 1- and 2b's 
+    ////////////////////////
+
+    for(int i=0; i<sys.n_atoms; i++)
+    {
+        if (per_atom)
+        {
+            energy_cl = 0.0;
+            compute_1B(sys.sys_atmtyp_indices[i], energy_cl);
+            
+            energy_order[0] += energy_cl;
+            energy_atoms[sys.sys_rep_parent[i]] += energy_cl;
+        }
+        else
+            compute_1B(sys.sys_atmtyp_indices[i], energy_order[0]);
+
+        for(int j=0; j<neighlist_2b[i].size(); j++) // Neighbors of i
+        {
+            jj = neighlist_2b[i][j];
+
+            if (use_edge_table)
+                get_edge(neigh.edge_2b_start[i]+j, dist, dr.data());
+            else
+                dist = sys.get_dist(i,jj,dr); // Populates dr, which is passed by ref (overloaded)
+            
+            typ_idxs_2b[0] = sys.sys_atmtyp_indices[i ];
+            typ_idxs_2b[1] = sys.sys_atmtyp_indices[jj];
+            
+            for (int idx=0; idx<2*CHDIM; idx++) {
+                force_2b[idx] = 0.0 ;
+            }
+            
+            if (per_atom)
+            {
+                energy_cl = 0.0;
+                fill(stress_cl.begin(), stress_cl.end(), 0.0);
+                
+                compute_2B(dist, dr, typ_idxs_2b, force_2b, stress_cl, energy_cl, chimes_2btmp);
+                
+                atoms_cl[0] = i; atoms_cl[1] = jj;
+                
+                tally_per_atom(2, atoms_cl, energy_cl, stress_cl, energy_order[1], stress_chimes, energy_atoms, stress_atoms);
+            }
+            else
+                compute_2B(dist, dr, typ_idxs_2b, force_2b, stress_chimes, energy_order[1], chimes_2btmp);
+
+            if (do_forces)
+            for (int idx=0; idx<3; idx++)
+            {
+                force[sys.sys_rep_parent[i]][idx]                  += force_2b[0*CHDIM+idx] ;
+                force[sys.sys_rep_parent[sys.sys_parent[jj]]][idx] += force_2b[1*CHDIM+idx] ;     
+            }
+        }
+    }
+    
+#if CHIMES_INSTRUMENT
+    t_now = chimes_wtime();
+    stats.time[chimesStats::LOOP_2B] += t_now - t_phase;
+    t_phase = t_now;
+#endif
     
     ////////////////////////
     // interate over 3b's 
     ////////////////////////
     
+    if (cache_edge_polys && ((poly_orders[1] > 0) || (poly_orders[2] > 0)))
+        edge_cache_init();
+    
+    // Queue clusters by type for blocked evaluation, unless per-cluster quantities are needed
+    
+    const bool block_clusters = cache_edge_polys && !per_atom;
+    
     if (poly_orders[1] > 0 )
     {
-        for(int i=0; i<neighlist_3b.size(); i++)
+        const int n_3b = neighlist_3b.size()/3;
+        
+        for(int i=0; i<n_3b; i++)
         {
-            ii = neighlist_3b[i][0];
-            jj = neighlist_3b[i][1];
-            kk = neighlist_3b[i][2];
+            ii = neighlist_3b[3*i+0];
+            jj = neighlist_3b[3*i+1];
+            kk = neighlist_3b[3*i+2];
         
-            dist_3b[0] = sys.get_dist(ii,jj,&dr_3b[0]); 
-            dist_3b[1] = sys.get_dist(ii,kk,&dr_3b[3]); 
-            dist_3b[2] = sys.get_dist(jj,kk,&dr_3b[6]); 
+            if (use_edge_table)
+            {
+                for (int e=0; e<3; e++)
+                    get_edge(neigh.edges_3b[3*i+e], dist_3b[e], &dr_3b[e*CHDIM]);
+            }
+            else
+            {
+                dist_3b[0] = sys.get_dist(ii,jj,&dr_3b[0]); 
+                dist_3b[1] = sys.get_dist(ii,kk,&dr_3b[3]); 
+                dist_3b[2] = sys.get_dist(jj,kk,&dr_3b[6]); 
+            }
         
             typ_idxs_3b[0] = sys.sys_atmtyp_indices[ii];
             typ_idxs_3b[1] = sys.sys_atmtyp_indices[jj];
@@ -1035,61 +1438,159 @@ void serial_chimes_interface::calculate(vector<double> & x_in, vector<double> &
                 force_3b[idx] = 0.0 ;               
             }    
         
-            compute_3B(dist_3b, dr_3b, typ_idxs_3b, force_3b, stress_chimes, energy, chimes_3btmp);
+            atoms_cl[0] = ii; atoms_cl[1] = jj; atoms_cl[2] = kk;
+            
+            if (block_clusters)
+            {
+                queue_cluster(3, atoms_cl, force, stress_chimes, energy_order[2], chimes_3btmp, chimes_4btmp);
+                continue;
+            }
+            
+            if (per_atom)
+            {
+                energy_cl = 0.0;
+                fill(stress_cl.begin(), stress_cl.end(), 0.0);
+                
+                compute_3B_cached(atoms_cl, force_3b, stress_cl, energy_cl, chimes_3btmp);
+                
+                tally_per_atom(3, atoms_cl, energy_cl, stress_cl, energy_order[2], stress_chimes, energy_atoms, stress_atoms);
+            }
+            else
+                compute_3B_cached(atoms_cl, force_3b, stress_chimes, energy_order[2], chimes_3btmp);
 
+            if (do_forces)
             for (int idx=0; idx<3; idx++) {
                 force[sys.sys_rep_parent[sys.sys_parent[ii]]][idx] += force_3b[0*CHDIM+idx] ;
                 force[sys.sys_rep_parent[sys.sys_parent[jj]]][idx] += force_3b[1*CHDIM+idx] ;
                 force[sys.sys_rep_parent[sys.sys_parent[kk]]][idx] += force_3b[2*CHDIM+idx] ;
             }
         }
+        
+        if (block_clusters)
+            flush_queues(3, force, stress_chimes, energy_order[2]);
     }
 
+#if CHIMES_INSTRUMENT
+    t_now = chimes_wtime();
+    stats.time[chimesStats::LOOP_3B] += t_now - t_phase;
+    t_phase = t_now;
+#endif
+
     ////////////////////////
     // interate over 4b's 
     ////////////////////////
 
     if (poly_orders[2] > 0 )
     {
-        for(int i=0; i<neighlist_4b.size(); i++)
+        // With stream_4b, clusters come in tiles from neigh, each complete for its root atoms (as required by the edge
+        // cache); otherwise from neighlist_4b
+        
+        int next_root = 0;
+        int n_edges   = neigh.num_edges();    // Edges of the frame; tiles add their own
+        
+        do
         {
-            ii = neighlist_4b[i][0];
-            jj = neighlist_4b[i][1];
-            kk = neighlist_4b[i][2];
-            ll = neighlist_4b[i][3];
-        
-            dist_4b[0] = sys.get_dist(ii,jj,&dr_4b[0*CHDIM]); 
-            dist_4b[1] = sys.get_dist(ii,kk,&dr_4b[1*CHDIM]); 
-            dist_4b[2] = sys.get_dist(ii,ll,&dr_4b[2*CHDIM]); 
-            dist_4b[3] = sys.get_dist(jj,kk,&dr_4b[3*CHDIM]); 
-            dist_4b[4] = sys.get_dist(jj,ll,&dr_4b[4*CHDIM]); 
-            dist_4b[5] = sys.get_dist(kk,ll,&dr_4b[5*CHDIM]);         
-
-            typ_idxs_4b[0] = sys.sys_atmtyp_indices[ii];
-            typ_idxs_4b[1] = sys.sys_atmtyp_indices[jj];
-            typ_idxs_4b[2] = sys.sys_atmtyp_indices[kk];
-            typ_idxs_4b[3] = sys.sys_atmtyp_indices[ll];        
-        
-            for (int idx=0; idx<4*CHDIM; idx++)
+            if (stream_4b)
             {
-                force_4b[idx] = 0.0 ;
-            }    
+                if (use_edge_table)
+                    neigh.resize_edges(n_edges);
+                
+                next_root = neigh.build_4b_tile(next_root, stream_4b_tile, neighlist_2b, tile_4b, max_4b_cut, this, 0.0, use_edge_table ? &tile_4b_edges : NULL);
+                
+                if (use_edge_table)
+                    fill_edge_table(n_edges);
+            }
         
-            compute_4B(dist_4b, dr_4b, typ_idxs_4b, force_4b, stress_chimes, energy, chimes_4btmp);
-
-            for (int idx=0; idx<3; idx++)
+            const vector<int> & quads = stream_4b ? tile_4b : neighlist_4b;
+            const int           n_4b  = quads.size()/4;
+        
+            for(int i=0; i<n_4b; i++)
             {
-                force[sys.sys_rep_parent[sys.sys_parent[ii]]][idx] += force_4b[0*CHDIM+idx] ;
-                force[sys.sys_rep_parent[sys.sys_parent[jj]]][idx] += force_4b[1*CHDIM+idx] ;
-                force[sys.sys_rep_parent[sys.sys_parent[kk]]][idx] += force_4b[2*CHDIM+idx] ;
-                force[sys.sys_rep_parent[sys.sys_parent[ll]]][idx] += force_4b[3*CHDIM+idx] ;
+                const int * quad = &quads[4*i];
+            
+                ii = quad[0];
+                jj = quad[1];
+                kk = quad[2];
+                ll = quad[3];
+        
+                if (use_edge_table)
+                {
+                    const int * quad_edges = stream_4b ? &tile_4b_edges[6*i] : &neigh.edges_4b[6*i];
+                    
+                    for (int e=0; e<6; e++)
+                        get_edge(quad_edges[e], dist_4b[e], &dr_4b[e*CHDIM]);
+                }
+                else
+                {
+                    dist_4b[0] = sys.get_dist(ii,jj,&dr_4b[0*CHDIM]); 
+                    dist_4b[1] = sys.get_dist(ii,kk,&dr_4b[1*CHDIM]); 
+                    dist_4b[2] = sys.get_dist(ii,ll,&dr_4b[2*CHDIM]); 
+                    dist_4b[3] = sys.get_dist(jj,kk,&dr_4b[3*CHDIM]); 
+                    dist_4b[4] = sys.get_dist(jj,ll,&dr_4b[4*CHDIM]); 
+                    dist_4b[5] = sys.get_dist(kk,ll,&dr_4b[5*CHDIM]);         
+                }
+
+                typ_idxs_4b[0] = sys.sys_atmtyp_indices[ii];
+                typ_idxs_4b[1] = sys.sys_atmtyp_indices[jj];
+                typ_idxs_4b[2] = sys.sys_atmtyp_indices[kk];
+                typ_idxs_4b[3] = sys.sys_atmtyp_indices[ll];        
+        
+                for (int idx=0; idx<4*CHDIM; idx++)
+                {
+                    force_4b[idx] = 0.0 ;
+                }    
+        
+                atoms_cl[0] = ii; atoms_cl[1] = jj; atoms_cl[2] = kk; atoms_cl[3] = ll;
+            
+                if (block_clusters)
+                {
+                    queue_cluster(4, atoms_cl, force, stress_chimes, energy_order[3], chimes_3btmp, chimes_4btmp);
+                    continue;
+                }
+            
+                if (per_atom)
+                {
+                    energy_cl = 0.0;
+                    fill(stress_cl.begin(), stress_cl.end(), 0.0);
+                
+                    compute_4B_cached(atoms_cl, force_4b, stress_cl, energy_cl, chimes_4btmp);
+                
+                    tally_per_atom(4, atoms_cl, energy_cl, stress_cl, energy_order[3], stress_chimes, energy_atoms, stress_atoms);
+                }
+                else
+                    compute_4B_cached(atoms_cl, force_4b, stress_chimes, energy_order[3], chimes_4btmp);
+
+                if (do_forces)
+                for (int idx=0; idx<3; idx++)
+                {
+                    force[sys.sys_rep_parent[sys.sys_parent[ii]]][idx] += force_4b[0*CHDIM+idx] ;
+                    force[sys.sys_rep_parent[sys.sys_parent[jj]]][idx] += force_4b[1*CHDIM+idx] ;
+                    force[sys.sys_rep_parent[sys.sys_parent[kk]]][idx] += force_4b[2*CHDIM+idx] ;
+                    force[sys.sys_rep_parent[sys.sys_parent[ll]]][idx] += force_4b[3*CHDIM+idx] ;
+                }    
             }    
-        }    
+        }
+        while (stream_4b && (next_root < neigh.n_atoms));
+        
+        if (block_clusters)
+            flush_queues(4, force, stress_chimes, energy_order[3]);
     }
 
+#if CHIMES_INSTRUMENT
+    stats.time[chimesStats::LOOP_4B] += chimes_wtime() - t_phase;
+#endif
+
     // Correct for use of replicates, if applicable
     
-    energy /= pow(sys.n_replicates+1.0,3.0);
+    double norm = pow(sys.n_replicates+1.0,3.0);
+    
+    for (int n=0; n<4; n++)
+        energy_terms[n] = energy_order[n] / norm;
+    
+    energy_terms[4]  = energy_penalty / norm;
+    energy_terms[1] -= energy_terms[4];
+    
+    energy += (energy_order[0] + energy_order[1] + energy_order[2] + energy_order[3]) / norm;
    
     ////////////////////////
     // Finish pressure calculation
@@ -1108,14 +1609,682 @@ void serial_chimes_interface::calculate(vector<double> & x_in, vector<double> &
     
     for (int idx=0; idx<9; idx++)
         stress[idx] /= sys.vol;  
+    
+    // Per-atom quantities are normalized like the energy, so that they sum to the energy and to the stress times the 
+    // input cell volume
+    
+    if (per_atom)
+    {
+        atom_energy->resize(x_in.size(), 0.0);
+        if (atom_stress->size() != x_in.size())
+            atom_stress->resize(x_in.size(), vector<double>(9,0.0));
+        
+        for (int a=0; a<x_in.size(); a++)
+        {
+            (*atom_energy)[a] += energy_atoms[a] / norm;
+            
+            (*atom_stress)[a].resize(9, 0.0);
+            
+            for (int idx=0; idx<9; idx++)
+                (*atom_stress)[a][idx] += stress_atoms[a][idx] / norm;
+        }
+    }
 }
 
+void serial_chimes_interface::tally_per_atom(int natoms, const int * atoms, double energy_cl, const vector<double> & stress_cl, double & energy, vector<double> & stress, vector<double> & energy_atoms, vector<vector<double> > & stress_atoms)
+{
+    // Adds the energy and (packed) stress of one cluster to the totals, and an even share of them to each of its 
+    // atoms (expanded to 9 components)
+    
+    energy += energy_cl;
+    
+    for (int idx=0; idx<6; idx++)
+        stress[idx] += stress_cl[idx];
+    
+    const int unpack[9] = {0, 1, 2, 1, 3, 4, 2, 4, 5};
+    
+    for (int a=0; a<natoms; a++)
+    {
+        int parent = sys.sys_rep_parent[sys.sys_parent[atoms[a]]];
+        
+        energy_atoms[parent] += energy_cl / natoms;
+        
+        for (int idx=0; idx<9; idx++)
+            stress_atoms[parent][idx] += stress_cl[unpack[idx]] / natoms;
+    }
+}
 
+void serial_chimes_interface::edge_cache_init()
+{
+    // Size the cache for the current neighbor lists: all atoms of a cluster are its root or neighbors of the root
+    
+    edge_nslots = 4;
+    
+    for (int i=0; i<sys.n_atoms; i++)
+        if (neighlist_2b[i].size() + 1 > edge_nslots)
+            edge_nslots = neighlist_2b[i].size() + 1;
+    
+    edge_slot.assign(sys.n_ghost, -1);
+    edge_slot_atoms.clear();
+    edge_poly_idx.assign(edge_nslots*edge_nslots*get_num_edge_variants(), -1);
+    edge_poly_set.clear();
+    edge_polys.clear();
+    
+    edge_root = -1;
+    
+    queue_3b.resize(natmtyps*natmtyps*natmtyps);
+    queue_4b.resize(natmtyps*natmtyps*natmtyps*natmtyps);
+    
+    for (int q=0; q<queue_3b.size(); q++)
+        queue_3b[q].n = 0;
+    for (int q=0; q<queue_4b.size(); q++)
+        queue_4b[q].n = 0;
+}
 
+bool serial_chimes_interface::edge_cache_stale(int root, int natoms)
+{
+    // True when moving on to the clusters of a new root, or if the natoms atoms of the next cluster may not fit
+    
+    return (root != edge_root) || (edge_slot_atoms.size() + natoms > edge_nslots);
+}
 
+void serial_chimes_interface::edge_cache_root(int root, int natoms)
+{
+    // Drop the cached edges if stale
+    
+    if (!edge_cache_stale(root, natoms))
+        return;
+    
+    for (int a=0; a<edge_slot_atoms.size(); a++)
+        edge_slot[edge_slot_atoms[a]] = -1;
+    
+    for (int e=0; e<edge_poly_set.size(); e++)
+        edge_poly_idx[edge_poly_set[e]] = -1;
+    
+    edge_slot_atoms.clear();
+    edge_poly_set.clear();
+    edge_polys.clear();
+    
+    edge_root = root;
+}
 
+int serial_chimes_interface::edge_cache_find(int a, int b, int variant, double dx)
+{
+    // Offset of the polynomials of edge a-b (of length dx) in edge_polys, computed if not cached yet
+    
+    int slot[2] = {a, b};
+    
+    for (int n=0; n<2; n++)
+    {
+        if (edge_slot[slot[n]] < 0)
+        {
+            edge_slot[slot[n]] = edge_slot_atoms.size();
+            edge_slot_atoms.push_back(slot[n]);
+        }
+        slot[n] = edge_slot[slot[n]];
+    }
+    
+    if (slot[0] > slot[1])
+        swap(slot[0], slot[1]);
+    
+    int idx = (slot[0]*edge_nslots + slot[1])*get_num_edge_variants() + variant;
+    
+    if (edge_poly_idx[idx] < 0)
+    {
+        int offset = edge_polys.size();
+        int npows  = get_edge_variant_order(variant) + 1;
+        
+        edge_polys.resize(offset + 2*npows);
+        
+        set_edge_polys(variant, dx, &edge_polys[offset], &edge_polys[offset + npows]);
+        
+        edge_poly_idx[idx] = offset;
+        edge_poly_set.push_back(idx);
+    }
+    
+    return edge_poly_idx[idx];
+}
 
+void serial_chimes_interface::compute_3B_cached(const int * atoms, vector<double> & force, vector<double> & stress, double & energy, chimes3BTmp & tmp)
+{
+    // compute_3B for the cluster in dist_3b/dr_3b/typ_idxs_3b, reading the edge polynomials from the cache if enabled
+    
+    if (!cache_edge_polys || !cluster_within_3B(dist_3b.data(), typ_idxs_3b.data()))
+    {
+        compute_3B(dist_3b, dr_3b, typ_idxs_3b, force, stress, energy, tmp);
+        return;
+    }
+    
+    const int edges[3][2] = {{0,1}, {0,2}, {1,2}};    // ij, ik, jk
+    
+    int           variant[3], offset[3];
+    const double *G[3], *dG[3];
+    
+    edge_cache_root(atoms[0], 3);
+    
+    for (int e=0; e<3; e++)
+    {
+        variant[e] = get_edge_variant_3B(typ_idxs_3b.data(), e);
+        offset [e] = edge_cache_find(atoms[edges[e][0]], atoms[edges[e][1]], variant[e], dist_3b[e]);
+    }
+    
+    for (int e=0; e<3; e++)
+    {
+        G [e] = &edge_polys[offset[e]];
+        dG[e] = G[e] + get_edge_variant_order(variant[e]) + 1;
+    }
+    
+    compute_3B_edges(dist_3b, dr_3b, typ_idxs_3b, G, dG, force, stress, energy, force_scalar_mb);
+}
+
+void serial_chimes_interface::compute_4B_cached(const int * atoms, vector<double> & force, vector<double> & stress, double & energy, chimes4BTmp & tmp)
+{
+    // As compute_3B_cached, for the cluster in dist_4b/dr_4b/typ_idxs_4b
+    
+    if (!cache_edge_polys || !cluster_within_4B(dist_4b.data(), typ_idxs_4b.data()))
+    {
+        compute_4B(dist_4b, dr_4b, typ_idxs_4b, force, stress, energy, tmp);
+        return;
+    }
+    
+    const int edges[6][2] = {{0,1}, {0,2}, {0,3}, {1,2}, {1,3}, {2,3}};    // ij, ik, il, jk, jl, kl
+    
+    int           variant[6], offset[6];
+    const double *G[6], *dG[6];
+    
+    edge_cache_root(atoms[0], 4);
+    
+    for (int e=0; e<6; e++)
+    {
+        variant[e] = get_edge_variant_4B(typ_idxs_4b.data(), e);
+        offset [e] = edge_cache_find(atoms[edges[e][0]], atoms[edges[e][1]], variant[e], dist_4b[e]);
+    }
+    
+    for (int e=0; e<6; e++)
+    {
+        G [e] = &edge_polys[offset[e]];
+        dG[e] = G[e] + get_edge_variant_order(variant[e]) + 1;
+    }
+    
+    compute_4B_edges(dist_4b, dr_4b, typ_idxs_4b, G, dG, force, stress, energy, force_scalar_mb);
+}
+
+void serial_chimes_interface::queue_cluster(int natoms, const int * atoms, vector<vector<double> > & force, vector<double> & stress, double & energy, chimes3BTmp & tmp_3b, chimes4BTmp & tmp_4b)
+{
+    // Queue the cluster in dist_XB/dr_XB/typ_idxs_XB for blocked evaluation. Clusters that compute_XB would skip are 
+    // passed to it directly, for the call statistics.
+    
+    const int         npairs   = natoms*(natoms-1)/2;
+    const int         max_n    = 4*CHIMES_BLOCK;    // Queued clusters per type before the queue is flushed
+    const int         edges[6][2] = {{0,1}, {0,2}, {0,3}, {1,2}, {1,3}, {2,3}};    // ij, ik, (il,) jk, (jl, kl)
+    
+    vector<double>  & dist     = (natoms == 3) ? dist_3b     : dist_4b;
+    vector<double>  & dr_cl    = (natoms == 3) ? dr_3b       : dr_4b;
+    vector<int>     & typ_idxs = (natoms == 3) ? typ_idxs_3b : typ_idxs_4b;
+    
+    bool within = (natoms == 3) ? cluster_within_3B(dist.data(), typ_idxs.data()) : cluster_within_4B(dist.data(), typ_idxs.data());
+    
+    if (!within)
+    {
+        block_force.assign(natoms*CHDIM, 0.0);
+        
+        if (natoms == 3)
+            compute_3B(dist, dr_cl, typ_idxs, block_force, stress, energy, tmp_3b);
+        else
+            compute_4B(dist, dr_cl, typ_idxs, block_force, stress, energy, tmp_4b);
+        
+        return;
+    }
+    
+    if (edge_cache_stale(atoms[0], natoms))
+    {
+        flush_queues(natoms, force, stress, energy);
+        edge_cache_root(atoms[0], natoms);
+    }
+    
+    int type_idx = 0;
+    
+    for (int a=0; a<natoms; a++)
+        type_idx = type_idx*natmtyps + typ_idxs[a];
+    
+    cluster_queue & queue = (natoms == 3) ? queue_3b[type_idx] : queue_4b[type_idx];
+    
+    if (queue.n == 0)
+    {
+        queue.atoms  .resize(max_n*natoms);
+        queue.offsets.resize(max_n*npairs*2);
+        queue.dx     .resize(max_n*npairs);
+        queue.dr     .resize(max_n*npairs*CHDIM);
+        
+        for (int a=0; a<natoms; a++)
+            queue.typ[a] = typ_idxs[a];
+    }
+    
+    const int c = queue.n;
+    
+    for (int a=0; a<natoms; a++)
+        queue.atoms[c*natoms+a] = atoms[a];
+    
+    for (int e=0; e<npairs; e++)
+    {
+        // Map the pair index in the 3-body ordering (ij, ik, jk) to the 4-body pair list above
+        
+        const int ep      = (natoms == 3 && e == 2) ? 3 : e;
+        const int variant = (natoms == 3) ? get_edge_variant_3B(typ_idxs.data(), e) : get_edge_variant_4B(typ_idxs.data(), e);
+        const int offset  = edge_cache_find(atoms[edges[ep][0]], atoms[edges[ep][1]], variant, dist[e]);
+        
+        queue.offsets[(c*npairs+e)*2+0] = offset;
+        queue.offsets[(c*npairs+e)*2+1] = offset + get_edge_variant_order(variant) + 1;
+        
+        queue.dx[c*npairs+e] = dist[e];
+        
+        for (int d=0; d<CHDIM; d++)
+            queue.dr[(c*npairs+e)*CHDIM+d] = dr_cl[e*CHDIM+d];
+    }
+    
+    queue.n++;
+    
+    if (queue.n == max_n)
+        flush_queue(natoms, queue, force, stress, energy);
+}
+
+void serial_chimes_interface::flush_queue(int natoms, cluster_queue & queue, vector<vector<double> > & force, vector<double> & stress, double & energy)
+{
+    // Evaluate the queued clusters as a block, and add their forces to the input atoms they are copies of
+    
+    if (queue.n == 0)
+        return;
+    
+    const int npairs = natoms*(natoms-1)/2;
+    const int n      = queue.n;
+    
+    block_G .resize(n*npairs);
+    block_dG.resize(n*npairs);
+    
+    for (int e=0; e<n*npairs; e++)
+    {
+        block_G [e] = &edge_polys[ queue.offsets[2*e+0] ];
+        block_dG[e] = &edge_polys[ queue.offsets[2*e+1] ];
+    }
+    
+    block_force.assign(n*natoms*CHDIM, 0.0);
+    
+    if (natoms == 3)
+        compute_3B_block(n, queue.typ, block_G.data(), block_dG.data(), queue.dx.data(), queue.dr.data(), block_force.data(), stress.data(), energy, block_tmp);
+    else
+        compute_4B_block(n, queue.typ, block_G.data(), block_dG.data(), queue.dx.data(), queue.dr.data(), block_force.data(), stress.data(), energy, block_tmp);
+    
+    if (get_eval_mode() != evalMode::ENERGY)
+    for (int c=0; c<n; c++)
+        for (int a=0; a<natoms; a++)
+        {
+            vector<double> & f = force[ sys.sys_rep_parent[ sys.sys_parent[ queue.atoms[c*natoms+a] ] ] ];
+            
+            for (int d=0; d<CHDIM; d++)
+                f[d] += block_force[(c*natoms+a)*CHDIM+d];
+        }
+    
+    queue.n = 0;
+}
+
+void serial_chimes_interface::flush_queues(int natoms, vector<vector<double> > & force, vector<double> & stress, double & energy)
+{
+    vector<cluster_queue> & queues = (natoms == 3) ? queue_3b : queue_4b;
+    
+    for (int q=0; q<queues.size(); q++)
+        flush_queue(natoms, queues[q], force, stress, energy);
+}
+
+void serial_chimes_interface::calculate(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy)
+{
+    // Energy-only calculation, e.g. for Monte Carlo or screening: polynomial derivatives, forces and the stress 
+    // are skipped altogether. The evaluation mode is restored on return.
+    
+    evalMode mode = get_eval_mode();
+    
+    vector<vector<double> > force;
+    vector<double>          stress(9,0.0);
+    
+    set_eval_mode(evalMode::ENERGY);
+    
+    calculate(x_in, y_in, z_in, cella_in, cellb_in, cellc_in, atmtyps, energy, force, stress);
+    
+    set_eval_mode(mode);
+}
+
+void serial_chimes_interface::get_energy_terms(vector<double> & terms)
+{
+    terms.assign(energy_terms, energy_terms+5);
+}
+
+void serial_chimes_interface::mc_init(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy)
+{
+    // Store the system, build the padded neighbor lists, and add the energy of the system to energy
+    
+    if ((x_in.size() != y_in.size()) || (x_in.size() != z_in.size()) || (x_in.size() != atmtyps.size()))
+    {
+        cout << "ERROR: mc_init: coordinate and atom type vector lengths do not match!" << endl;
+        exit(0);
+    }
+    if (mc_skin < 0.0)
+    {
+        cout << "ERROR: mc_init: mc_skin must be non-negative. Received: " << mc_skin << endl;
+        exit(0);
+    }
+    
+    mc_x = x_in;
+    mc_y = y_in;
+    mc_z = z_in;
+    
+    mc_cella = cella_in;
+    mc_cellb = cellb_in;
+    mc_cellc = cellc_in;
+    
+    mc_atmtyps = atmtyps;
+    
+    mc_trial_atom = -1;
+    
+    mc_force .resize(4*CHDIM);
+    mc_stress.resize(6);
+    
+    mc_2btmp.resize(poly_orders[0]);
+    mc_3btmp.resize(poly_orders[1]);
+    mc_4btmp.resize(poly_orders[2]);
+    
+    mc_build();
+    
+    energy += mc_total_energy();
+}
+
+void serial_chimes_interface::mc_build()
+{
+    // Rebuild the real+ghost system and the neighbor lists at the current coordinates, with cutoffs padded by mc_skin,
+    // then index the list entries by the input atoms they involve
+    
+    double cut_2b = max_cutoff_2B(true);
+    double cut_3b = max_cutoff_3B(true);
+    double cut_4b = max_cutoff_4B(true);
+    
+    simulation_system nbr;
+    
+    mc_sys.init(mc_atmtyps, type_list, mc_x, mc_y, mc_z, mc_cella, mc_cellb, mc_cellc, cut_2b, allow_replication);
+    warn_replication(mc_sys);
+    mc_sys.build_layered_system(poly_orders, cut_2b+mc_skin, cut_3b+mc_skin, cut_4b+mc_skin);
+    mc_sys.run_checks({cut_2b+mc_skin, cut_3b+mc_skin, cut_4b+mc_skin}, poly_orders);
+    
+    nbr.init(mc_atmtyps, type_list, mc_x, mc_y, mc_z, mc_cella, mc_cellb, mc_cellc, cut_2b, allow_replication);
+    nbr.reorient();
+    nbr.build_layered_system(poly_orders, cut_2b+mc_skin, cut_3b+mc_skin, cut_4b+mc_skin);
+    
+    vector<vector<int> > neighlist_2b;
+    
+    nbr.build_neigh_lists(poly_orders, neighlist_2b, mc_neighlist_3b, mc_neighlist_4b, cut_2b+mc_skin, cut_3b+mc_skin, cut_4b+mc_skin, this, mc_skin);
+    
+    mc_neighlist_2b.resize(0);
+    
+    for (int i=0; i<mc_sys.n_atoms; i++)
+        for (int j=0; j<neighlist_2b[i].size(); j++)
+        {
+            mc_neighlist_2b.push_back(i);
+            mc_neighlist_2b.push_back(neighlist_2b[i][j]);
+        }
+    
+    // Index everything by input atom
+    
+    int natoms = mc_x.size();
+    
+    vector<int> root(mc_sys.n_ghost);    // Input atom that each real/ghost atom is a copy of
+    
+    mc_images.assign(natoms, vector<int>());
+    
+    for (int i=0; i<mc_sys.n_ghost; i++)
+    {
+        root[i] = mc_sys.sys_rep_parent[mc_sys.sys_parent[i]];
+        mc_images[root[i]].push_back(i);
+    }
+    
+    mc_pairs.assign(natoms, vector<int>());
+    mc_trips.assign(natoms, vector<int>());
+    mc_quads.assign(natoms, vector<int>());
+    
+    vector<int>          * lists  [3] = {&mc_neighlist_2b, &mc_neighlist_3b, &mc_neighlist_4b};
+    vector<vector<int> > * entries[3] = {&mc_pairs,        &mc_trips,        &mc_quads       };
+    
+    for (int n=0; n<3; n++)
+    {
+        const int natoms_cl = n+2;
+        
+        for (int idx=0; idx<lists[n]->size()/natoms_cl; idx++)
+        {
+            const int * atoms = &(*lists[n])[natoms_cl*idx];
+            
+            for (int a=0; a<natoms_cl; a++)
+            {
+                vector<int> & atom_entries = (*entries[n])[ root[atoms[a]] ];
+                
+                // Entries with several copies of the same atom are only indexed once
+                
+                if (atom_entries.empty() || (atom_entries.back() != idx))
+                    atom_entries.push_back(idx);
+            }
+        }
+    }
+    
+    mc_x_ref = mc_x;
+    mc_y_ref = mc_y;
+    mc_z_ref = mc_z;
+}
 
+void serial_chimes_interface::mc_move(int atom, double dx, double dy, double dz)
+{
+    // Displace all copies of atom
+    
+    for (int i=0; i<mc_images[atom].size(); i++)
+    {
+        mc_sys.sys_x[ mc_images[atom][i] ] += dx;
+        mc_sys.sys_y[ mc_images[atom][i] ] += dy;
+        mc_sys.sys_z[ mc_images[atom][i] ] += dz;
+    }
+}
 
+void serial_chimes_interface::mc_add_2b(int idx, double & energy)
+{
+    int i  = mc_neighlist_2b[2*idx+0];
+    int jj = mc_neighlist_2b[2*idx+1];
+    
+    dist = mc_sys.get_dist(i,jj,dr);
+    
+    typ_idxs_2b[0] = mc_sys.sys_atmtyp_indices[i ];
+    typ_idxs_2b[1] = mc_sys.sys_atmtyp_indices[jj];
+    
+    compute_2B(dist, dr, typ_idxs_2b, mc_force, mc_stress, energy, mc_2btmp);
+}
+
+void serial_chimes_interface::mc_add_3b(int idx, double & energy)
+{
+    int ii = mc_neighlist_3b[3*idx+0];
+    int jj = mc_neighlist_3b[3*idx+1];
+    int kk = mc_neighlist_3b[3*idx+2];
+    
+    dist_3b[0] = mc_sys.get_dist(ii,jj,&dr_3b[0]); 
+    dist_3b[1] = mc_sys.get_dist(ii,kk,&dr_3b[3]); 
+    dist_3b[2] = mc_sys.get_dist(jj,kk,&dr_3b[6]); 
+
+    typ_idxs_3b[0] = mc_sys.sys_atmtyp_indices[ii];
+    typ_idxs_3b[1] = mc_sys.sys_atmtyp_indices[jj];
+    typ_idxs_3b[2] = mc_sys.sys_atmtyp_indices[kk];
+    
+    compute_3B(dist_3b, dr_3b, typ_idxs_3b, mc_force, mc_stress, energy, mc_3btmp);
+}
+
+void serial_chimes_interface::mc_add_4b(int idx, double & energy)
+{
+    int ii = mc_neighlist_4b[4*idx+0];
+    int jj = mc_neighlist_4b[4*idx+1];
+    int kk = mc_neighlist_4b[4*idx+2];
+    int ll = mc_neighlist_4b[4*idx+3];
+    
+    dist_4b[0] = mc_sys.get_dist(ii,jj,&dr_4b[0*CHDIM]); 
+    dist_4b[1] = mc_sys.get_dist(ii,kk,&dr_4b[1*CHDIM]); 
+    dist_4b[2] = mc_sys.get_dist(ii,ll,&dr_4b[2*CHDIM]); 
+    dist_4b[3] = mc_sys.get_dist(jj,kk,&dr_4b[3*CHDIM]); 
+    dist_4b[4] = mc_sys.get_dist(jj,ll,&dr_4b[4*CHDIM]); 
+    dist_4b[5] = mc_sys.get_dist(kk,ll,&dr_4b[5*CHDIM]);         
+
+    typ_idxs_4b[0] = mc_sys.sys_atmtyp_indices[ii];
+    typ_idxs_4b[1] = mc_sys.sys_atmtyp_indices[jj];
+    typ_idxs_4b[2] = mc_sys.sys_atmtyp_indices[kk];
+    typ_idxs_4b[3] = mc_sys.sys_atmtyp_indices[ll];        
+    
+    compute_4B(dist_4b, dr_4b, typ_idxs_4b, mc_force, mc_stress, energy, mc_4btmp);
+}
 
+double serial_chimes_interface::mc_local_energy(int atom)
+{
+    if ((atom < 0) || (atom >= mc_images.size()))
+    {
+        cout << "ERROR: Monte Carlo atom index out of range (call mc_init first?): " << atom << endl;
+        exit(0);
+    }
+    
+    evalMode mode = get_eval_mode();
+    
+    set_eval_mode(evalMode::ENERGY);
+    
+    double energy = 0.0;
+    
+    for (int i=0; i<mc_images[atom].size(); i++)
+        if (mc_images[atom][i] < mc_sys.n_atoms)    // Replicates count as real atoms
+            compute_1B(mc_sys.sys_atmtyp_indices[ mc_images[atom][i] ], energy);
+    
+    for (int i=0; i<mc_pairs[atom].size(); i++)
+        mc_add_2b(mc_pairs[atom][i], energy);
+    
+    for (int i=0; i<mc_trips[atom].size(); i++)
+        mc_add_3b(mc_trips[atom][i], energy);
+    
+    for (int i=0; i<mc_quads[atom].size(); i++)
+        mc_add_4b(mc_quads[atom][i], energy);
+    
+    set_eval_mode(mode);
+    
+    return energy / pow(mc_sys.n_replicates+1.0,3.0);
+}
 
+double serial_chimes_interface::mc_total_energy()
+{
+    evalMode mode = get_eval_mode();
+    
+    set_eval_mode(evalMode::ENERGY);
+    
+    double energy = 0.0;
+    
+    for (int i=0; i<mc_sys.n_atoms; i++)
+        compute_1B(mc_sys.sys_atmtyp_indices[i], energy);
+    
+    for (int i=0; i<mc_neighlist_2b.size()/2; i++)
+        mc_add_2b(i, energy);
+    
+    for (int i=0; i<mc_neighlist_3b.size()/3; i++)
+        mc_add_3b(i, energy);
+    
+    for (int i=0; i<mc_neighlist_4b.size()/4; i++)
+        mc_add_4b(i, energy);
+    
+    set_eval_mode(mode);
+    
+    return energy / pow(mc_sys.n_replicates+1.0,3.0);
+}
+
+double serial_chimes_interface::mc_delta_energy(int atom, double dx, double dy, double dz)
+{
+    // Move atom on trial and return the resulting change in energy
+    
+    if (mc_trial_atom >= 0)
+    {
+        cout << "ERROR: mc_delta_energy: accept or reject the pending trial move first" << endl;
+        exit(0);
+    }
+    if ((atom < 0) || (atom >= mc_images.size()))
+    {
+        cout << "ERROR: Monte Carlo atom index out of range (call mc_init first?): " << atom << endl;
+        exit(0);
+    }
+    
+    // The lists hold all interactions as long as no atom has moved by more than mc_skin/2 since they were built
+    
+    double disp[3] = {mc_x[atom] + dx - mc_x_ref[atom], mc_y[atom] + dy - mc_y_ref[atom], mc_z[atom] + dz - mc_z_ref[atom]};
+    
+    if (sqrt(disp[0]*disp[0] + disp[1]*disp[1] + disp[2]*disp[2]) > 0.5*mc_skin)
+    {
+        if (sqrt(dx*dx + dy*dy + dz*dz) > 0.5*mc_skin)
+        {
+            cout << "ERROR: mc_delta_energy: displacements may not exceed mc_skin/2 (" << 0.5*mc_skin << " Angstrom)" << endl;
+            exit(0);
+        }
+        
+        mc_build();
+    }
+    
+    double e_old = mc_local_energy(atom);
+    
+    mc_trial_old.resize(3*mc_images[atom].size());
+    
+    for (int i=0; i<mc_images[atom].size(); i++)
+    {
+        mc_trial_old[3*i+0] = mc_sys.sys_x[ mc_images[atom][i] ];
+        mc_trial_old[3*i+1] = mc_sys.sys_y[ mc_images[atom][i] ];
+        mc_trial_old[3*i+2] = mc_sys.sys_z[ mc_images[atom][i] ];
+    }
+    
+    mc_move(atom, dx, dy, dz);
+    
+    mc_trial_atom    = atom;
+    mc_trial_disp[0] = dx;
+    mc_trial_disp[1] = dy;
+    mc_trial_disp[2] = dz;
+    
+    return mc_local_energy(atom) - e_old;
+}
+
+void serial_chimes_interface::mc_accept()
+{
+    if (mc_trial_atom < 0)
+    {
+        cout << "ERROR: mc_accept: no pending trial move" << endl;
+        exit(0);
+    }
+    
+    mc_x[mc_trial_atom] += mc_trial_disp[0];
+    mc_y[mc_trial_atom] += mc_trial_disp[1];
+    mc_z[mc_trial_atom] += mc_trial_disp[2];
+    
+    mc_trial_atom = -1;
+}
+
+void serial_chimes_interface::mc_reject()
+{
+    if (mc_trial_atom < 0)
+    {
+        cout << "ERROR: mc_reject: no pending trial move" << endl;
+        exit(0);
+    }
+    
+    for (int i=0; i<mc_images[mc_trial_atom].size(); i++)
+    {
+        mc_sys.sys_x[ mc_images[mc_trial_atom][i] ] = mc_trial_old[3*i+0];
+        mc_sys.sys_y[ mc_images[mc_trial_atom][i] ] = mc_trial_old[3*i+1];
+        mc_sys.sys_z[ mc_images[mc_trial_atom][i] ] = mc_trial_old[3*i+2];
+    }
+    
+    mc_trial_atom = -1;
+}
+
+void serial_chimes_interface::mc_get_coords(vector<double> & x_out, vector<double> & y_out, vector<double> & z_out)
+{
+    // Current coordinates, as input to mc_init plus all accepted moves (i.e. not wrapped)
+    
+    x_out = mc_x;
+    y_out = mc_y;
+    z_out = mc_z;
+}
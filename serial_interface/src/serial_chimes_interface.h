@@ -14,6 +14,13 @@ Notes: This class has been written for readability rather than speed.
 Optimization and parallel distribution is recommended prior to use with 
 large systems.
 
+Thread safety: all mutable state (work buffers, neighbor lists, counters,
+warnings issued) is held by the instance, so distinct instances may be 
+used concurrently from different threads, e.g. one thread per instance 
+evaluating its own frames. A single instance must not be used by several
+threads at once. Diagnostics printed to cout by concurrent instances may
+interleave.
+
 ---------------------------------------------------------------------- */
 
 #ifndef _serial_chimes_interface_h
@@ -37,13 +44,42 @@ class simulation_system
         inline double get_dist(int i,int j, double* rij);   
         inline double get_dist(int i,int j);
         
-        void init(vector<string> & atmtyps, vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, double max_2b_cut, bool small = false);
-        void set_atomtyp_indices(vector<string> & type_list);
+        // Copies (and if small, replicates) the system. Chemical symbols are resolved to their index in type_list for 
+        // the input atoms only; replicate and ghost atoms carry integer type and parent indices.
+        
+        void init(const vector<string> & atmtyps, const vector<string> & type_list, vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, double max_2b_cut, bool small = false);
         void copy(simulation_system & to);
         void reorient();
-        void build_layered_system(vector<string> & atmtyps, vector<int> & poly_orders, double max_2b_cut, double max_3b_cut, double max_4b_cut);
-        void build_neigh_lists(vector<int> & poly_orders, vector<vector<int> > & neighlist_2b, vector<vector<int> > & neighlist_3b, vector<vector<int> > & neighlist_4b, double max_2b_cut, double max_3b_cut, double max_4b_cut);
-        void run_checks(const vector<double>& max_cuts, vector<int>&poly_orders);
+        void build_layered_system(vector<int> & poly_orders, double max_2b_cut, double max_3b_cut, double max_4b_cut);
+        
+        // The 3- and 4-body lists are flat, [cluster][atom]. If ff is given, they only hold clusters that ff would evaluate (see chimesFF::cluster_within_3B),
+        // with all cutoffs padded by skin. The max_*_cut arguments are used as given. With build_4b false, the 4-body list
+        // is left empty (see build_4b_tile).
+        
+        void build_neigh_lists(vector<int> & poly_orders, vector<vector<int> > & neighlist_2b, vector<int> & neighlist_3b, vector<int> & neighlist_4b, double max_2b_cut, double max_3b_cut, double max_4b_cut, chimesFF * ff = NULL, double skin = 0.0, bool build_4b = true);
+        
+        // Enumerates the 4-body clusters of build_neigh_lists for the real atoms from root on, appending them to quads 
+        // ([cluster][atom], cleared first) until it holds at least max_quads clusters or all atoms are done. Clusters of
+        // a root atom are never split across calls. Returns the first root atom not done (n_atoms once all are).
+        
+        int  build_4b_tile(int root, int max_quads, const vector<vector<int> > & neighlist_2b, vector<int> & quads, double max_4b_cut, chimesFF * ff = NULL, double skin = 0.0, vector<int> * quad_edges = NULL);
+        
+        // Edge table. If build_edges is set, build_neigh_lists also numbers the distinct atom pairs (edges) of all pairs 
+        // and clusters, so that their distances can be computed once per frame and looked up by index. The pairs 
+        // (i, neighlist_2b[i][j]) come first, in list order, followed by the other cluster edges. Cluster edges are 
+        // listed in the order of the compute_XB distances (ij, ik, jk and ij, ik, il, jk, jl, kl), and are stored as 
+        // ~edge if the cluster visits the edge atoms in reverse order (i.e. the displacement must be negated). 
+        // build_4b_tile adds the edges of its clusters to the table (to be dropped with resize_edges).
+        
+        bool           build_edges;
+        vector<int>    edge_atoms;       // [edge][a, b]
+        vector<int>    edge_2b_start;    // [real atom]; edge of pair (i, neighlist_2b[i][j]) is edge_2b_start[i] + j
+        vector<int>    edges_3b;         // [cluster][3]; edges of the neighlist_3b clusters
+        vector<int>    edges_4b;         // [cluster][6]; edges of the neighlist_4b clusters
+        
+        int  num_edges() { return edge_atoms.size()/2; }
+        void resize_edges(int n_edges) { edge_atoms.resize(2*n_edges); }
+        void run_checks(const double (&max_cuts)[3], vector<int>&poly_orders);
         
         
         bool allow_replication; // If true, replicates coordinates prior to calculation
@@ -57,7 +93,6 @@ class simulation_system
 		double max_cut;
 
         vector<int>       sys_atmtyp_indices;   // Atom type indices for all (real+ghost) atoms        
-        vector<string>    sys_atmtyps;          // Chemical symbols for all (real+ghost) atoms      
     
         vector<double> sys_x;          // System (i.e. ghost+real) x-coordinates
         vector<double> sys_y;          // System (i.e. ghost+real) y-coordinates
@@ -67,8 +102,33 @@ class simulation_system
        
         double         vol;         // System volume    
         
+        double time_neigh_2b;       // Wall time (s) of the last build_neigh_lists call spent on the 2b list (when instrumented)
+        double time_neigh_mb;       // ... and on the 3b/4b lists
+        
     private: 
         
+        // Appends to quads the 4-body clusters (i, jj, kk, l) for all l in nlist, given dist_4b[0,1,3] (ij, ik, jk)
+        
+        void add_4mers(int i, int j, int k, double * dist_4b, const vector<int> & nlist, double max_4b_cut, chimesFF * ff, double skin, vector<int> & quads, vector<int> * quad_edges);
+        
+        // Edges between the neighbors of the current root atom (see build_edges), [slot a*edge_nslots + slot b] with slot
+        // 0 the root and slot j+1 its neighbor j; -1 if not yet numbered
+        
+        vector<int>       root_edge;
+        vector<int>       root_edge_set;
+        int               root_edge_nslots;
+        
+        // Neighbor bins of build_neigh_lists, kept so that their storage is reused: the atoms of bin b are 
+        // bin_atoms[bin_start[b]] to bin_atoms[bin_start[b+1]-1]
+        
+        vector<int>       bin_start;
+        vector<int>       bin_next;
+        vector<int>       bin_atoms;
+        vector<int>       atom_bin;     // [real/ghost atom]; its bin
+        
+        void        edge_root(int i, const vector<int> & nlist);
+        inline int  find_edge(int i, const vector<int> & nlist, int sa, int sb);
+        
         vector<double>    hmat;        // System h-matrix
         vector<double>    invr_hmat;   // Inverse h-matrix
         
@@ -89,6 +149,20 @@ class simulation_system
         double extent_z;    // Length of projection of the rotated cell c onto the z axis   
 };
 
+// Clusters of one type (ordered atom types) queued by serial_chimes_interface for blocked evaluation
+
+class cluster_queue
+{
+    public:
+        
+        int               n;          // Number of queued clusters
+        int               typ[4];     // Atom types of the clusters
+        vector<int>       atoms;      // [cluster][atom]
+        vector<int>       offsets;    // [cluster][edge][G, dG]; offsets of the edge polynomials in the edge cache
+        vector<double>    dx;         // [cluster][edge]
+        vector<double>    dr;         // [cluster][edge][x,y,z]
+};
+
 
 class serial_chimes_interface : public chimesFF
 {
@@ -101,12 +175,70 @@ class serial_chimes_interface : public chimesFF
            
         void    init_chimesFF(string chimesFF_paramfile, int rank);
         void    calculate(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy, vector<vector<double> > & force, vector<double> & stress);
+        void    calculate(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy);    // Energy only
+        
+        // As calculate, also adding per-atom energies ([atom]) and virials ([atom][s_xx, s_xy, ..., s_zz]) to atom_energy 
+        // and atom_stress (resized to the number of atoms if needed). Each interaction is split evenly among its atoms. 
+        // The per-atom energies sum to the system energy, and the per-atom virials sum to stress times the cell volume.
+        
+        void    calculate(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy, vector<vector<double> > & force, vector<double> & stress, vector<double> & atom_energy, vector<vector<double> > & atom_stress);
+        
+        // 1-, 2-, 3- and 4-body and penalty energies of the last calculate call. The 2-body energy excludes the penalty,
+        // so the terms sum to the energy computed by that call.
+        
+        void    get_energy_terms(vector<double> & terms);
+        
+        // If true (the default), calculate evaluates the smoothed 3- and 4-body polynomials of each edge once for all 
+        // clusters built around the same atom that share it, instead of once per cluster (see chimesFF::set_edge_polys).
+        // Unless per-atom quantities are requested, clusters are then also queued by type and evaluated in blocks (see
+        // chimesFF::compute_3B_block).
+        
+        bool    cache_edge_polys;
+        
+        // If true, calculate does not store the 4-body neighbor list. 4-body clusters are instead enumerated in tiles of
+        // about stream_4b_tile clusters, each of which is evaluated before the next is built, so memory no longer grows 
+        // with the number of clusters. Results are unchanged. Default: false.
+        
+        bool    stream_4b;
+        int     stream_4b_tile;
+        
+        // If true (the default), the pair and cluster lists refer to a table of the distinct atom pairs of the frame, 
+        // whose distances and displacements are computed once per calculate call instead of once per pair and cluster
+        // (see simulation_system::build_edges).
+        
+        bool    use_edge_table;
+        
+        // If true, calculate orders the atoms along a Morton (Z-order) curve through the cell before building ghosts and
+        // neighbor lists, so that atoms close in space are also close in memory. Forces and per-atom quantities are 
+        // returned in the input order. Results agree with the unsorted calculation to round-off. Default: false.
+        
+        bool    spatial_sort;
+        
+        // Incremental energies for single-atom Monte Carlo moves. mc_init stores the system and builds neighbor lists
+        // with cutoffs padded by mc_skin, which are reused until an atom has moved by more than mc_skin/2. Each 
+        // mc_delta_energy call moves an atom (with its periodic images) on trial and returns the change in energy, 
+        // from the 1- to 4-body interactions involving that atom only; the trial is then closed by mc_accept or 
+        // mc_reject. Atom indices follow the input coordinate vectors.
+        
+        double  mc_skin;    // Neighbor list skin for mc_init (Angstrom); moves may not exceed mc_skin/2
+        
+        void    mc_init(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy);
+        double  mc_delta_energy(int atom, double dx, double dy, double dz);
+        void    mc_accept();
+        void    mc_reject();
+        double  mc_local_energy(int atom);    // Energy of all interactions involving atom
+        double  mc_total_energy();            // Energy of the current configuration, from the cached lists
+        void    mc_get_coords(vector<double> & x_out, vector<double> & y_out, vector<double> & z_out);
 
     private:
 
         simulation_system sys;      // Input system
         simulation_system neigh;    // Re-oriented ss
         
+        bool warned_replication;    // Whether the replication warning has been printed
+        
+        void warn_replication(const simulation_system & system);
+        
         vector<string>    type_list;   // A list of possible unique atom types and thier corresponding numerical index, per the parameter file
         
         double max_2b_cut;    // Maximum 2-body outer cutoff
@@ -114,8 +246,16 @@ class serial_chimes_interface : public chimesFF
         double max_4b_cut;    // Maximum 4-body outer cutoff
         
         vector<vector<int> > neighlist_2b;    // [real atom index][list of real/ghost atom neighbors]
-        vector<vector<int> > neighlist_3b;    // [interaction set index][list of 3 atoms within interaction range] -- currently unused
-        vector<vector<int> > neighlist_4b;    // [interaction set index][list of 4 atoms within interaction range] -- currently unused    
+        vector<int>          neighlist_3b;    // [cluster][atom]; 3 atoms within interaction range
+        vector<int>          neighlist_4b;    // [cluster][atom]; 4 atoms within interaction range (unless stream_4b)
+        vector<int>          tile_4b;         // [cluster][atom]; current tile of 4-body clusters (see stream_4b)
+        vector<int>          tile_4b_edges;   // [cluster][edge]; ... and their edges, with use_edge_table
+        
+        vector<double>       edge_dx;         // [edge]; distances of the neigh edge table (see use_edge_table)
+        vector<double>       edge_dr;         // [edge][x,y,z]; ... and displacements
+        
+        void        fill_edge_table(int first);
+        inline void get_edge(int edge, double & dx, double * dr_out);
         
         // Pointers, etc for chimes calculator interfacing (2-body only for now)
         // To set up for many body calculations, see the LAMMPS implementation
@@ -133,9 +273,109 @@ class serial_chimes_interface : public chimesFF
         vector<int>                typ_idxs_2b;
         vector<int>                typ_idxs_3b;
         vector<int>                typ_idxs_4b;
+        
+        // Work buffers of calculate, kept across calls so that their storage is reused
+        
+        vector<double>             force_2b;          // [atom][x,y,z]; forces of one interaction
+        vector<double>             force_3b;
+        vector<double>             force_4b;
+        vector<double>             stress_chimes;     // [xx, xy, xz, yy, yz, zz]; system virial
+        vector<double>             stress_cl;         // ... of one interaction
+        vector<double>             energy_atoms;      // [input atom]; per-atom energies, if requested
+        vector<vector<double> >    stress_atoms;      // [input atom][9]; ... and virials
+        chimes2BTmp                chimes_2btmp;
+        chimes3BTmp                chimes_3btmp;
+        chimes4BTmp                chimes_4btmp;
 
     
         void build_neigh_lists(vector<string> & atmtyps, vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in);
+        
+        double energy_terms[5];     // See get_energy_terms
+        
+        void calculate_system(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy, vector<vector<double> > & force, vector<double> & stress, vector<double> * atom_energy, vector<vector<double> > * atom_stress);
+        void evaluate_system (vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps, double & energy, vector<vector<double> > & force, vector<double> & stress, vector<double> * atom_energy, vector<vector<double> > * atom_stress);
+        
+        // Spatially sorted copy of the input system (see spatial_sort); sort_order[a] is the input index of sorted atom a
+        
+        vector<int>             sort_order;
+        vector<pair<unsigned int, int> > sort_keys;    // [sorted atom][Morton code, input index]
+        vector<double>          sort_hmat, sort_invr_hmat;
+        vector<double>          sort_x, sort_y, sort_z;
+        vector<string>          sort_atmtyps;
+        vector<vector<double> > sort_force;
+        vector<double>          sort_atom_energy;
+        vector<vector<double> > sort_atom_stress;
+        
+        void sort_system(vector<double> & x_in, vector<double> & y_in, vector<double> & z_in, vector<double> & cella_in, vector<double> & cellb_in, vector<double> & cellc_in, vector<string> & atmtyps);
+        void tally_per_atom(int natoms, const int * atoms, double energy_cl, const vector<double> & stress_cl, double & energy, vector<double> & stress, vector<double> & energy_atoms, vector<vector<double> > & stress_atoms);
+        
+        // Edge polynomial cache for calculate (see cache_edge_polys). Clusters are listed by root (first) atom, and all
+        // other atoms of a cluster are neighbors of the root. The polynomials of each (edge, edge variant) of the current
+        // root's clusters are computed on first use, and dropped when the root changes.
+        
+        vector<int>       edge_slot;          // [real/ghost atom]; slot of the atom in the cache, -1 if none
+        vector<int>       edge_slot_atoms;    // Atoms holding a slot
+        int               edge_nslots;        // Number of slots
+        int               edge_root;          // Root atom of the cached edges
+        vector<int>       edge_poly_idx;      // [(slot a*edge_nslots + slot b)*nvariants + variant]; offset in edge_polys, -1 if unset
+        vector<int>       edge_poly_set;      // Set entries of edge_poly_idx
+        vector<double>    edge_polys;         // G, then dG, of each cached (edge, variant)
+        vector<double>    force_scalar_mb;    // Unused per-pair force scalars of compute_3B_edges/compute_4B_edges
+        
+        void    edge_cache_init();
+        bool    edge_cache_stale(int root, int natoms);
+        void    edge_cache_root(int root, int natoms);
+        int     edge_cache_find(int a, int b, int variant, double dx);
+        void    compute_3B_cached(const int * atoms, vector<double> & force, vector<double> & stress, double & energy, chimes3BTmp & tmp);
+        void    compute_4B_cached(const int * atoms, vector<double> & force, vector<double> & stress, double & energy, chimes4BTmp & tmp);
+        
+        // Cluster queues for blocked evaluation, [type index]. Queued clusters refer to the edge cache, so all queues
+        // are flushed before the cache is dropped.
+        
+        vector<cluster_queue>   queue_3b;
+        vector<cluster_queue>   queue_4b;
+        vector<const double*>   block_G;        // [cluster][edge]; edge polynomials of a flushed queue
+        vector<const double*>   block_dG;
+        vector<double>          block_force;    // [cluster][atom][x,y,z]
+        chimesBlockTmp          block_tmp;
+        
+        void    queue_cluster(int natoms, const int * atoms, vector<vector<double> > & force, vector<double> & stress, double & energy, chimes3BTmp & tmp_3b, chimes4BTmp & tmp_4b);
+        void    flush_queue(int natoms, cluster_queue & queue, vector<vector<double> > & force, vector<double> & stress, double & energy);
+        void    flush_queues(int natoms, vector<vector<double> > & force, vector<double> & stress, double & energy);
+        
+        // Persistent state for the Monte Carlo functions
+        
+        simulation_system mc_sys;               // Real+ghost atoms at the current coordinates
+        
+        vector<double>    mc_x, mc_y, mc_z;     // Current (input) coordinates
+        vector<double>    mc_x_ref, mc_y_ref, mc_z_ref;    // ... when the lists were last built
+        vector<double>    mc_cella, mc_cellb, mc_cellc;
+        vector<string>    mc_atmtyps;
+        
+        vector<int>          mc_neighlist_2b;   // [pair][i, j]
+        vector<int>          mc_neighlist_3b;   // As neighlist_3b, with padded cutoffs
+        vector<int>          mc_neighlist_4b;
+        
+        vector<vector<int> > mc_images;         // [input atom][real/ghost atoms that are copies of it]
+        vector<vector<int> > mc_pairs;          // [input atom][mc_neighlist_2b entries involving it]
+        vector<vector<int> > mc_trips;          // [input atom][mc_neighlist_3b entries involving it]
+        vector<vector<int> > mc_quads;          // [input atom][mc_neighlist_4b entries involving it]
+        
+        int               mc_trial_atom;        // Atom of the pending trial move (-1 if none)
+        double            mc_trial_disp[3];     // ... its displacement
+        vector<double>    mc_trial_old;         // ... and the previous coordinates of its images
+        
+        vector<double>    mc_force;             // Unused force/stress buffers for the compute functions
+        vector<double>    mc_stress;
+        chimes2BTmp       mc_2btmp;
+        chimes3BTmp       mc_3btmp;
+        chimes4BTmp       mc_4btmp;
+        
+        void    mc_build();
+        void    mc_move(int atom, double dx, double dy, double dz);
+        void    mc_add_2b(int idx, double & energy);
+        void    mc_add_3b(int idx, double & energy);
+        void    mc_add_4b(int idx, double & energy);
 };
 
 inline double simulation_system::get_dist(int i,int j, vector<double> & rij)
@@ -207,9 +447,57 @@ inline double simulation_system::get_dist(int i,int j, double *rij)
 
 }
 
+inline void serial_chimes_interface::get_edge(int edge, double & dx, double * dr_out)
+{
+    // Distance and displacement of an edge of the neigh edge table, reversed for ~edge
+    
+    if (edge >= 0)
+    {
+        dx = edge_dx[edge];
+        
+        for (int d=0; d<CHDIM; d++)
+            dr_out[d] = edge_dr[edge*CHDIM+d];
+    }
+    else
+    {
+        dx = edge_dx[~edge];
+        
+        for (int d=0; d<CHDIM; d++)
+            dr_out[d] = -edge_dr[(~edge)*CHDIM+d];
+    }
+}
+
+inline int simulation_system::find_edge(int i, const vector<int> & nlist, int sa, int sb)
+{
+    // Edge between the atoms in slots sa and sb of root i's clusters, numbered on first use; ~edge if sa > sb
+    
+    int lo = (sa < sb) ? sa : sb;
+    int hi = (sa < sb) ? sb : sa;
+    int e;
+    
+    if (lo == 0)
+        e = edge_2b_start[i] + hi - 1;
+    else
+    {
+        int & entry = root_edge[lo*root_edge_nslots + hi];
+        
+        if (entry < 0)
+        {
+            entry = edge_atoms.size()/2;
+            
+            edge_atoms.push_back(nlist[lo-1]);
+            edge_atoms.push_back(nlist[hi-1]);
+            root_edge_set.push_back(lo*root_edge_nslots + hi);
+        }
+        e = entry;
+    }
+    
+    return (sa < sb) ? e : ~e;
+}
+
 inline double simulation_system::get_dist(int i,int j)
 {
-    vector<double> rij(3);
+    double rij[3];
     
     return get_dist(i,j,rij);
 }